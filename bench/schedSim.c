@@ -0,0 +1,319 @@
+/**
+ * @file schedSim.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Host model of the audio scheduler, convolving with interrupts masked or in a deferred DSP task
+ * @version 0.1
+ * @date 2021-12-27
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ * @details
+ * Threads stand in for each priority level of the firmware. A DMA thread raises an event every
+ * period and wakes the audio update, a USB thread takes an interrupt every frame, and masking
+ * interrupts is a mutex both of them have to take on entry, so their lateness is the ISR latency
+ * the firmware would see.
+ *
+ * In the masked model the update convolves with the mutex held, like ConvolvIR::update() without
+ * UPOLS_DEFERRED_DSP. In the deferred model the update only moves blocks through the dspSched
+ * queues and a DSP thread convolves without the mutex, like ConvolvIR::dspTask(). Both run on
+ * the scheduler from lib/upols/dspSched.c, so its counters and worst cases are reported as is.
+ * Processing time is slept rather than spun, so the model behaves the same on a single-core host.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "dspSched.h"
+
+enum SimLengths
+{
+	SimPeriods = 400,
+	SimPeriodNs = 2902494, // 128 frames at 44.1 kHz
+	SimUsbTickNs = 1000000 // Full-speed USB frames
+};
+
+typedef struct scenario_t
+{
+	const char *name;
+	float load;		 // Processing time as a share of the period
+	float spikeRate; // Share of blocks that take spikeLoad instead
+	float spikeLoad;
+} scenario_t;
+
+typedef struct tally_t
+{
+	uint32_t sent;		// Blocks that reached the output
+	uint32_t silent;	// Updates with nothing to send
+	uint32_t dropped;	// Blocks refused by a full queue or overtaken by a newer one
+	uint32_t reordered; // Blocks sent after a newer one, never expected
+} tally_t;
+
+// A wake-up that doesn't queue, like a pending bit in the NVIC
+typedef struct pend_t
+{
+	pthread_mutex_t lock;
+	pthread_cond_t signal;
+	bool pending;
+} pend_t;
+
+static dspSched_t sched;
+static const scenario_t *scenario;
+static bool deferred;
+static volatile bool finished;
+
+static pthread_mutex_t irqLock = PTHREAD_MUTEX_INITIALIZER; // Held while interrupts are masked
+static pend_t updatePend = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, false};
+static pend_t dspPend = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, false};
+
+static volatile uint32_t eventStamp;	 // SpdifTx::eventTimestamp()
+static volatile uint32_t eventLateness; // SpdifTx::eventLatency()
+static uint32_t usbLatency;
+static tally_t tally;
+
+static uint64_t nowNs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void sleepUntil(const uint64_t deadline)
+{
+	struct timespec ts = {(time_t)(deadline / 1000000000u), (long)(deadline % 1000000000u)};
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+static void pendWake(pend_t *pend)
+{
+	pthread_mutex_lock(&pend->lock);
+	pend->pending = true;
+	pthread_cond_signal(&pend->signal);
+	pthread_mutex_unlock(&pend->lock);
+}
+
+/**
+ * @brief Wait for a pended wake-up
+ *
+ * @param pend Wake-up
+ * @return false once the run is over
+ */
+static bool waitFor(pend_t *pend)
+{
+	pthread_mutex_lock(&pend->lock);
+	while (!pend->pending && !finished)
+	{
+		pthread_cond_wait(&pend->signal, &pend->lock);
+	}
+	pend->pending = false;
+	pthread_mutex_unlock(&pend->lock);
+	return !finished;
+}
+
+/**
+ * @brief The convolution, one block of synthetic load
+ *
+ * @param job Block
+ */
+static void process(const dspJob_t *job)
+{
+	dspSchedStart(&sched, job, (uint32_t)nowNs());
+	const bool spike = (float)rand() / (float)RAND_MAX < scenario->spikeRate;
+	sleepUntil(nowNs() + (uint64_t)((spike ? scenario->spikeLoad : scenario->load) * SimPeriodNs));
+	dspSchedFinish(&sched, job, (uint32_t)nowNs());
+}
+
+/**
+ * @brief Count a block reaching the output
+ *
+ * @param block Block number
+ * @param lastSent Newest block sent so far
+ */
+static void send(const uint32_t block, uint32_t *lastSent)
+{
+	if (block <= *lastSent)
+	{
+		tally.reordered++;
+	}
+	else
+	{
+		tally.sent++;
+		*lastSent = block;
+	}
+}
+
+/**
+ * @brief DSP task of the deferred model, below every interrupt
+ *
+ */
+static void *dspTask(void *arg)
+{
+	(void)arg;
+	while (waitFor(&dspPend))
+	{
+		dspJob_t job;
+		while (dspQueuePop(&sched.pending, &job))
+		{
+			process(&job);
+			if (!dspQueuePush(&sched.finished, &job))
+			{
+				tally.dropped++;
+			}
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief Audio update, once per DMA event
+ *
+ */
+static void *audioUpdate(void *arg)
+{
+	(void)arg;
+	uint32_t block = 0;
+	uint32_t lastSent = 0;
+
+	while (waitFor(&updatePend))
+	{
+		dspSchedEvent(&sched, eventStamp, eventLateness);
+		dspJob_t job = {(void *)(uintptr_t)++block, NULL, 0, 0};
+
+		if (deferred)
+		{
+			// Newest finished block goes out, older ones are dropped to hold the latency at one block
+			dspJob_t done;
+			uint32_t newest = 0;
+			while (dspQueuePop(&sched.finished, &done))
+			{
+				tally.dropped += (newest != 0);
+				newest = (uint32_t)(uintptr_t)done.left;
+			}
+			if (newest)
+			{
+				send(newest, &lastSent);
+			}
+			else if (block > 1)
+			{
+				tally.silent++;
+			}
+
+			if (dspSchedSubmit(&sched, &job, (uint32_t)nowNs()))
+			{
+				pendWake(&dspPend);
+			}
+			else
+			{
+				tally.dropped++;
+			}
+		}
+		else
+		{
+			// Convolve on the spot with interrupts masked
+			pthread_mutex_lock(&irqLock);
+			dspSchedSubmit(&sched, &job, (uint32_t)nowNs());
+			dspQueuePop(&sched.pending, &job);
+			process(&job);
+			send(block, &lastSent);
+			pthread_mutex_unlock(&irqLock);
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief USB interrupt every frame, noting how late it gets in
+ *
+ */
+static void *usbInterrupt(void *arg)
+{
+	(void)arg;
+	uint64_t tick = nowNs();
+	while (!finished)
+	{
+		tick += SimUsbTickNs;
+		sleepUntil(tick);
+		pthread_mutex_lock(&irqLock);
+		const uint32_t latency = (uint32_t)(nowNs() - tick);
+		pthread_mutex_unlock(&irqLock);
+		usbLatency = (latency > usbLatency) ? latency : usbLatency;
+	}
+	return NULL;
+}
+
+/**
+ * @brief Run one scenario with the DMA interrupt on this thread
+ *
+ * @param run Load to model
+ * @param deferDsp Convolve in the DSP task instead of the update
+ */
+static void simulate(const scenario_t *run, const bool deferDsp)
+{
+	scenario = run;
+	deferred = deferDsp;
+	finished = false;
+	usbLatency = 0;
+	memset(&tally, 0, sizeof(tally));
+	dspSchedInit(&sched, SimPeriodNs);
+
+	pthread_t threads[3];
+	pthread_create(&threads[0], NULL, audioUpdate, NULL);
+	pthread_create(&threads[1], NULL, dspTask, NULL);
+	pthread_create(&threads[2], NULL, usbInterrupt, NULL);
+
+	uint64_t periodStart = nowNs();
+	for (size_t period = 0; period < SimPeriods; period++)
+	{
+		periodStart += SimPeriodNs;
+		sleepUntil(periodStart);
+
+		pthread_mutex_lock(&irqLock);
+		eventStamp = (uint32_t)nowNs();
+		eventLateness = eventStamp - (uint32_t)periodStart;
+		pthread_mutex_unlock(&irqLock);
+		pendWake(&updatePend);
+	}
+
+	// Let the last job finish before stopping
+	sleepUntil(nowNs() + 2 * SimPeriodNs);
+	finished = true;
+	pendWake(&updatePend);
+	pendWake(&dspPend);
+	for (size_t i = 0; i < 3; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+
+	printf("%-9s %-22s %6u %6u %7u %8u %8u %10.0f %10.0f %9.0f%%\n", deferDsp ? "deferred" : "masked", run->name, tally.sent,
+		   tally.silent, tally.dropped, sched.deadlineMisses, sched.overruns, sched.eventLatency / 1000.0f, usbLatency / 1000.0f,
+		   100.0f * sched.completion / SimPeriodNs);
+	if (tally.reordered)
+	{
+		printf("          %u blocks sent out of order\n", tally.reordered);
+	}
+}
+
+int main(void)
+{
+	static const scenario_t scenarios[] = {
+		{"50% load", 0.5f, 0.0f, 0.0f},
+		{"90% load", 0.9f, 0.0f, 0.0f},
+		{"50% load, 2% at 150%", 0.5f, 0.02f, 1.5f},
+		{"110% load", 1.1f, 0.0f, 0.0f},
+	};
+
+	srand(1);
+	printf("%d periods of %d us per scenario, USB frames every %d us\n\n", SimPeriods, SimPeriodNs / 1000, SimUsbTickNs / 1000);
+	printf("%-9s %-22s %6s %6s %7s %8s %8s %10s %10s %10s\n", "Model", "Scenario", "sent", "silent", "dropped", "missed",
+		   "overruns", "DMA us", "USB us", "complete");
+	for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++)
+	{
+		simulate(&scenarios[i], false);
+		simulate(&scenarios[i], true);
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,141 @@
+/**
+ * @file silenceCheck.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Host check that UPOLS_SILENCE_BYPASS never cuts off the tail of the filter
+ * @version 0.1
+ * @date 2021-12-30
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ * @details
+ * The HRIR is a single tap at the very end of each ear's filter, so one block of input comes back
+ * a whole filter length later and nothing in between. Everything after that one block is silent,
+ * which is the worst case for the bypass: the output it has to wait for is preceded by silence.
+ * The output of the uniform and the head / tail paths is compared against the same block delayed
+ * by hand.
+ *
+ * Usage: silenceCheck, exits with failure if either path loses the echo
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "upols.h"
+
+#if defined(UPOLS_SUBBAND) || defined(UPOLS_MINIMUM_PHASE) || defined(UPOLS_ROOM) || defined(UPOLS_STEREO_MATRIX)
+#error "silenceCheck compares against a plain delay, build it without UPOLS_SUBBAND, UPOLS_MINIMUM_PHASE, UPOLS_ROOM and UPOLS_STEREO_MATRIX"
+#endif
+
+enum CheckLengths
+{
+	CheckBlocks = PartitionCount + 4, // Past the echo and the bypass kicking in
+	CheckSamples = CheckBlocks * PartitionSize
+};
+
+static const float32_t tapGain[2] = {0.5f, 0.25f};
+static const float32_t tolerance = 1e-4f;
+
+float32_t irTable[2 * ImpulseSamples];
+const uint16_t irCount = 1;
+
+static int16_t input[2][CheckSamples];
+static float32_t expected[2][CheckSamples];
+
+/**
+ * @brief One block of a different tone in each channel, then silence, and what the last taps make of it. Both tones start
+ * at zero, so the block before the echo is silent as well
+ *
+ */
+static void generateSignals(void)
+{
+	irTable[ImpulseSamples - 1] = tapGain[0];
+	irTable[2 * ImpulseSamples - 1] = tapGain[1];
+
+	for (size_t i = 0; i < PartitionSize; i++)
+	{
+		input[0][i] = (int16_t)(20000.0f * sinf(0.11f * (float32_t)i));
+		input[1][i] = (int16_t)(20000.0f * sinf(0.07f * (float32_t)i));
+	}
+
+	for (size_t channel = 0; channel < 2; channel++)
+	{
+		for (size_t i = ImpulseSamples - 1; i < CheckSamples; i++)
+		{
+			expected[channel][i] = tapGain[channel] * input[channel][i - (ImpulseSamples - 1)] / 32768.0f;
+		}
+	}
+}
+
+/**
+ * @brief Run the signal through one path of a fresh convolver
+ *
+ * @param name Path
+ * @param headTail Use upolsProcessHeadFloat() and upolsProcessTail() instead of upolsProcessFloat()
+ * @return Largest error against the delayed input
+ */
+static float32_t checkPath(const char *name, const bool headTail)
+{
+	upols_t *upols = upolsCreate();
+	if (!upols)
+	{
+		fprintf(stderr, "Not enough memory for the convolver\n");
+		exit(EXIT_FAILURE);
+	}
+	upolsSetFilters(upols, 0);
+
+	float32_t worst = 0.0f;
+	size_t worstBlock = 0;
+	size_t bypassed = 0;
+	for (size_t block = 0; block < CheckBlocks; block++)
+	{
+		const size_t offset = block * PartitionSize;
+		float32_t output[2][PartitionSize];
+		if (headTail)
+		{
+			upolsProcessHeadFloat(upols, &input[0][offset], &input[1][offset], output[0], output[1]);
+			upolsProcessTail(upols);
+		}
+		else
+		{
+			upolsProcessFloat(upols, &input[0][offset], &input[1][offset], output[0], output[1]);
+		}
+		bypassed += upolsBypassing(upols);
+
+		for (size_t channel = 0; channel < 2; channel++)
+		{
+			for (size_t i = 0; i < PartitionSize; i++)
+			{
+				const float32_t error = fabsf(output[channel][i] - expected[channel][offset + i]);
+				if (error > worst)
+				{
+					worst = error;
+					worstBlock = block;
+				}
+			}
+		}
+	}
+
+	printf("%-26s %12.3g %12zu %12zu\n", name, worst, worstBlock, bypassed);
+	upolsDestroy(upols);
+	return worst;
+}
+
+int main(void)
+{
+	generateSignals();
+
+	printf("%u partitions, echo in blocks %u and %u\n\n", PartitionCount, PartitionCount - 1, PartitionCount);
+	printf("%-26s %12s %12s %12s\n", "Path", "max error", "in block", "bypassed");
+	const float32_t uniform = checkPath("upolsProcessFloat()", false);
+	const float32_t headTail = checkPath("upolsProcessHeadFloat()", true);
+
+	if ((uniform > tolerance) || (headTail > tolerance))
+	{
+		printf("\nFAIL: output differs from the delayed input by more than %g\n", tolerance);
+		return EXIT_FAILURE;
+	}
+	printf("\nOK\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,79 @@
+/**
+ * @file templateEngines.cpp
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Benchmark stages for UpolsEngine instantiations
+ * @version 0.1
+ * @date 2021-12-15
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ * @details
+ * Each stage pushes TemplateBenchSamples of stereo audio through one instantiation, so the times
+ * compare directly: smaller partitions pay for more FFTs and CMAC passes per sample.
+ *
+ */
+
+#include "templateEngines.h"
+#include "upolsEngine.h"
+
+static int16_t leftSource[TemplateBenchSamples];
+static int16_t rightSource[TemplateBenchSamples];
+static int16_t leftAudio[TemplateBenchSamples];
+static int16_t rightAudio[TemplateBenchSamples];
+
+static UpolsEngine<64, ImpulseSamples / 64> engine64;
+static UpolsEngine<128, ImpulseSamples / 128> engine128;
+static UpolsEngine<256, ImpulseSamples / 256> engine256;
+static decltype(engine64)::Filters filters64;
+static decltype(engine128)::Filters filters128;
+static decltype(engine256)::Filters filters256;
+
+template <typename Engine>
+static void prepare(Engine *engine, typename Engine::Filters *filters)
+{
+	const hrirBlend_t blend = {{0, 0, 0}, {1.0f, 0.0f, 0.0f}};
+	Engine::computeFilters(filters, &blend);
+	engine->reset();
+	engine->attachFilters(filters);
+}
+
+template <size_t PartitionSamples, typename Engine>
+static void run(Engine *engine)
+{
+	memcpy(leftAudio, leftSource, sizeof(leftAudio));
+	memcpy(rightAudio, rightSource, sizeof(rightAudio));
+	for (size_t i = 0; i < TemplateBenchSamples; i += PartitionSamples)
+	{
+		engine->convolve(&leftAudio[i], &rightAudio[i]);
+	}
+}
+
+/**
+ * @brief Compute filters for every instantiation from irTable, which must already be filled
+ *
+ * @param leftInput TemplateBenchSamples of left channel input
+ * @param rightInput TemplateBenchSamples of right channel input
+ */
+void templateEnginesInit(const int16_t *leftInput, const int16_t *rightInput)
+{
+	memcpy(leftSource, leftInput, sizeof(leftSource));
+	memcpy(rightSource, rightInput, sizeof(rightSource));
+	prepare(&engine64, &filters64);
+	prepare(&engine128, &filters128);
+	prepare(&engine256, &filters256);
+}
+
+void stageTemplateEngine64(void)
+{
+	run<64>(&engine64);
+}
+
+void stageTemplateEngine128(void)
+{
+	run<128>(&engine128);
+}
+
+void stageTemplateEngine256(void)
+{
+	run<256>(&engine256);
+}
@@ -0,0 +1,31 @@
+/**
+ * @file templateEngines.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Benchmark stages for UpolsEngine instantiations
+ * @version 0.1
+ * @date 2021-12-15
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ */
+
+#pragma once
+
+#include "upols.h"
+
+enum TemplateBench
+{
+	TemplateBenchSamples = 256 // Samples per stage call, so every partition size does the same work
+};
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+	void templateEnginesInit(const int16_t *leftInput, const int16_t *rightInput);
+	void stageTemplateEngine64(void);
+	void stageTemplateEngine128(void);
+	void stageTemplateEngine256(void);
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,308 @@
+/**
+ * @file txRingSim.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Host model of the S/PDIF transmit ring with UPOLS_DIRECT_OUTPUT
+ * @version 0.1
+ * @date 2021-12-23
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ * @details
+ * One thread stands in for the eDMA: every period it moves to the other half of the ring, calls
+ * txRingDmaEvent() like SpdifTx::dmaISR() does, and then reads the half a few frames at a time over
+ * the rest of the period. Another thread stands in for the audio update: each DMA event wakes it to
+ * acquire a half, spend a synthetic processing time, fill the half, publish it and commit it.
+ *
+ * The producer fills a private copy of the half, which stands in for its data cache, and only
+ * writes it back a cache line at a time between txRingPublish() and txRingCommit(), like
+ * SpdifTx::commitHalf(). The DMA event zeroes a half it silences and discards the producer's copy
+ * of it, with a lock that makes it atomic against each line written back, as the interrupt is
+ * against the code it preempts.
+ *
+ * Every word the producer writes carries its block number, so the DMA side can tell what each
+ * half actually played: the next block, silence, a block that skipped ahead, or a torn mix of two.
+ * A torn half fails the run. Timer jitter of the host shows up as the odd underrun or late half
+ * even at low load.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "txRing.h"
+
+enum SimLengths
+{
+	SimPeriods = 600,
+	SimPeriodNs = 1000000, // Scaled down from 2.9 ms so the model runs quickly
+	SimReadChunks = 8,	   // Reads of the DMA per period
+	SimLineWords = 8	   // Words per line of the data cache
+};
+
+typedef struct scenario_t
+{
+	const char *name;
+	float load;		  // Processing time as a share of the period
+	float spikeRate;  // Share of blocks that take spikeLoad instead
+	float spikeLoad;
+} scenario_t;
+
+typedef struct tally_t
+{
+	uint32_t played;   // Halves holding the block after the previous one
+	uint32_t silent;   // Halves zeroed by the DMA event
+	uint32_t skipped;  // Halves holding a later block than expected, the ones in between were dropped
+	uint32_t torn;	   // Halves holding more than one block, or a block and silence
+} tally_t;
+
+static int32_t fifoTx[TxRingHalves * TxRingHalfWords];
+static txRing_t txRing;
+
+// The producer's data cache over fifoTx, written back line by line
+static int32_t cache[TxRingHalves * TxRingHalfWords];
+static volatile bool dirty[TxRingHalves * TxRingHalfWords / SimLineWords];
+static pthread_mutex_t cpuLock = PTHREAD_MUTEX_INITIALIZER; // Held by the DMA event, and by the producer per line
+
+static const scenario_t *scenario;
+static pthread_mutex_t wakeLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wakeSignal = PTHREAD_COND_INITIALIZER;
+static uint32_t pendingWakes;
+static bool finished;
+
+static uint64_t nowNs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void sleepUntil(const uint64_t deadline)
+{
+	struct timespec ts = {(time_t)(deadline / 1000000000u), (long)(deadline % 1000000000u)};
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+/**
+ * @brief arm_dcache_flush_delete() of the words the producer wrote, one line at a time
+ *
+ * @param half Half of fifoTx
+ */
+static void flushHalf(int32_t *half)
+{
+	const size_t first = (size_t)(half - fifoTx);
+	for (size_t line = first / SimLineWords; line < (first + TxRingHalfWords) / SimLineWords; line++)
+	{
+		pthread_mutex_lock(&cpuLock);
+		if (dirty[line])
+		{
+			memcpy(&fifoTx[SimLineWords * line], &cache[SimLineWords * line], sizeof(int32_t) * SimLineWords);
+			dirty[line] = false;
+		}
+		pthread_mutex_unlock(&cpuLock);
+	}
+}
+
+/**
+ * @brief arm_dcache_delete(), the words the producer wrote never reach fifoTx
+ *
+ * @param half Half of fifoTx
+ */
+static void discardHalf(const int32_t *half)
+{
+	const size_t first = (size_t)(half - fifoTx);
+	for (size_t line = first / SimLineWords; line < (first + TxRingHalfWords) / SimLineWords; line++)
+	{
+		dirty[line] = false;
+	}
+}
+
+/**
+ * @brief Audio update: one block per DMA event, written in place
+ *
+ */
+static void *producer(void *arg)
+{
+	(void)arg;
+	uint32_t block = 0;
+
+	while (1)
+	{
+		pthread_mutex_lock(&wakeLock);
+		while (!pendingWakes && !finished)
+		{
+			pthread_cond_wait(&wakeSignal, &wakeLock);
+		}
+		if (finished)
+		{
+			pthread_mutex_unlock(&wakeLock);
+			return NULL;
+		}
+		pendingWakes--;
+		pthread_mutex_unlock(&wakeLock);
+
+		block++;
+		int32_t *half = txRingAcquire(&txRing);
+
+		// Processing time is slept rather than spun, so the model behaves the same on a single-core host
+		const bool spike = (float)rand() / (float)RAND_MAX < scenario->spikeRate;
+		sleepUntil(nowNs() + (uint64_t)((spike ? scenario->spikeLoad : scenario->load) * SimPeriodNs));
+
+		if (half)
+		{
+			// The convolver's output lands in the cache at the end of its work
+			const size_t first = (size_t)(half - fifoTx);
+			for (size_t i = first; i < first + TxRingHalfWords; i++)
+			{
+				cache[i] = (int32_t)block;
+				dirty[i / SimLineWords] = true;
+			}
+
+			if (txRingPublish(&txRing, half))
+			{
+				flushHalf(half);
+				txRingCommit(&txRing, half);
+			}
+			else
+			{
+				discardHalf(half);
+			}
+		}
+	}
+}
+
+/**
+ * @brief Classify what a half played
+ *
+ * @param words Words read by the DMA
+ * @param expected Block that should be in it
+ * @param tally Counts to update
+ * @return Block played, or expected - 1 when nothing moved the stream on
+ */
+static uint32_t classify(const int32_t *words, const uint32_t expected, tally_t *tally)
+{
+	const int32_t first = words[0];
+	for (size_t i = 1; i < TxRingHalfWords; i++)
+	{
+		if (words[i] != first)
+		{
+			tally->torn++;
+			return expected;
+		}
+	}
+
+	if (first == 0)
+	{
+		tally->silent++;
+		return expected - 1;
+	}
+	if ((uint32_t)first == expected)
+	{
+		tally->played++;
+	}
+	else
+	{
+		tally->skipped++;
+	}
+	return (uint32_t)first;
+}
+
+/**
+ * @brief Run one scenario with a DMA loop on this thread
+ *
+ * @param run Load to model
+ * @return false if any half played torn
+ */
+static bool simulate(const scenario_t *run)
+{
+	scenario = run;
+	finished = false;
+	pendingWakes = 0;
+	txRingInit(&txRing, fifoTx);
+
+	pthread_t thread;
+	pthread_create(&thread, NULL, producer, NULL);
+
+	tally_t tally = {0};
+	uint32_t lastBlock = 0;
+	size_t playing = 0;
+	uint64_t periodStart = nowNs();
+
+	for (size_t period = 0; period < SimPeriods; period++)
+	{
+		// Half / major interrupt: the DMA moves on and the update is triggered
+		playing = !playing;
+		pthread_mutex_lock(&cpuLock);
+		if (txRingDmaEvent(&txRing, playing))
+		{
+			// Flushing the zeroes takes the producer's lines for this half with them
+			discardHalf(&fifoTx[TxRingHalfWords * playing]);
+		}
+		pthread_mutex_unlock(&cpuLock);
+		pthread_mutex_lock(&wakeLock);
+		pendingWakes++;
+		pthread_cond_signal(&wakeSignal);
+		pthread_mutex_unlock(&wakeLock);
+
+		// The DMA takes the half a few frames at a time over the period
+		int32_t words[TxRingHalfWords];
+		const int32_t *half = &fifoTx[TxRingHalfWords * playing];
+		for (size_t chunk = 0; chunk < SimReadChunks; chunk++)
+		{
+			const size_t chunkWords = TxRingHalfWords / SimReadChunks;
+			for (size_t i = chunk * chunkWords; i < (chunk + 1) * chunkWords; i++)
+			{
+				words[i] = __atomic_load_n(&half[i], __ATOMIC_RELAXED);
+			}
+			sleepUntil(periodStart + (chunk + 1) * (SimPeriodNs / SimReadChunks));
+		}
+		periodStart += SimPeriodNs;
+
+		// The first period plays the silence the ring starts with
+		if (period)
+		{
+			lastBlock = classify(words, lastBlock + 1, &tally);
+		}
+	}
+
+	pthread_mutex_lock(&wakeLock);
+	finished = true;
+	pthread_cond_signal(&wakeSignal);
+	pthread_mutex_unlock(&wakeLock);
+	pthread_join(thread, NULL);
+
+	// Less the start-up underrun, the first update only runs after the DMA has moved into the second half
+	printf("%-26s %8u %8u %8u %8u %10u %8u %10u\n", run->name, tally.played, tally.silent, tally.skipped, tally.torn,
+		   (unsigned)txRing.underruns - 1, (unsigned)txRing.lateHalves, (unsigned)txRing.overruns);
+	return tally.torn == 0;
+}
+
+int main(void)
+{
+	static const scenario_t scenarios[] = {
+		{"50% load", 0.5f, 0.0f, 0.0f},
+		{"90% load", 0.9f, 0.0f, 0.0f},
+		{"50% load, 2% at 150%", 0.5f, 0.02f, 1.5f},
+		{"110% load", 1.1f, 0.0f, 0.0f},
+	};
+
+	srand(1);
+	printf("%d periods of %d us per scenario\n\n", SimPeriods - 1, SimPeriodNs / 1000);
+	printf("%-26s %8s %8s %8s %8s %10s %8s %10s\n", "Scenario", "played", "silent", "skipped", "torn", "underruns", "late",
+		   "overruns");
+	bool intact = true;
+	for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++)
+	{
+		intact &= simulate(&scenarios[i]);
+	}
+
+	if (!intact)
+	{
+		printf("\nFAIL: the DMA played a half the producer was still writing\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
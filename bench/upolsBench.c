@@ -0,0 +1,545 @@
+/**
+ * @file upolsBench.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Host benchmark for libupols
+ * @version 0.1
+ * @date 2021-12-04
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ * @details
+ * Times each stage of a 128-sample convolution block against a synthetic HRIR table.
+ * Engines that do uneven work per block (NUPOLS) should be judged on the worst column: calls
+ * are grouped by their position in a cycle of CycleBlocks blocks, and the worst column is the
+ * slowest position by median, so host noise doesn't count but a block that always does more does.
+ * Estimated M7 cycles are the host time scaled to a 600 MHz core clock and multiplied
+ * by a host-to-M7 slowdown factor (-s) that should be calibrated against the pin 33
+ * measurement on hardware.
+ *
+ * Usage: upolsBench [-n iterations] [-s m7Scale]
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "upols.h"
+#include "nupols.h"
+#include "interpolation.h"
+#include "templateEngines.h"
+#include "virtualizer.h"
+
+enum BenchDefaults
+{
+	DefaultIterations = 2000,
+	M7ClockMHz = 600,
+	BenchCellTriangles = 24, // Candidates per lookup cell, typical of a ~1000 direction set
+	CycleBlocks = 16		 // Blocks before the non-uniform engine's firing pattern repeats
+};
+
+typedef struct bench_t
+{
+	const char *stageName;
+	void (*stageFunction)(void);
+} bench_t;
+
+float32_t irTable[2 * ImpulseSamples];
+const uint16_t irCount = 1;
+#ifdef UPOLS_MINIMUM_PHASE
+float32_t irDelay[1][2] = {{0.0f, 20.5f}};
+#endif
+
+// The non-uniform layout only covers the default 8192-tap filters
+#if UPOLS_PARTITION_COUNT == 64
+#define BENCH_NUPOLS
+#endif
+
+// Lookup cost only depends on the number of candidates per cell, so every cell shares the same list
+static const uint16_t benchTriangles[BenchCellTriangles][BlendDirections];
+static float32_t benchInverse[BenchCellTriangles][9];
+static uint32_t benchCellStart[TriangulationCellCount + 1];
+static uint16_t benchCellTriangles[TriangulationCellCount * BenchCellTriangles];
+const triangulation_t triangulation = {BenchCellTriangles, benchTriangles, benchInverse, benchCellStart, benchCellTriangles};
+
+#ifdef UPOLS_STEREO_MATRIX
+static const hrirBlend_t benchBlend = {
+	.irIndex = {0, 0, 0}, .weight = {0.5f, 0.3f, 0.2f}, .rightIrIndex = {0, 0, 0}, .rightWeight = {0.5f, 0.3f, 0.2f}};
+#else
+static const hrirBlend_t benchBlend = {.irIndex = {0, 0, 0}, .weight = {0.5f, 0.3f, 0.2f}};
+#endif
+static uint32_t lookupCount;
+
+// Separate convolvers, so the hybrid stages don't disturb the state of the uniform ones
+static upols_t *upols;
+static upols_t *hybrid;
+static virtualizer_t *virtualizer;
+#ifdef BENCH_NUPOLS
+static nupols_t *nupols;
+#endif
+
+static int16_t leftInput[PartitionSize];
+static int16_t rightInput[PartitionSize];
+static int16_t leftAudio[PartitionSize];
+static int16_t rightAudio[PartitionSize];
+static float32_t leftAudioData[PartitionSize];
+static float32_t rightAudioData[PartitionSize];
+static float32_t spectra[512];
+static float32_t accum[512];
+static float32_t accumRight[512];
+static float32_t delayLine[4 * HalfSpectrumBins * PartitionCount]; // Large enough to view as half spectra
+static float32_t filter[512 * PartitionCount];
+static float32_t rightFilter[512 * PartitionCount];
+static int16_t compactDelayLine[512 * PartitionCount];
+static int16_t compactFilter[512 * PartitionCount];
+static float32_t compactScale[PartitionCount];
+
+/**
+ * @brief Fill the IR table with exponentially decaying noise, one HRIR per ear
+ *
+ */
+static void generateIrTable(void)
+{
+	srand(1);
+	for (size_t i = 0; i < 2 * ImpulseSamples; i++)
+	{
+		const float32_t noise = (float32_t)rand() / (float32_t)RAND_MAX - 0.5f;
+		irTable[i] = noise * expf(-6.9f * (float32_t)(i % ImpulseSamples) / ImpulseSamples);
+	}
+
+	for (size_t i = 0; i < 512 * PartitionCount; i++)
+	{
+		delayLine[i] = (float32_t)rand() / (float32_t)RAND_MAX - 0.5f;
+		filter[i] = (float32_t)rand() / (float32_t)RAND_MAX - 0.5f;
+		rightFilter[i] = (float32_t)rand() / (float32_t)RAND_MAX - 0.5f;
+	}
+
+	for (size_t i = 0; i < PartitionCount; i++)
+	{
+		compactScale[i] = packBfp512(&delayLine[512 * i], &compactDelayLine[512 * i]);
+		compactScale[i] *= packBfp512(&filter[512 * i], &compactFilter[512 * i]);
+	}
+
+	for (size_t i = 0; i < BenchCellTriangles; i++)
+	{
+		for (size_t j = 0; j < 9; j++)
+		{
+			benchInverse[i][j] = (float32_t)rand() / (float32_t)RAND_MAX - 0.5f;
+		}
+	}
+
+	for (size_t i = 0; i <= TriangulationCellCount; i++)
+	{
+		benchCellStart[i] = i * BenchCellTriangles;
+	}
+
+	for (size_t i = 0; i < TriangulationCellCount * BenchCellTriangles; i++)
+	{
+		benchCellTriangles[i] = i % BenchCellTriangles;
+	}
+}
+
+static void fillAudio(void)
+{
+	for (size_t i = 0; i < PartitionSize; i++)
+	{
+		leftInput[i] = (int16_t)(rand() >> 17);
+		rightInput[i] = (int16_t)(rand() >> 17);
+	}
+	memcpy(leftAudio, leftInput, sizeof(leftAudio));
+	memcpy(rightAudio, rightInput, sizeof(rightAudio));
+}
+
+static void stageQ15ToFloat(void)
+{
+	dspQ15ToFloat(leftAudio, leftAudioData, PartitionSize);
+	dspQ15ToFloat(rightAudio, rightAudioData, PartitionSize);
+}
+
+static void stageForwardFFT(void)
+{
+	cp512(delayLine, spectra);
+	dspCfft(spectra, 256, ForwardFFT);
+}
+
+static void stageCmac(void)
+{
+	clear512(accum);
+	for (size_t i = 0; i < PartitionCount; i++)
+	{
+		cmac512(&delayLine[512 * i], &filter[512 * i], accum);
+	}
+}
+
+static void stageCmacDual(void)
+{
+	clear512(accum);
+	clear512(accumRight);
+	for (size_t i = 0; i < PartitionCount; i++)
+	{
+		cmacDual512(&delayLine[512 * i], &filter[512 * i], &rightFilter[512 * i], accum, accumRight);
+	}
+}
+
+static void stageCmacBinMajor(void)
+{
+	// Same arrays viewed as bin-major, the cost doesn't depend on the content
+	clear512(accum);
+	clear512(accumRight);
+	cmacBinMajor512(delayLine, filter, rightFilter, PartitionCount, PartitionCount / 2, 0, accum, accumRight);
+}
+
+static void stageCmacHalf(void)
+{
+	// Left and right input half spectra follow each other in every slot, as with UPOLS_HALF_SPECTRUM
+	float32_t halfLeft[2 * HalfSpectrumBins];
+	float32_t halfRight[2 * HalfSpectrumBins];
+	memset(halfLeft, 0, sizeof(halfLeft));
+	memset(halfRight, 0, sizeof(halfRight));
+	for (size_t i = 0; i < PartitionCount; i++)
+	{
+		const float32_t *input = &delayLine[4 * HalfSpectrumBins * i];
+		cmacHalfDual512(input, &input[2 * HalfSpectrumBins], &filter[2 * HalfSpectrumBins * i], &rightFilter[2 * HalfSpectrumBins * i],
+						halfLeft, halfRight);
+	}
+	mergeHalf512(halfLeft, halfRight, accum);
+}
+
+static void stageCmacCompact(void)
+{
+	clear512(accum);
+	for (size_t i = 0; i < PartitionCount; i++)
+	{
+		cmacBfp512(&compactDelayLine[512 * i], &compactFilter[512 * i], compactScale[i], accum);
+	}
+}
+
+static void stageInverseFFT(void)
+{
+	cp512(filter, spectra);
+	dspCfft(spectra, 256, InverseFFT);
+}
+
+static void stageFloatToQ15(void)
+{
+	dspFloatToQ15(leftAudioData, leftAudio, PartitionSize);
+	dspFloatToQ15(rightAudioData, rightAudio, PartitionSize);
+}
+
+static void stageConvolve(void)
+{
+	memcpy(leftAudio, leftInput, sizeof(leftAudio));
+	memcpy(rightAudio, rightInput, sizeof(rightAudio));
+	upolsProcess(upols, leftAudio, rightAudio);
+}
+
+static void stageConvolveFloat(void)
+{
+	// Output left in float for a 24-bit sink, no copy of the input needed
+	upolsProcessFloat(upols, leftInput, rightInput, leftAudioData, rightAudioData);
+}
+
+static void stageConvolveInterleaved(void)
+{
+	// Straight from the IFFT buffers into 24-bit words, as into a half of the S/PDIF ring
+	static int32_t interleaved[2 * PartitionSize];
+	upolsProcessInterleaved(upols, leftInput, rightInput, interleaved);
+}
+
+#ifdef UPOLS_SILENCE_BYPASS
+static void stageConvolveSilent(void)
+{
+	// Bypassed once the tail has run out, which the warm-up and the first few iterations take care of
+	memset(leftAudio, 0, sizeof(leftAudio));
+	memset(rightAudio, 0, sizeof(rightAudio));
+	upolsProcess(upols, leftAudio, rightAudio);
+}
+#endif
+
+static void stageConvolveSwapping(void)
+{
+	if (!upolsFiltersPending(upols))
+	{
+		upolsRequestFilters(upols, 0);
+	}
+	stageConvolve();
+}
+
+static void stageConvolveBlending(void)
+{
+	if (!upolsFiltersPending(upols))
+	{
+		upolsRequestBlend(upols, &benchBlend);
+	}
+	stageConvolve();
+}
+
+static void stageHrirLookup(void)
+{
+	hrirBlend_t blend;
+	lookupCount++;
+#ifdef UPOLS_STEREO_MATRIX
+	stereoLookup(0.7f * lookupCount, fmodf(0.3f * lookupCount, 180.0f) - 90.0f, &blend);
+#else
+	hrirLookup(0.7f * lookupCount, fmodf(0.3f * lookupCount, 180.0f) - 90.0f, &blend);
+#endif
+}
+
+static void stageHybridHead(void)
+{
+	memcpy(leftAudio, leftInput, sizeof(leftAudio));
+	memcpy(rightAudio, rightInput, sizeof(rightAudio));
+	upolsProcessHead(hybrid, leftAudio, rightAudio);
+}
+
+static void stageHybridTail(void)
+{
+	upolsProcessTail(hybrid);
+}
+
+static void stageVirtualizer(void)
+{
+	// Every bed channel carries the same test signal, the cost doesn't depend on the content
+	const int16_t *bedAudio[MaxBedChannels];
+	for (size_t i = 0; i < MaxBedChannels; i++)
+	{
+		bedAudio[i] = (i & 1) ? rightInput : leftInput;
+	}
+	virtualizerProcess(virtualizer, bedAudio, leftAudio, rightAudio);
+}
+
+#ifdef BENCH_NUPOLS
+static void stageNupolsConvolve(void)
+{
+	memcpy(leftAudio, leftInput, sizeof(leftAudio));
+	memcpy(rightAudio, rightInput, sizeof(rightAudio));
+	nupolsConvolve(nupols, leftAudio, rightAudio);
+}
+
+static void stageNupolsProcessFilters(void)
+{
+	nupolsProcessFilters(nupols, 0);
+}
+#endif
+
+#ifdef UPOLS_ROOM
+static void stageRoom(void)
+{
+	roomProcess(&upols->room, upols->previousAudio, leftAudioData, rightAudioData, false);
+}
+#endif
+
+static void stageSetFilters(void)
+{
+	upolsSetFilters(upols, 0);
+}
+
+static double nanoseconds(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec * 1e9 + (double)now.tv_nsec;
+}
+
+static int compareTimes(const void *a, const void *b)
+{
+	const double diff = *(const double *)a - *(const double *)b;
+	return (diff > 0) - (diff < 0);
+}
+
+static double m7Cycles(double ns, double m7Scale)
+{
+	return ns * M7ClockMHz / 1000.0 * m7Scale;
+}
+
+/**
+ * @brief Median of the calls at one position in the block cycle
+ *
+ * @param callTimes Time of every call, in call order
+ * @param iterations Number of calls
+ * @param position Position in the cycle
+ * @param positionTimes Scratch buffer of at least iterations / CycleBlocks + 1 entries
+ */
+static double positionMedian(const double *callTimes, size_t iterations, size_t position, double *positionTimes)
+{
+	size_t count = 0;
+	for (size_t i = position; i < iterations; i += CycleBlocks)
+	{
+		positionTimes[count++] = callTimes[i];
+	}
+	qsort(positionTimes, count, sizeof(double), compareTimes);
+	return positionTimes[count / 2];
+}
+
+/**
+ * @brief Run a stage repeatedly and print its mean, 99th percentile and worst block time per call
+ *
+ * @param bench Stage to time
+ * @param iterations Number of timed calls
+ * @param m7Scale Host-to-M7 slowdown factor
+ */
+static void runBench(const bench_t *bench, size_t iterations, double m7Scale)
+{
+	double *callTimes = malloc(iterations * sizeof(double));
+	double *positionTimes = malloc((iterations / CycleBlocks + 1) * sizeof(double));
+	if (!callTimes || !positionTimes)
+	{
+		fprintf(stderr, "Unable to allocate timing buffer\n");
+		exit(EXIT_FAILURE);
+	}
+
+	bench->stageFunction(); // Warm caches and lazily initialized tables
+
+	double total = 0;
+	for (size_t i = 0; i < iterations; i++)
+	{
+		const double start = nanoseconds();
+		bench->stageFunction();
+		callTimes[i] = nanoseconds() - start;
+		total += callTimes[i];
+	}
+
+	double worst = 0;
+	for (size_t position = 0; (position < CycleBlocks) && (position < iterations); position++)
+	{
+		const double median = positionMedian(callTimes, iterations, position, positionTimes);
+		worst = (median > worst) ? median : worst;
+	}
+
+	qsort(callTimes, iterations, sizeof(double), compareTimes);
+	const double mean = total / (double)iterations;
+	const double p99 = callTimes[(iterations * 99) / 100];
+
+	printf("%-28s %12.1f %12.1f %12.1f %16.0f %16.0f\n", bench->stageName, mean, p99, worst, m7Cycles(mean, m7Scale),
+		   m7Cycles(worst, m7Scale));
+	free(callTimes);
+	free(positionTimes);
+}
+
+int main(int argc, char **argv)
+{
+	size_t iterations = DefaultIterations;
+	double m7Scale = 1.0;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:s:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n':
+			iterations = (size_t)strtoul(optarg, NULL, 10);
+			break;
+		case 's':
+			m7Scale = strtod(optarg, NULL);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n iterations] [-s m7Scale]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	generateIrTable();
+	fillAudio();
+	upols = upolsCreate();
+	hybrid = upolsCreate();
+	virtualizer = virtualizerCreate(Bed71);
+	if (!upols || !hybrid || !virtualizer)
+	{
+		fprintf(stderr, "Not enough memory for the convolvers\n");
+		return EXIT_FAILURE;
+	}
+	upolsSetFilters(upols, 0);
+	upolsSetFilters(hybrid, 0);
+#ifdef BENCH_NUPOLS
+	nupols = nupolsCreate();
+	if (!nupols)
+	{
+		fprintf(stderr, "Not enough memory for the convolvers\n");
+		return EXIT_FAILURE;
+	}
+	nupolsProcessFilters(nupols, 0);
+#endif
+
+	int16_t leftTemplateInput[TemplateBenchSamples];
+	int16_t rightTemplateInput[TemplateBenchSamples];
+	for (size_t i = 0; i < TemplateBenchSamples; i++)
+	{
+		leftTemplateInput[i] = leftInput[i % PartitionSize];
+		rightTemplateInput[i] = rightInput[i % PartitionSize];
+	}
+	templateEnginesInit(leftTemplateInput, rightTemplateInput);
+
+	const bench_t blockStages[] = {
+		{"q15 to float (2 ch)", stageQ15ToFloat},
+		{"forward FFT 256", stageForwardFFT},
+		{"CMAC pass (1 ear)", stageCmac},
+		{"CMAC pass, fused (2 ears)", stageCmacDual},
+		{"CMAC pass, bin-major (2 ears)", stageCmacBinMajor},
+		{"CMAC pass, half (2 ears)", stageCmacHalf},
+		{"CMAC pass, q15 BFP (1 ear)", stageCmacCompact},
+		{"inverse FFT 256", stageInverseFFT},
+		{"float to q15 (2 ch)", stageFloatToQ15},
+		{"upolsProcess() block", stageConvolve},
+		{"upolsProcessFloat() block", stageConvolveFloat},
+		{"upolsProcessInterleaved()", stageConvolveInterleaved},
+		{"upolsProcess() block, swap", stageConvolveSwapping},
+		{"upolsProcess() block, blend", stageConvolveBlending},
+#ifdef UPOLS_SILENCE_BYPASS
+		{"upolsProcess() block, silent", stageConvolveSilent},
+#endif
+		{"hrirLookup()", stageHrirLookup},
+#ifdef UPOLS_ROOM
+		{"roomProcess() block", stageRoom},
+#endif
+		{"virtualizerProcess() 7.1", stageVirtualizer},
+#ifdef BENCH_NUPOLS
+		{"nupolsConvolve() block", stageNupolsConvolve},
+#endif
+		{"upolsProcessHead() (in->out)", stageHybridHead},
+		{"upolsProcessTail() (defer)", stageHybridTail},
+		{"UpolsEngine<64> 256 samples", stageTemplateEngine64},
+		{"UpolsEngine<128> 256 samples", stageTemplateEngine128},
+		{"UpolsEngine<256> 256 samples", stageTemplateEngine256},
+	};
+
+	// Pruned builds only multiply the partitions and bins above their thresholds, so the upolsProcess() stages depend on them
+	printf("Active partitions: left %u, right %u of %u\n", upolsActivePartitions(upols, LeftFilter),
+		   upolsActivePartitions(upols, RightFilter), PartitionCount);
+	printf("Active bins: left %u, right %u of %u\n", (unsigned)upolsActiveBins(upols, LeftFilter),
+		   (unsigned)upolsActiveBins(upols, RightFilter), PartitionCount * HalfSpectrumBins);
+#ifdef UPOLS_SUBBAND
+	printf("Low-rate tail: %u partitions of %u-point FFTs after the %u full-rate ones\n\n", (unsigned)SubbandFilterPartitions, (unsigned)SubbandFftLength,
+		   (unsigned)PartitionCount);
+#else
+	printf("\n");
+#endif
+
+	printf("%-28s %12s %12s %12s %16s %16s\n", "Stage", "mean ns", "p99 ns", "worst ns", "mean M7 cycles", "worst M7 cycles");
+	for (size_t i = 0; i < sizeof(blockStages) / sizeof(blockStages[0]); i++)
+	{
+		runBench(&blockStages[i], iterations, m7Scale);
+	}
+
+	const bench_t filterStages[] = {
+		{"upolsSetFilters()", stageSetFilters},
+#ifdef BENCH_NUPOLS
+		{"nupolsProcessFilters()", stageNupolsProcessFilters},
+#endif
+	};
+
+	for (size_t i = 0; i < sizeof(filterStages) / sizeof(filterStages[0]); i++)
+	{
+		runBench(&filterStages[i], iterations / 100 + 1, m7Scale);
+	}
+
+	upolsDestroy(upols);
+	upolsDestroy(hybrid);
+	virtualizerDestroy(virtualizer);
+#ifdef BENCH_NUPOLS
+	nupolsDestroy(nupols);
+#endif
+
+	return EXIT_SUCCESS;
+}
@@ -15,6 +15,7 @@
 #include "subshell.h"
 #include "d3io.h"
 #include "convolvIR.h"
+#include "spdifTx.h"
 
 class Ash
 {
@@ -28,6 +29,16 @@ private:
 
 	static void toggle(void *);
 	static void setAngle(void *);
+#if defined(UPOLS_VIRTUALIZER)
+	static void setLayout(void *);
+#endif
+#if defined(CONVOLVIR_UPOLS) && (defined(UPOLS_PARTITION_PRUNING) || defined(UPOLS_BAND_PRUNING))
+	static void pruning(void *);
+#endif
+#if defined(UPOLS_DEFERRED_DSP)
+	static void scheduler(void *);
+#endif
+	static void transmitRing(void *);
 	static void currentStatus(void *);
 	static void audioPassthrough(void *);
 	static void audioMemory(void *);
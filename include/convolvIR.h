@@ -17,17 +17,165 @@
 #include <AudioStream.h>
 #include "auricle.h"
 #include "upols.h"
+#include "nupols.h"
+#include "interpolation.h"
+#include "upolsEngine.h"
+#include "virtualizer.h"
+#if defined(UPOLS_DEFERRED_DSP)
+#include "dspSched.h"
+#endif
+
+#if defined(UPOLS_NONUNIFORM) && defined(UPOLS_HYBRID)
+#error "UPOLS_NONUNIFORM and UPOLS_HYBRID are mutually exclusive"
+#endif
+
+#if defined(UPOLS_TEMPLATE_ENGINE)
+#if defined(UPOLS_NONUNIFORM) || defined(UPOLS_HYBRID)
+#error "UPOLS_TEMPLATE_ENGINE can't be combined with UPOLS_NONUNIFORM or UPOLS_HYBRID"
+#endif
+
+// Samples per partition for the templated engine, AUDIO_BLOCK_SAMPLES must be a multiple of it
+#ifndef UPOLS_TEMPLATE_PARTITION_SIZE
+#define UPOLS_TEMPLATE_PARTITION_SIZE 128
+#endif
+
+typedef UpolsEngine<UPOLS_TEMPLATE_PARTITION_SIZE, ImpulseSamples / UPOLS_TEMPLATE_PARTITION_SIZE> TemplateEngine;
+static_assert(AUDIO_BLOCK_SAMPLES % UPOLS_TEMPLATE_PARTITION_SIZE == 0, "Set AUDIO_BLOCK_SAMPLES to a multiple of UPOLS_TEMPLATE_PARTITION_SIZE");
+#endif
+
+#if defined(UPOLS_VIRTUALIZER)
+#if defined(UPOLS_NONUNIFORM) || defined(UPOLS_HYBRID) || defined(UPOLS_TEMPLATE_ENGINE)
+#error "UPOLS_VIRTUALIZER can't be combined with the other engines"
+#endif
+
+// Bed layout at power-up
+#ifndef UPOLS_VIRTUAL_LAYOUT
+#define UPOLS_VIRTUAL_LAYOUT Bed71
+#endif
+#endif
+
+// Only the uniform engine puts the interaural delay back on minimum-phase HRIRs
+#if defined(UPOLS_MINIMUM_PHASE) && (defined(UPOLS_NONUNIFORM) || defined(UPOLS_TEMPLATE_ENGINE) || defined(UPOLS_VIRTUALIZER))
+#error "UPOLS_MINIMUM_PHASE needs the uniform engine, with or without UPOLS_HYBRID"
+#endif
+
+// The low-rate tail lives in upols_t, the other engines would read the longer irTable as full-rate taps
+#if defined(UPOLS_SUBBAND) && (defined(UPOLS_NONUNIFORM) || defined(UPOLS_TEMPLATE_ENGINE) || defined(UPOLS_VIRTUALIZER))
+#error "UPOLS_SUBBAND needs the uniform engine, with or without UPOLS_HYBRID"
+#endif
+
+// Reflections and reverb are added by the uniform engine around its direct path
+#if defined(UPOLS_ROOM) && (defined(UPOLS_NONUNIFORM) || defined(UPOLS_TEMPLATE_ENGINE) || defined(UPOLS_VIRTUALIZER))
+#error "UPOLS_ROOM needs the uniform engine, with or without UPOLS_HYBRID"
+#endif
+
+// Only the uniform engine builds the cross paths into its filters
+#if defined(UPOLS_STEREO_MATRIX) && (defined(UPOLS_NONUNIFORM) || defined(UPOLS_TEMPLATE_ENGINE) || defined(UPOLS_VIRTUALIZER))
+#error "UPOLS_STEREO_MATRIX needs the uniform engine"
+#endif
+
+// Only the uniform engine hands float blocks straight to SpdifTx
+#if defined(UPOLS_FLOAT_OUTPUT) && (defined(UPOLS_NONUNIFORM) || defined(UPOLS_TEMPLATE_ENGINE) || defined(UPOLS_VIRTUALIZER))
+#error "UPOLS_FLOAT_OUTPUT needs the uniform engine, with or without UPOLS_HYBRID"
+#endif
+
+// Direct output writes into fifoTx itself, the float blocks would be a second path to the same DMA
+#if defined(UPOLS_DIRECT_OUTPUT) && (defined(UPOLS_NONUNIFORM) || defined(UPOLS_TEMPLATE_ENGINE) || defined(UPOLS_VIRTUALIZER))
+#error "UPOLS_DIRECT_OUTPUT needs the uniform engine, with or without UPOLS_HYBRID"
+#endif
+#if defined(UPOLS_DIRECT_OUTPUT) && defined(UPOLS_FLOAT_OUTPUT)
+#error "UPOLS_DIRECT_OUTPUT and UPOLS_FLOAT_OUTPUT are mutually exclusive"
+#endif
+
+// The uniform engine, with or without the hybrid head, keeps its state in an upols_t
+#if !defined(UPOLS_NONUNIFORM) && !defined(UPOLS_TEMPLATE_ENGINE) && !defined(UPOLS_VIRTUALIZER)
+#define CONVOLVIR_UPOLS
+#endif
+
+#if defined(UPOLS_DEFERRED_DSP)
+// The other engines recompute their filters in the foreground, which a queued job could run into
+#if !defined(CONVOLVIR_UPOLS)
+#error "UPOLS_DEFERRED_DSP needs the uniform engine, with or without UPOLS_HYBRID"
+#endif
+
+// Vector the DSP task is pended on. GPT2 itself is never started, only its slot in the NVIC is used
+#ifndef CONVOLVIR_DSP_IRQ
+#define CONVOLVIR_DSP_IRQ IRQ_GPT2
+#endif
+
+// Below USB (112), the DMA (128) and the audio update (208), so all of them preempt the convolution
+#ifndef CONVOLVIR_DSP_PRIORITY
+#define CONVOLVIR_DSP_PRIORITY 240
+#endif
+#endif
+
+enum ConvolvIRInputs
+{
+#if defined(UPOLS_VIRTUALIZER)
+	ConvolvIRInputCount = MaxBedChannels,
+	ConvolvIRAudioBlocks = 48 // Multichannel sources allocate a block per channel
+#else
+	ConvolvIRInputCount = 2,
+	ConvolvIRAudioBlocks = 16
+#endif
+};
 
 class ConvolvIR : public AudioStream
 {
 public:
 	ConvolvIR(void);
+	ConvolvIR(filters_t *primaryBank, filters_t *secondaryBank);
 	virtual void update(void);
 	bool togglePassthrough(void);
+	void setDirection(float32_t azimuth, float32_t elevation);
+#if defined(UPOLS_VIRTUALIZER)
+	void setLayout(bedLayout_t layout);
+#else
 	void convertIR(uint16_t irIndex);
+#endif
+#if defined(CONVOLVIR_UPOLS)
+	uint16_t partitionsInUse(size_t ear);
+	uint32_t binsInUse(size_t ear);
+	bool bypassing(void);
+#endif
+#if defined(UPOLS_DEFERRED_DSP)
+	const dspSched_t *scheduler(void);
+#endif
 
 private:
-	audio_block_t *inputQueueArray[2];
+	audio_block_t *inputQueueArray[ConvolvIRInputCount];
+
+#if defined(UPOLS_VIRTUALIZER)
+	virtualizer_t virtualizer;
+	float32_t bedAzimuth; // Direction the front of the bed faces
+	float32_t bedElevation;
+#else
+	void applyBlend(const hrirBlend_t *blend);
+	void transmitPassthrough(audio_block_t *leftAudio, audio_block_t *rightAudio);
+#endif
+
+#if defined(CONVOLVIR_UPOLS)
+	upols_t upols; // Convolver state, filter banks are supplied by the constructor
+#elif defined(UPOLS_NONUNIFORM)
+	nupols_t nupols; // Convolver state, memory pools are static in convolvIR.cpp
+#elif defined(UPOLS_TEMPLATE_ENGINE)
+	TemplateEngine templateEngine; // Filters are static in convolvIR.cpp
+#endif
+
+#if defined(UPOLS_DEFERRED_DSP)
+	static void dspTask(void);
+	void processJob(const dspJob_t *job);
+	void convolveJob(audio_block_t *leftAudio, audio_block_t *rightAudio);
+
+	dspSched_t sched;			  // Blocks between the audio update and the DSP task
+	ConvolvIR *nextDeferred;	  // Instances the DSP task serves, in construction order
+	static ConvolvIR *firstDeferred;
+
+	enum DspJobFlags
+	{
+		PassthroughJob = 1 // Send the blocks on untouched
+	};
+#endif
 
 	bool audioPassthrough;
 	bool audioMute;
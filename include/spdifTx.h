@@ -14,25 +14,76 @@
 #include "auricle.h"
 #include <AudioStream.h>
 #include <DMAChannel.h>
+#include "blockRing.h"
+#if defined(UPOLS_DIRECT_OUTPUT)
+#include "txRing.h"
+#endif
+
+// Stereo blocks queued between update() and the DMA at power-up, up to BlockRingSlots. 2 keeps the old two-slot queue
+#ifndef SPDIFTX_RING_DEPTH
+#define SPDIFTX_RING_DEPTH 2
+#endif
+
+#if defined(UPOLS_FLOAT_OUTPUT)
+// Stereo block of float samples in [-1, 1), handed to SpdifTx outside the q15 audio graph
+typedef struct audio_block_f32_t
+{
+	float data[2][AUDIO_BLOCK_SAMPLES];
+} audio_block_f32_t;
+#endif
 
 class SpdifTx : public AudioStream
 {
 public:
 	SpdifTx(void);
 	virtual void update(void);
+	static const blockRing_t *ring(void);
+	static uint32_t unpairedBlocks(size_t channel);
+	static void setRingDepth(uint32_t depth);
+	static void clearRingStats(void);
+#if defined(UPOLS_FLOAT_OUTPUT)
+	static audio_block_f32_t *allocateFloat(void);
+	static void transmitFloat(audio_block_f32_t *block);
+#endif
+#if defined(UPOLS_DIRECT_OUTPUT)
+	static const txRing_t *directRing(void);
+	static int32_t *acquireHalf(void);
+	static bool commitHalf(int32_t *half);
+	static void transmitDirect(const int16_t *leftAudioData, const int16_t *rightAudioData);
+#endif
+#if defined(UPOLS_DEFERRED_DSP)
+	static uint32_t eventTimestamp(void);
+	static uint32_t eventLatency(void);
+	static uint32_t periodCycles(void);
+#endif
 
 private:
 	void init(void);
 	static void configureSpdifRegisters(void);
 	static void spdifInterleave(int32_t *pTx, const int16_t *leftAudioData, const int16_t *rightAudioData);
+#if defined(UPOLS_FLOAT_OUTPUT)
+	static void spdifInterleave(int32_t *pTx, const float *leftAudioData, const float *rightAudioData);
+	static int32_t floatToSample(float sample);
+	static void releaseFloat(audio_block_f32_t *block);
+#endif
 	static void dmaISR(void);
 
 	static uint8_t configureDMA(void);
 	static int32_t getTxOffset(uint32_t txSourceAddress, uint32_t sourceBufferSize);
 
 	audio_block_t *inputQueueArray[2];
-	static audio_block_t *leftAudioBuffer[2];
-	static audio_block_t *rightAudioBuffer[2];
+	static blockRing_t audioRing;		   // q15 blocks from update() to dmaISR(), both channels of a period in one slot
+	static volatile uint32_t unpaired[2]; // Blocks dropped per channel for arriving without the other channel's
+#if defined(UPOLS_FLOAT_OUTPUT)
+	static blockRing_t floatRing; // Float blocks from transmitFloat() to dmaISR(), both slots of a pair point to the same block
+#endif
+#if defined(UPOLS_DIRECT_OUTPUT)
+	static txRing_t txRing; // Halves of fifoTx handed to the producer to fill in place
+#endif
+#if defined(UPOLS_DEFERRED_DSP)
+	static volatile uint32_t dmaEventCycles; // Cycle count on entry to the latest dmaISR()
+	static volatile uint32_t dmaEventLatency; // Cycles the latest dmaISR() ran after the DMA crossed the half boundary
+#endif
 
 	static DMAChannel eDMA;
 	uint8_t dmaChannel;
@@ -54,6 +105,7 @@ private:
 
 	enum SPDIF
 	{
+		SPDIF_SAMPLE_RATE = 44100, // 24 MHz * (28 + 2240 / 10000) / 8 / 30 / 64
 		SPDIF_LOOP_DIV = 28,
 		SPDIF_STC_DIV = 29,
 		GPIO_AD_B1_02_MUX_MODE_SPDIF = 0b011
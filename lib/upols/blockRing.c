@@ -0,0 +1,129 @@
+/**
+ * @file blockRing.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Lock-free queue of stereo audio blocks with a settable depth and dropout counters
+ * @version 0.1
+ * @date 2021-12-29
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ * @details
+ * Pairs of left and right blocks are passed from one producer, such as an audio update, to one
+ * consumer, such as a DMA interrupt. Both blocks of a period share a slot, so one channel can
+ * never be pushed, refused or run dry on its own and end up a period behind the other. Each side
+ * only writes its own index and publishes it with release ordering, so neither has to mask the
+ * other out.
+ *
+ * The depth is the number of pairs the ring holds before the producer is turned away, which
+ * trades latency against how long the producer can stall before the consumer runs dry. It can
+ * be changed while running; a smaller depth takes effect as the queued pairs drain.
+ *
+ * Every way a pair goes missing is counted: a pair refused by a full ring is an overrun, and
+ * every pop that finds the ring empty is an underrun, so a long gap counts each period it left
+ * silent. The number of separate gaps is kept as dropouts, counted when the ring runs empty after
+ * the consumer had been getting pairs. The high-water mark shows how much of the depth is
+ * actually used.
+ *
+ */
+
+#include "blockRing.h"
+
+/**
+ * @brief Start empty with cleared counters
+ *
+ * @param ring Ring
+ * @param depth Pairs to queue before overrunning, clamped to 1 to BlockRingSlots
+ */
+void blockRingInit(blockRing_t *ring, const uint32_t depth)
+{
+	memset(ring, 0, sizeof(blockRing_t));
+	blockRingSetDepth(ring, depth);
+}
+
+/**
+ * @brief Producer side: queue a pair of blocks
+ *
+ * @param ring Ring
+ * @param pair Blocks to copy in
+ * @return false if depth pairs are already queued, both blocks stay with the caller
+ */
+bool blockRingPush(blockRing_t *ring, const blockPair_t *pair)
+{
+	const uint32_t head = ring->head;
+	const uint32_t queued = head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	if (queued >= ring->depth)
+	{
+		__atomic_fetch_add(&ring->overruns, 1, __ATOMIC_RELAXED);
+		return false;
+	}
+
+	ring->slot[head & (BlockRingSlots - 1)] = *pair;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+	if (queued + 1 > ring->highWater)
+	{
+		ring->highWater = queued + 1;
+	}
+	return true;
+}
+
+/**
+ * @brief Consumer side: take the oldest pair of blocks
+ *
+ * @param ring Ring
+ * @param pair Blocks to copy out
+ * @return false if the ring is empty
+ */
+bool blockRingPop(blockRing_t *ring, blockPair_t *pair)
+{
+	const uint32_t tail = ring->tail;
+	if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail)
+	{
+		__atomic_fetch_add(&ring->underruns, 1, __ATOMIC_RELAXED);
+		if (ring->flowing)
+		{
+			__atomic_fetch_add(&ring->dropouts, 1, __ATOMIC_RELAXED);
+			ring->flowing = false;
+		}
+		return false;
+	}
+
+	*pair = ring->slot[tail & (BlockRingSlots - 1)];
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+	ring->flowing = true;
+	return true;
+}
+
+/**
+ * @brief Pairs queued, from either side
+ *
+ * @param ring Ring
+ */
+uint32_t blockRingCount(const blockRing_t *ring)
+{
+	return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Change the depth. Safe while running, pairs already queued beyond a smaller depth still play
+ *
+ * @param ring Ring
+ * @param depth Pairs to queue before overrunning, clamped to 1 to BlockRingSlots
+ */
+void blockRingSetDepth(blockRing_t *ring, const uint32_t depth)
+{
+	ring->depth = (depth < 1) ? 1 : ((depth > BlockRingSlots) ? BlockRingSlots : depth);
+}
+
+/**
+ * @brief Clear the counters and the high-water mark. From outside both sides a count landing at the same time can be lost
+ *
+ * @param ring Ring
+ */
+void blockRingClearStats(blockRing_t *ring)
+{
+	ring->highWater = 0;
+	ring->underruns = 0;
+	ring->dropouts = 0;
+	ring->overruns = 0;
+}
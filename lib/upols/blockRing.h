@@ -0,0 +1,57 @@
+/**
+ * @file blockRing.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Lock-free queue of stereo audio blocks with a settable depth and dropout counters
+ * @version 0.1
+ * @date 2021-12-29
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+
+enum BlockRingLengths
+{
+	BlockRingSlots = 8 // Deepest the ring can be set, a power of two
+};
+
+// Left and right blocks of one period, queued and taken together so the channels can't drift apart
+typedef struct blockPair_t
+{
+	void *left;
+	void *right;
+} blockPair_t;
+
+// Single-producer, single-consumer. head and highWater are only written by the producer, tail, flowing, underruns and dropouts only by the consumer
+typedef struct blockRing_t
+{
+	blockPair_t slot[BlockRingSlots];
+	volatile uint32_t head;
+	volatile uint32_t tail;
+	volatile uint32_t depth;	 // Pairs queued before the producer overruns, 1 to BlockRingSlots
+	volatile uint32_t highWater; // Most pairs queued at once
+	volatile uint32_t underruns; // Pops that found the ring empty, one per period played as silence
+	volatile uint32_t dropouts;	 // Times the ring ran empty after the consumer had been getting pairs
+	volatile uint32_t overruns;	 // Pairs refused because depth pairs were already queued
+	bool flowing;				 // The last pop found a pair
+} blockRing_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+	void blockRingInit(blockRing_t *ring, uint32_t depth);
+	bool blockRingPush(blockRing_t *ring, const blockPair_t *pair);
+	bool blockRingPop(blockRing_t *ring, blockPair_t *pair);
+	uint32_t blockRingCount(const blockRing_t *ring);
+	void blockRingSetDepth(blockRing_t *ring, uint32_t depth);
+	void blockRingClearStats(blockRing_t *ring);
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,253 @@
+/**
+ * @file dspBackend.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief FFT and sample conversion routines used by libupols
+ * @version 0.1
+ * @date 2021-12-04
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ */
+
+#include "dspBackend.h"
+
+#if defined(__IMXRT1062__)
+
+/**
+ * @brief In-place complex FFT of interleaved [re, im] data, bit-reversed back to natural order
+ *
+ * @param buffer Interleaved complex buffer of 2 * fftLength floats
+ * @param fftLength Number of complex points, power of two from 16 to 4096
+ * @param ifftFlag ForwardFFT or InverseFFT. The inverse transform is scaled by 1 / fftLength
+ */
+void dspCfft(float32_t *buffer, uint16_t fftLength, uint8_t ifftFlag)
+{
+	const arm_cfft_instance_f32 *cfft;
+	switch (fftLength)
+	{
+	case 16:
+		cfft = &arm_cfft_sR_f32_len16;
+		break;
+	case 32:
+		cfft = &arm_cfft_sR_f32_len32;
+		break;
+	case 64:
+		cfft = &arm_cfft_sR_f32_len64;
+		break;
+	case 128:
+		cfft = &arm_cfft_sR_f32_len128;
+		break;
+	case 256:
+		cfft = &arm_cfft_sR_f32_len256;
+		break;
+	case 512:
+		cfft = &arm_cfft_sR_f32_len512;
+		break;
+	case 1024:
+		cfft = &arm_cfft_sR_f32_len1024;
+		break;
+	case 2048:
+		cfft = &arm_cfft_sR_f32_len2048;
+		break;
+	default:
+		cfft = &arm_cfft_sR_f32_len4096;
+		break;
+	}
+	arm_cfft_f32(cfft, buffer, ifftFlag, 1);
+}
+
+void dspQ15ToFloat(const q15_t *src, float32_t *dest, uint32_t blockSize)
+{
+	arm_q15_to_float((q15_t *)src, dest, blockSize);
+}
+
+void dspFloatToQ15(const float32_t *src, q15_t *dest, uint32_t blockSize)
+{
+	arm_float_to_q15((float32_t *)src, dest, blockSize);
+}
+
+void dspFirInit(dspFir_t *fir, uint16_t numTaps, const float32_t *coeffs, float32_t *state, uint32_t blockSize)
+{
+	arm_fir_init_f32(fir, numTaps, (float32_t *)coeffs, state, blockSize);
+}
+
+void dspFir(const dspFir_t *fir, const float32_t *src, float32_t *dest, uint32_t blockSize)
+{
+	arm_fir_f32(fir, (float32_t *)src, dest, blockSize);
+}
+
+#else
+
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+// Twiddle factors for the largest supported length, smaller lengths stride through the table
+static float32_t twiddleTable[MaxFFTLength];
+
+static void initTwiddleTable(void)
+{
+	static bool twiddlesReady;
+	if (twiddlesReady)
+	{
+		return;
+	}
+
+	for (size_t k = 0; k < MaxFFTLength / 2; k++)
+	{
+		const double phase = -2.0 * M_PI * (double)k / MaxFFTLength;
+		twiddleTable[2 * k] = (float32_t)cos(phase);
+		twiddleTable[2 * k + 1] = (float32_t)sin(phase);
+	}
+	twiddlesReady = true;
+}
+
+/**
+ * @brief Reorder interleaved complex data into bit-reversed index order
+ *
+ * @param buffer Interleaved complex buffer
+ * @param fftLength Number of complex points
+ */
+static void bitReverse(float32_t *buffer, uint16_t fftLength)
+{
+	for (size_t i = 1, j = 0; i < fftLength; i++)
+	{
+		size_t bit = fftLength >> 1;
+		for (; j & bit; bit >>= 1)
+		{
+			j ^= bit;
+		}
+		j ^= bit;
+
+		if (i < j)
+		{
+			float32_t swap = buffer[2 * i];
+			buffer[2 * i] = buffer[2 * j];
+			buffer[2 * j] = swap;
+
+			swap = buffer[2 * i + 1];
+			buffer[2 * i + 1] = buffer[2 * j + 1];
+			buffer[2 * j + 1] = swap;
+		}
+	}
+}
+
+/**
+ * @brief In-place complex FFT of interleaved [re, im] data. Same conventions as arm_cfft_f32 with bitReverseFlag set
+ *
+ * @param buffer Interleaved complex buffer of 2 * fftLength floats
+ * @param fftLength Number of complex points, power of two from 16 to 4096
+ * @param ifftFlag ForwardFFT or InverseFFT. The inverse transform is scaled by 1 / fftLength
+ */
+void dspCfft(float32_t *buffer, uint16_t fftLength, uint8_t ifftFlag)
+{
+	initTwiddleTable();
+	bitReverse(buffer, fftLength);
+
+	const float32_t direction = ifftFlag ? -1.0f : 1.0f;
+
+	// Iterative radix-2 decimation-in-time butterflies
+	for (size_t span = 1; span < fftLength; span <<= 1)
+	{
+		const size_t stride = MaxFFTLength / (2 * span);
+		for (size_t start = 0; start < fftLength; start += 2 * span)
+		{
+			for (size_t k = 0; k < span; k++)
+			{
+				const float32_t wRe = twiddleTable[2 * k * stride];
+				const float32_t wIm = direction * twiddleTable[2 * k * stride + 1];
+
+				float32_t *a = &buffer[2 * (start + k)];
+				float32_t *b = &buffer[2 * (start + k + span)];
+
+				const float32_t tRe = b[0] * wRe - b[1] * wIm;
+				const float32_t tIm = b[0] * wIm + b[1] * wRe;
+
+				b[0] = a[0] - tRe;
+				b[1] = a[1] - tIm;
+				a[0] += tRe;
+				a[1] += tIm;
+			}
+		}
+	}
+
+	if (ifftFlag)
+	{
+		const float32_t scale = 1.0f / fftLength;
+		for (size_t i = 0; i < 2 * (size_t)fftLength; i++)
+		{
+			buffer[i] *= scale;
+		}
+	}
+}
+
+/**
+ * @brief Convert Q15 samples to float in the range [-1, 1)
+ *
+ */
+void dspQ15ToFloat(const q15_t *src, float32_t *dest, uint32_t blockSize)
+{
+	for (size_t i = 0; i < blockSize; i++)
+	{
+		dest[i] = (float32_t)src[i] / 32768.0f;
+	}
+}
+
+/**
+ * @brief Convert float samples to Q15 with saturation, truncating like arm_float_to_q15 without ARM_MATH_ROUNDING
+ *
+ */
+void dspFloatToQ15(const float32_t *src, q15_t *dest, uint32_t blockSize)
+{
+	for (size_t i = 0; i < blockSize; i++)
+	{
+		float32_t sample = src[i] * 32768.0f;
+		sample = (sample > (float32_t)INT16_MAX) ? (float32_t)INT16_MAX : sample;
+		sample = (sample < (float32_t)INT16_MIN) ? (float32_t)INT16_MIN : sample;
+		dest[i] = (q15_t)sample;
+	}
+}
+
+/**
+ * @brief Initialize a direct-form FIR filter, same arguments as arm_fir_init_f32
+ *
+ * @param fir Filter instance
+ * @param numTaps Number of coefficients
+ * @param coeffs Coefficients in time-reversed order
+ * @param state History buffer of numTaps + blockSize - 1 samples
+ * @param blockSize Samples processed per call
+ */
+void dspFirInit(dspFir_t *fir, uint16_t numTaps, const float32_t *coeffs, float32_t *state, uint32_t blockSize)
+{
+	fir->numTaps = numTaps;
+	fir->pCoeffs = coeffs;
+	fir->pState = state;
+	memset(state, 0, (numTaps + blockSize - 1) * sizeof(float32_t));
+}
+
+/**
+ * @brief Direct-form FIR filter, same state layout as arm_fir_f32
+ *
+ */
+void dspFir(const dspFir_t *fir, const float32_t *src, float32_t *dest, uint32_t blockSize)
+{
+	float32_t *state = fir->pState;
+	const size_t history = fir->numTaps - 1;
+
+	memcpy(&state[history], src, blockSize * sizeof(float32_t));
+
+	for (size_t i = 0; i < blockSize; i++)
+	{
+		float32_t accum = 0;
+		for (size_t k = 0; k < fir->numTaps; k++)
+		{
+			accum += state[i + k] * fir->pCoeffs[k];
+		}
+		dest[i] = accum;
+	}
+
+	// Keep the most recent numTaps - 1 samples for the next block
+	memmove(state, &state[blockSize], history * sizeof(float32_t));
+}
+
+#endif
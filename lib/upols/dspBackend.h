@@ -0,0 +1,66 @@
+/**
+ * @file dspBackend.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief FFT and sample conversion routines used by libupols
+ * @version 0.1
+ * @date 2021-12-04
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ * @details
+ * On the Teensy (__IMXRT1062__) every routine forwards to CMSIS-DSP. Anywhere else a portable
+ * implementation with the same scaling and bin ordering is used so the convolution engine can be
+ * built and benchmarked on the host.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#if defined(__IMXRT1062__)
+#include <arm_math.h>
+#include <arm_const_structs.h>
+#define _section_ocram __attribute__((used, section(".dmabuffers"))) // Large, streamed buffers that don't need to be in DTCM
+#define _section_progmem __attribute__((section(".progmem")))		 // Constant tables left in flash rather than copied to RAM
+typedef arm_fir_instance_f32 dspFir_t;
+#else
+typedef float float32_t;
+typedef int16_t q15_t;
+#define _section_ocram
+#define _section_progmem
+
+// Mirrors arm_fir_instance_f32
+typedef struct dspFir_t
+{
+	uint16_t numTaps;		  // Number of filter coefficients
+	float32_t *pState;		  // numTaps + blockSize - 1 samples of history
+	const float32_t *pCoeffs; // Coefficients in time-reversed order
+} dspFir_t;
+#endif
+
+enum FFT_Flags
+{
+	ForwardFFT,
+	InverseFFT
+};
+
+enum FFT_Lengths
+{
+	MinFFTLength = 16,
+	MaxFFTLength = 4096
+};
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+	void dspCfft(float32_t *buffer, uint16_t fftLength, uint8_t ifftFlag);
+	void dspQ15ToFloat(const q15_t *src, float32_t *dest, uint32_t blockSize);
+	void dspFloatToQ15(const float32_t *src, q15_t *dest, uint32_t blockSize);
+	void dspFirInit(dspFir_t *fir, uint16_t numTaps, const float32_t *coeffs, float32_t *state, uint32_t blockSize);
+	void dspFir(const dspFir_t *fir, const float32_t *src, float32_t *dest, uint32_t blockSize);
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,170 @@
+/**
+ * @file dspSched.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Handoff of audio blocks between interrupts and a preemptible DSP task
+ * @version 0.1
+ * @date 2021-12-27
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ * @details
+ * The DMA interrupt and the audio update only move blocks, the convolution runs in a task below
+ * both of them that any interrupt can preempt:
+ *
+ *   DMA interrupt: dspSchedEvent(), then triggers the audio update
+ *   Audio update: collects the previous job from finished, submits this block to pending, triggers the DSP task
+ *   DSP task: takes jobs from pending until it's empty, dspSchedStart() / dspSchedFinish() around each one
+ *
+ * Each queue has exactly one producer and one consumer, so a slot is handed over by publishing
+ * its index with release ordering and read after an acquire of the same index. Neither side
+ * ever waits on or masks the other.
+ *
+ * A job is due at the DMA event after the one it was submitted for. The scheduler keeps the
+ * worst latencies seen at each stage, measured from that event, so the headroom left at each
+ * priority level can be read off while running.
+ *
+ */
+
+#include "dspSched.h"
+
+/**
+ * @brief Keep the larger of a running worst case and a new sample
+ *
+ * @param worst Worst case so far, only written by one context
+ * @param sample New measurement
+ */
+static inline void recordWorst(volatile uint32_t *worst, const uint32_t sample)
+{
+	if (sample > *worst)
+	{
+		*worst = sample;
+	}
+}
+
+/**
+ * @brief Producer side: append a job
+ *
+ * @param queue Queue
+ * @param job Job to copy in
+ * @return false if the queue is full
+ */
+bool dspQueuePush(dspQueue_t *queue, const dspJob_t *job)
+{
+	const uint32_t head = queue->head;
+	if (head - __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE) == DspQueueSlots)
+	{
+		return false;
+	}
+	queue->slot[head & (DspQueueSlots - 1)] = *job;
+	__atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+/**
+ * @brief Consumer side: take the oldest job
+ *
+ * @param queue Queue
+ * @param job Job to copy out
+ * @return false if the queue is empty
+ */
+bool dspQueuePop(dspQueue_t *queue, dspJob_t *job)
+{
+	const uint32_t tail = queue->tail;
+	if (__atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) == tail)
+	{
+		return false;
+	}
+	*job = queue->slot[tail & (DspQueueSlots - 1)];
+	__atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+/**
+ * @brief Jobs waiting in a queue, from either side
+ *
+ * @param queue Queue
+ */
+uint32_t dspQueueCount(const dspQueue_t *queue)
+{
+	return __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Empty queues and clear the statistics
+ *
+ * @param sched Scheduler
+ * @param period Time between DMA events, in timestamp units
+ */
+void dspSchedInit(dspSched_t *sched, const uint32_t period)
+{
+	memset(sched, 0, sizeof(dspSched_t));
+	sched->period = period;
+}
+
+/**
+ * @brief DMA interrupt: a block period has started
+ *
+ * @param sched Scheduler
+ * @param now Timestamp on entry to the interrupt
+ * @param latency Time from the DMA event to entry, as measured by the caller
+ */
+void dspSchedEvent(dspSched_t *sched, const uint32_t now, const uint32_t latency)
+{
+	recordWorst(&sched->eventLatency, latency);
+	sched->lastEvent = now;
+	sched->events++;
+}
+
+/**
+ * @brief Audio update: queue a block for the DSP task
+ *
+ * @param sched Scheduler
+ * @param job Blocks to process, stamped with the current DMA event
+ * @param now Timestamp
+ * @return false if the DSP task is too far behind, the caller keeps the blocks
+ */
+bool dspSchedSubmit(dspSched_t *sched, dspJob_t *job, const uint32_t now)
+{
+	job->event = sched->lastEvent;
+	recordWorst(&sched->updateLatency, now - job->event);
+
+	if (!dspQueuePush(&sched->pending, job))
+	{
+		__atomic_fetch_add(&sched->overruns, 1, __ATOMIC_RELAXED);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief DSP task: about to process a job from pending
+ *
+ * @param sched Scheduler
+ * @param job Job
+ * @param now Timestamp
+ */
+void dspSchedStart(dspSched_t *sched, const dspJob_t *job, const uint32_t now)
+{
+	recordWorst(&sched->dspLatency, now - job->event);
+}
+
+/**
+ * @brief DSP task: a job has been processed
+ *
+ * @param sched Scheduler
+ * @param job Job
+ * @param now Timestamp
+ * @return false if it missed its deadline
+ */
+bool dspSchedFinish(dspSched_t *sched, const dspJob_t *job, const uint32_t now)
+{
+	const uint32_t elapsed = now - job->event;
+	recordWorst(&sched->completion, elapsed);
+
+	if (elapsed > sched->period)
+	{
+		__atomic_fetch_add(&sched->deadlineMisses, 1, __ATOMIC_RELAXED);
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,72 @@
+/**
+ * @file dspSched.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Handoff of audio blocks between interrupts and a preemptible DSP task
+ * @version 0.1
+ * @date 2021-12-27
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+
+enum DspSchedLengths
+{
+	DspQueueSlots = 4 // Jobs a queue holds, a power of two
+};
+
+// Stereo block handed between contexts, the scheduler never looks inside
+typedef struct dspJob_t
+{
+	void *left;
+	void *right;
+	uint32_t event; // Timestamp of the DMA event the job was submitted for, its deadline is the next one
+	uint32_t flags; // The caller's, such as how the DSP task is to process the blocks
+} dspJob_t;
+
+// Single-producer, single-consumer queue. head is only written by the producer, tail only by the consumer
+typedef struct dspQueue_t
+{
+	dspJob_t slot[DspQueueSlots];
+	volatile uint32_t head;
+	volatile uint32_t tail;
+} dspQueue_t;
+
+// Timestamps are in whatever unit the caller counts in, cycles on the Teensy and nanoseconds on the host
+typedef struct dspSched_t
+{
+	dspQueue_t pending;				 // Audio update -> DSP task
+	dspQueue_t finished;			 // DSP task -> audio update, for output that still goes through the audio graph
+	uint32_t period;				 // Time between DMA events
+	volatile uint32_t lastEvent;	 // Timestamp of the latest DMA event
+	volatile uint32_t events;		 // DMA events so far
+	volatile uint32_t eventLatency;	 // Worst time from the DMA crossing a half of its buffer to its interrupt running
+	volatile uint32_t updateLatency; // Worst time from a DMA event to the audio update submitting its job
+	volatile uint32_t dspLatency;	 // Worst time from a DMA event to the DSP task starting its job
+	volatile uint32_t completion;	 // Worst time from a DMA event to the DSP task finishing its job
+	volatile uint32_t deadlineMisses; // Jobs finished after the next DMA event
+	volatile uint32_t overruns;		 // Jobs refused because the DSP task was DspQueueSlots jobs behind
+} dspSched_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+	bool dspQueuePush(dspQueue_t *queue, const dspJob_t *job);
+	bool dspQueuePop(dspQueue_t *queue, dspJob_t *job);
+	uint32_t dspQueueCount(const dspQueue_t *queue);
+
+	void dspSchedInit(dspSched_t *sched, uint32_t period);
+	void dspSchedEvent(dspSched_t *sched, uint32_t now, uint32_t latency);
+	bool dspSchedSubmit(dspSched_t *sched, dspJob_t *job, uint32_t now);
+	void dspSchedStart(dspSched_t *sched, const dspJob_t *job, uint32_t now);
+	bool dspSchedFinish(dspSched_t *sched, const dspJob_t *job, uint32_t now);
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,128 @@
+/**
+ * @file interpolation.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Direction lookup over a spherical triangulation of the HRIR measurement grid
+ * @version 0.1
+ * @date 2021-12-14
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ * @details
+ * The triangulation (convex hull of the measurement directions) is built offline. Each triangle
+ * carries the inverse of the matrix formed by its corner vectors, so the weights of a direction are
+ * a single 3x3 matrix-vector product, and every direction lies inside the triangle whose smallest
+ * weight is non-negative. A 5 degree azimuth / elevation grid lists the few triangles overlapping
+ * each cell, so a lookup is one cell read plus a handful of matrix products regardless of how many
+ * directions were measured.
+ *
+ * Horizontal-only sets are emitted as segments between neighbouring azimuths (third corner repeated,
+ * third weight always zero), so they use the same lookup.
+ *
+ */
+
+#include "interpolation.h"
+
+#ifdef UPOLS_EXTERNAL_IR_TABLE
+extern const triangulation_t triangulation; // Supplied by the host build instead of the generated index
+#else
+#include "./../../include/triangulation.h"
+#endif
+
+/**
+ * @brief Find the HRIR pairs surrounding a direction and their interpolation weights
+ *
+ * @param azimuth Degrees, in the convention of the measurement set
+ * @param elevation Degrees, positive above the horizontal plane
+ * @param blend Corner pairs and weights, summing to 1
+ */
+void hrirLookup(float32_t azimuth, float32_t elevation, hrirBlend_t *blend)
+{
+	const float32_t degToRad = (float32_t)M_PI / 180.0f;
+
+	azimuth = fmodf(azimuth, 360.0f);
+	azimuth = (azimuth < 0) ? azimuth + 360.0f : azimuth;
+	elevation = (elevation > 90.0f) ? 90.0f : ((elevation < -90.0f) ? -90.0f : elevation);
+
+	const float32_t direction[3] = {
+		cosf(elevation * degToRad) * cosf(azimuth * degToRad),
+		cosf(elevation * degToRad) * sinf(azimuth * degToRad),
+		sinf(elevation * degToRad),
+	};
+
+	uint32_t azimuthCell = (uint32_t)(azimuth / CellDegrees);
+	uint32_t elevationCell = (uint32_t)((elevation + 90.0f) / CellDegrees);
+	azimuthCell = (azimuthCell < AzimuthCells) ? azimuthCell : AzimuthCells - 1;
+	elevationCell = (elevationCell < ElevationCells) ? elevationCell : ElevationCells - 1;
+
+	const uint32_t cell = elevationCell * AzimuthCells + azimuthCell;
+
+	// Keep the candidate whose smallest weight is largest, which is the enclosing triangle when there is one
+	float32_t bestWeights[BlendDirections] = {1.0f, 0.0f, 0.0f};
+	float32_t bestScore = -INFINITY;
+	uint16_t bestTriangle = triangulation.cellTriangles[triangulation.cellStart[cell]];
+
+	for (uint32_t i = triangulation.cellStart[cell]; i < triangulation.cellStart[cell + 1]; i++)
+	{
+		const uint16_t triangle = triangulation.cellTriangles[i];
+		const float32_t *inverse = triangulation.inverse[triangle];
+
+		float32_t weights[BlendDirections];
+		float32_t score = INFINITY;
+		for (size_t j = 0; j < BlendDirections; j++)
+		{
+			weights[j] = inverse[3 * j] * direction[0] + inverse[3 * j + 1] * direction[1] + inverse[3 * j + 2] * direction[2];
+			score = (weights[j] < score) ? weights[j] : score;
+		}
+
+		// Segments leave their repeated corner at zero, which doesn't count against them
+		if (triangulation.triangles[triangle][2] == triangulation.triangles[triangle][1])
+		{
+			score = (weights[0] < weights[1]) ? weights[0] : weights[1];
+		}
+
+		if (score > bestScore)
+		{
+			bestScore = score;
+			bestTriangle = triangle;
+			memcpy(bestWeights, weights, sizeof(weights));
+		}
+	}
+
+	// Clamp any extrapolation outside the measured region and normalise onto the triangle
+	float32_t sum = 0;
+	for (size_t j = 0; j < BlendDirections; j++)
+	{
+		bestWeights[j] = (bestWeights[j] > 0) ? bestWeights[j] : 0;
+		sum += bestWeights[j];
+	}
+
+	for (size_t j = 0; j < BlendDirections; j++)
+	{
+		blend->irIndex[j] = triangulation.triangles[bestTriangle][j];
+		blend->weight[j] = (sum > 1e-6f) ? bestWeights[j] / sum : (float32_t)(j == 0);
+	}
+}
+
+#ifdef UPOLS_STEREO_MATRIX
+/**
+ * @brief Place the two input channels as virtual speakers UPOLS_STEREO_WIDTH degrees apart, centred on a direction
+ *
+ * @param azimuth Degrees, counter-clockwise from the front
+ * @param elevation Degrees, positive above the horizontal plane
+ * @param blend Left speaker in irIndex / weight, right speaker in rightIrIndex / rightWeight
+ */
+void stereoLookup(float32_t azimuth, float32_t elevation, hrirBlend_t *blend)
+{
+	const float32_t halfWidth = 0.5f * UPOLS_STEREO_WIDTH;
+	hrirBlend_t right;
+
+	hrirLookup(azimuth + halfWidth, elevation, blend);
+	hrirLookup(azimuth - halfWidth, elevation, &right);
+
+	for (size_t j = 0; j < BlendDirections; j++)
+	{
+		blend->rightIrIndex[j] = right.irIndex[j];
+		blend->rightWeight[j] = right.weight[j];
+	}
+}
+#endif
@@ -0,0 +1,45 @@
+/**
+ * @file interpolation.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Direction lookup over a spherical triangulation of the HRIR measurement grid
+ * @version 0.1
+ * @date 2021-12-14
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ */
+
+#pragma once
+
+#include "upols.h"
+
+// Azimuth / elevation cells used to find candidate triangles in constant time
+enum TriangulationCells
+{
+	CellDegrees = 5,
+	AzimuthCells = 360 / CellDegrees,
+	ElevationCells = 180 / CellDegrees,
+	TriangulationCellCount = AzimuthCells * ElevationCells
+};
+
+// Triangulation generated by tools/hrirc.cpp alongside tablIR.h
+typedef struct triangulation_t
+{
+	uint16_t triangleCount;
+	const uint16_t (*triangles)[BlendDirections]; // HRIR pair at each corner
+	const float32_t (*inverse)[9];				  // Row-major matrix taking a unit direction vector to corner weights
+	const uint32_t *cellStart;					  // TriangulationCellCount + 1 offsets into cellTriangles
+	const uint16_t *cellTriangles;				  // Candidate triangles for each cell
+} triangulation_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+	void hrirLookup(float32_t azimuth, float32_t elevation, hrirBlend_t *blend);
+#ifdef UPOLS_STEREO_MATRIX
+	void stereoLookup(float32_t azimuth, float32_t elevation, hrirBlend_t *blend);
+#endif
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,99 @@
+/**
+ * @file kernels.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Spectrum kernels for any block length, unrolled at compile time
+ * @version 0.1
+ * @date 2021-12-15
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ * @details
+ * Kernels<Floats> generates the multiply-accumulate, copy and clear routines that math512.c
+ * implements by hand for 512 floats. The inner body is expanded UnrollBins times by template
+ * recursion, leaving a loop with a compile-time trip count around it.
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include "dspBackend.h"
+
+#define _always_inline inline __attribute__((always_inline))
+
+// Calls body(0) ... body(Count - 1) with no loop left in the generated code
+template <size_t Count>
+struct Unrolled
+{
+	template <typename Body>
+	static _always_inline void run(Body body)
+	{
+		Unrolled<Count - 1>::run(body);
+		body(Count - 1);
+	}
+};
+
+template <>
+struct Unrolled<0>
+{
+	template <typename Body>
+	static _always_inline void run(Body)
+	{
+	}
+};
+
+template <size_t Floats>
+struct Kernels
+{
+	static constexpr size_t UnrollBins = 4; // Complex bins per unrolled step, matching math512.c
+	static constexpr size_t StepFloats = 2 * UnrollBins;
+
+	static_assert(Floats % StepFloats == 0, "Spectrum length must be a multiple of the unroll step");
+
+	/**
+	 * @brief Fast multiply-accumulate for complex numbers
+	 *
+	 * @param cmplxA Pointer to first array of interleaved complex values
+	 * @param cmplxB Pointer to second array of interleaved complex values
+	 * @param cmplxAccum Pointer to accumulator buffer
+	 */
+	static _always_inline void cmac(const float32_t *__restrict cmplxA, const float32_t *__restrict cmplxB, float32_t *__restrict cmplxAccum)
+	{
+		for (size_t i = 0; i < Floats; i += StepFloats)
+		{
+			Unrolled<UnrollBins>::run([&](size_t k) {
+				const float32_t aRe = cmplxA[i + 2 * k];
+				const float32_t aIm = cmplxA[i + 2 * k + 1];
+				const float32_t bRe = cmplxB[i + 2 * k];
+				const float32_t bIm = cmplxB[i + 2 * k + 1];
+
+				cmplxAccum[i + 2 * k] += (aRe * bRe) - (aIm * bIm);
+				cmplxAccum[i + 2 * k + 1] += (aRe * bIm) + (aIm * bRe);
+			});
+		}
+	}
+
+	/**
+	 * @brief Copy contents of src over to dest
+	 *
+	 */
+	static _always_inline void copy(const float32_t *__restrict src, float32_t *__restrict dest)
+	{
+		for (size_t i = 0; i < Floats; i += StepFloats)
+		{
+			Unrolled<StepFloats>::run([&](size_t k) { dest[i + k] = src[i + k]; });
+		}
+	}
+
+	/**
+	 * @brief Zero out destination array
+	 *
+	 */
+	static _always_inline void clear(float32_t *dest)
+	{
+		for (size_t i = 0; i < Floats; i += StepFloats)
+		{
+			Unrolled<StepFloats>::run([&](size_t k) { dest[i + k] = 0; });
+		}
+	}
+};
@@ -11,6 +11,10 @@
 
 #include "math512.h"
 
+#if defined(__IMXRT1062__)
+#include <arm_math.h> // __SMUSD, __SMUADX
+#endif
+
 /**
  * @brief Fast multiply-accumulate for complex numbers
  * 
@@ -57,6 +61,34 @@ void cmac512(const float *cmplxA, const float *cmplxB, float *cmplxAccum)
 	}
 }
 
+/**
+ * @brief Complex multiply-accumulate of one spectrum against two filters, reading the shared spectrum once
+ * 
+ * @param cmplxA Pointer to the shared array of interleaved complex values, such as a delay line partition
+ * @param cmplxLeft Pointer to the left ear filter
+ * @param cmplxRight Pointer to the right ear filter
+ * @param accumLeft Pointer to the left ear accumulator
+ * @param accumRight Pointer to the right ear accumulator
+ */
+void cmacDual512(const float *cmplxA, const float *cmplxLeft, const float *cmplxRight, float *accumLeft, float *accumRight)
+{
+#pragma GCC unroll 4
+	for (size_t i = 256; i > 0; i--)
+	{
+		const float aRe = *cmplxA++;
+		const float aIm = *cmplxA++;
+		const float leftRe = *cmplxLeft++;
+		const float leftIm = *cmplxLeft++;
+		const float rightRe = *cmplxRight++;
+		const float rightIm = *cmplxRight++;
+
+		*accumLeft++ += (aRe * leftRe) - (aIm * leftIm);
+		*accumLeft++ += (aRe * leftIm) + (aIm * leftRe);
+		*accumRight++ += (aRe * rightRe) - (aIm * rightIm);
+		*accumRight++ += (aRe * rightIm) + (aIm * rightRe);
+	}
+}
+
 /**
  * @brief Copy contents of src over to dest. Somehow faster than memcpy with gccarmnoneeabi and -O2
  * 
@@ -89,3 +121,367 @@ void clear512(float *dest)
 		*dest++ = 0;
 	}
 }
+
+/**
+ * @brief Scalar multiply-accumulate, dest += gain * src
+ * 
+ * @param src Source buffer
+ * @param gain Scale applied to src
+ * @param dest Accumulator buffer
+ */
+void smac512(const float *src, const float gain, float *dest)
+{
+	for (size_t i = 128; i > 0; i--)
+	{
+		*dest++ += gain * *src++;
+		*dest++ += gain * *src++;
+		*dest++ += gain * *src++;
+		*dest++ += gain * *src++;
+	}
+}
+
+/**
+ * @brief Store a block of 512 floats as q15 mantissas sharing one power-of-two scale (block floating point)
+ * 
+ * @param src Source buffer
+ * @param dest Mantissas, limited to +/-32767 so cmacBfp512() can't overflow
+ * @return Scale that converts the mantissas back to float
+ */
+float packBfp512(const float *src, int16_t *dest)
+{
+	float peak = 0;
+	for (size_t i = 0; i < 512; i++)
+	{
+		const float magnitude = fabsf(src[i]);
+		peak = (magnitude > peak) ? magnitude : peak;
+	}
+
+	if (peak == 0)
+	{
+		memset(dest, 0, 512 * sizeof(int16_t));
+		return 1.0f;
+	}
+
+	// peak < 2^exponent, so every mantissa fits in 15 bits
+	int exponent;
+	frexpf(peak, &exponent);
+	const float toMantissa = ldexpf(1.0f, 15 - exponent);
+
+	for (size_t i = 0; i < 512; i++)
+	{
+		float mantissa = src[i] * toMantissa;
+		mantissa += (mantissa < 0) ? -0.5f : 0.5f;
+		mantissa = (mantissa > 32767.0f) ? 32767.0f : ((mantissa < -32767.0f) ? -32767.0f : mantissa);
+		dest[i] = (int16_t)mantissa;
+	}
+	return ldexpf(1.0f, exponent - 15);
+}
+
+/**
+ * @brief Complex multiply-accumulate of two block-floating-point spectra into a float accumulator
+ * 
+ * @param cmplxA Pointer to first array of interleaved complex mantissas
+ * @param cmplxB Pointer to second array of interleaved complex mantissas
+ * @param scale Product of the two block scales
+ * @param cmplxAccum Pointer to accumulator buffer
+ */
+void cmacBfp512(const int16_t *cmplxA, const int16_t *cmplxB, const float scale, float *cmplxAccum)
+{
+#if defined(__IMXRT1062__)
+	// [re, im] pairs are one word each, SMUSD and SMUADX give the real and imaginary products in a cycle apiece
+	const uint32_t *wordA = (const uint32_t *)cmplxA;
+	const uint32_t *wordB = (const uint32_t *)cmplxB;
+#pragma GCC unroll 4
+	for (size_t i = 256; i > 0; i--)
+	{
+		const uint32_t a = *wordA++;
+		const uint32_t b = *wordB++;
+
+		*cmplxAccum++ += scale * (float)(int32_t)__SMUSD(a, b);
+		*cmplxAccum++ += scale * (float)(int32_t)__SMUADX(a, b);
+	}
+#else
+#pragma GCC unroll 4
+	for (size_t i = 256; i > 0; i--)
+	{
+		const int32_t aRe = *cmplxA++;
+		const int32_t aIm = *cmplxA++;
+		const int32_t bRe = *cmplxB++;
+		const int32_t bIm = *cmplxB++;
+
+		*cmplxAccum++ += scale * (float)(aRe * bRe - aIm * bIm);
+		*cmplxAccum++ += scale * (float)(aRe * bIm + aIm * bRe);
+	}
+#endif
+}
+
+/**
+ * @brief Block-floating-point multiply-accumulate of one spectrum against two filters, reading the shared spectrum once
+ * 
+ * @param cmplxA Pointer to the shared array of interleaved complex mantissas
+ * @param cmplxLeft Pointer to the left ear filter mantissas
+ * @param cmplxRight Pointer to the right ear filter mantissas
+ * @param scaleLeft Product of the block scales of cmplxA and cmplxLeft
+ * @param scaleRight Product of the block scales of cmplxA and cmplxRight
+ * @param accumLeft Pointer to the left ear accumulator
+ * @param accumRight Pointer to the right ear accumulator
+ */
+void cmacBfpDual512(const int16_t *cmplxA, const int16_t *cmplxLeft, const int16_t *cmplxRight, const float scaleLeft, const float scaleRight, float *accumLeft, float *accumRight)
+{
+#if defined(__IMXRT1062__)
+	const uint32_t *wordA = (const uint32_t *)cmplxA;
+	const uint32_t *wordLeft = (const uint32_t *)cmplxLeft;
+	const uint32_t *wordRight = (const uint32_t *)cmplxRight;
+#pragma GCC unroll 4
+	for (size_t i = 256; i > 0; i--)
+	{
+		const uint32_t a = *wordA++;
+		const uint32_t left = *wordLeft++;
+		const uint32_t right = *wordRight++;
+
+		*accumLeft++ += scaleLeft * (float)(int32_t)__SMUSD(a, left);
+		*accumLeft++ += scaleLeft * (float)(int32_t)__SMUADX(a, left);
+		*accumRight++ += scaleRight * (float)(int32_t)__SMUSD(a, right);
+		*accumRight++ += scaleRight * (float)(int32_t)__SMUADX(a, right);
+	}
+#else
+#pragma GCC unroll 4
+	for (size_t i = 256; i > 0; i--)
+	{
+		const int32_t aRe = *cmplxA++;
+		const int32_t aIm = *cmplxA++;
+		const int32_t leftRe = *cmplxLeft++;
+		const int32_t leftIm = *cmplxLeft++;
+		const int32_t rightRe = *cmplxRight++;
+		const int32_t rightIm = *cmplxRight++;
+
+		*accumLeft++ += scaleLeft * (float)(aRe * leftRe - aIm * leftIm);
+		*accumLeft++ += scaleLeft * (float)(aRe * leftIm + aIm * leftRe);
+		*accumRight++ += scaleRight * (float)(aRe * rightRe - aIm * rightIm);
+		*accumRight++ += scaleRight * (float)(aRe * rightIm + aIm * rightRe);
+	}
+#endif
+}
+
+/**
+ * @brief Dot products of a run of complex values against two filters, added to sums[] (left re, left im, right re, right im)
+ * 
+ */
+static inline void cdotDual(const float *cmplxA, const float *cmplxLeft, const float *cmplxRight, size_t count, float *sums)
+{
+	float leftRe = 0, leftIm = 0, rightRe = 0, rightIm = 0;
+
+#pragma GCC unroll 4
+	for (size_t i = count; i > 0; i--)
+	{
+		const float aRe = *cmplxA++;
+		const float aIm = *cmplxA++;
+		const float lRe = *cmplxLeft++;
+		const float lIm = *cmplxLeft++;
+		const float rRe = *cmplxRight++;
+		const float rIm = *cmplxRight++;
+
+		leftRe += (aRe * lRe) - (aIm * lIm);
+		leftIm += (aRe * lIm) + (aIm * lRe);
+		rightRe += (aRe * rRe) - (aIm * rIm);
+		rightIm += (aRe * rIm) + (aIm * rRe);
+	}
+
+	sums[0] += leftRe;
+	sums[1] += leftIm;
+	sums[2] += rightRe;
+	sums[3] += rightIm;
+}
+
+/**
+ * @brief Dual-ear multiply-accumulate over a bin-major delay line and filter pair. Bin b of slot s sits at [2 * (partitions * b + s)],
+ * and the filters hold partition p in slot partitions - 1 - p, so each bin is two contiguous dot products with the sums kept in registers
+ * 
+ * @param delayLine Bin-major ring of input spectra
+ * @param filterLeft Bin-major left ear filter, partitions reversed
+ * @param filterRight Bin-major right ear filter, partitions reversed
+ * @param partitions Slots per bin
+ * @param newest Delay line slot of the newest spectrum, which pairs with partition 0
+ * @param firstPartition First filter partition to accumulate, partitions before it are skipped
+ * @param accumLeft Pointer to the left ear accumulator (512 floats)
+ * @param accumRight Pointer to the right ear accumulator (512 floats)
+ */
+void cmacBinMajor512(const float *delayLine, const float *filterLeft, const float *filterRight, const size_t partitions, const size_t newest,
+					 const size_t firstPartition, float *accumLeft, float *accumRight)
+{
+	// Filter slot q pairs with delay line slot newest + 1 + q, wrapping to slot 0 after `unwrapped` terms
+	const size_t terms = partitions - firstPartition;
+	const size_t unwrapped = (partitions - 1 - newest < terms) ? partitions - 1 - newest : terms;
+
+	for (size_t bin = 0; bin < 256; bin++)
+	{
+		const size_t offset = 2 * partitions * bin;
+		float sums[4] = {0};
+
+		cdotDual(&delayLine[offset + 2 * (newest + 1)], &filterLeft[offset], &filterRight[offset], unwrapped, sums);
+		cdotDual(&delayLine[offset], &filterLeft[offset + 2 * unwrapped], &filterRight[offset + 2 * unwrapped], terms - unwrapped, sums);
+
+		accumLeft[2 * bin] += sums[0];
+		accumLeft[2 * bin + 1] += sums[1];
+		accumRight[2 * bin] += sums[2];
+		accumRight[2 * bin + 1] += sums[3];
+	}
+}
+
+/**
+ * @brief Split the spectrum of two real signals packed as A + jB into the half spectra of A and B (bins 0 to 128)
+ * 
+ * @param packed 256 interleaved complex bins
+ * @param halfA Half spectrum of the real part, 258 floats
+ * @param halfB Half spectrum of the imaginary part, 258 floats
+ */
+void splitHalf512(const float *packed, float *halfA, float *halfB)
+{
+	for (size_t k = 0; k <= 128; k++)
+	{
+		const size_t mirror = (256 - k) & 255;
+		const float re = packed[2 * k];
+		const float im = packed[2 * k + 1];
+		const float mirrorRe = packed[2 * mirror];
+		const float mirrorIm = packed[2 * mirror + 1];
+
+		// A = (Z[k] + conj(Z[-k])) / 2, B = (Z[k] - conj(Z[-k])) / 2j
+		*halfA++ = 0.5f * (re + mirrorRe);
+		*halfA++ = 0.5f * (im - mirrorIm);
+		*halfB++ = 0.5f * (im + mirrorIm);
+		*halfB++ = 0.5f * (mirrorRe - re);
+	}
+}
+
+/**
+ * @brief Pack the half spectra of two real signals into the full spectrum of A + jB, so one inverse FFT returns both
+ * 
+ * @param halfA Half spectrum destined for the real part, 258 floats
+ * @param halfB Half spectrum destined for the imaginary part, 258 floats
+ * @param packed 256 interleaved complex bins
+ */
+void mergeHalf512(const float *halfA, const float *halfB, float *packed)
+{
+	for (size_t k = 0; k <= 128; k++)
+	{
+		const float aRe = halfA[2 * k];
+		const float aIm = halfA[2 * k + 1];
+		const float bRe = halfB[2 * k];
+		const float bIm = halfB[2 * k + 1];
+
+		// Z[k] = A[k] + jB[k], and Z[-k] = conj(A[k]) + j conj(B[k]) since A and B are Hermitian
+		packed[2 * k] = aRe - bIm;
+		packed[2 * k + 1] = aIm + bRe;
+		if ((k != 0) && (k != 128))
+		{
+			packed[2 * (256 - k)] = aRe + bIm;
+			packed[2 * (256 - k) + 1] = bRe - aIm;
+		}
+	}
+}
+
+/**
+ * @brief Complex multiply-accumulate of two half spectra (bins 0 to 128), one per ear. The mirrored bins follow from symmetry,
+ * so this is 129 CMACs per ear where cmacDual512() needs 256
+ * 
+ * @param inputLeft Half spectrum of the left input channel
+ * @param inputRight Half spectrum of the right input channel
+ * @param filterLeft Half spectrum of the left ear filter
+ * @param filterRight Half spectrum of the right ear filter
+ * @param accumLeft Pointer to the left ear accumulator (258 floats)
+ * @param accumRight Pointer to the right ear accumulator (258 floats)
+ */
+void cmacHalfDual512(const float *inputLeft, const float *inputRight, const float *filterLeft, const float *filterRight, float *accumLeft, float *accumRight)
+{
+#pragma GCC unroll 4
+	for (size_t i = 129; i > 0; i--)
+	{
+		const float xLeftRe = *inputLeft++;
+		const float xLeftIm = *inputLeft++;
+		const float xRightRe = *inputRight++;
+		const float xRightIm = *inputRight++;
+		const float leftRe = *filterLeft++;
+		const float leftIm = *filterLeft++;
+		const float rightRe = *filterRight++;
+		const float rightIm = *filterRight++;
+
+		*accumLeft++ += (xLeftRe * leftRe) - (xLeftIm * leftIm);
+		*accumLeft++ += (xLeftRe * leftIm) + (xLeftIm * leftRe);
+		*accumRight++ += (xRightRe * rightRe) - (xRightIm * rightIm);
+		*accumRight++ += (xRightRe * rightIm) + (xRightIm * rightRe);
+	}
+}
+
+/**
+ * @brief Complex multiply-accumulate of two half spectra (bins 0 to 128)
+ * 
+ * @param cmplxA Pointer to the first half spectrum
+ * @param cmplxB Pointer to the second half spectrum
+ * @param cmplxAccum Pointer to the accumulator (258 floats)
+ */
+void cmacHalf512(const float *cmplxA, const float *cmplxB, float *cmplxAccum)
+{
+#pragma GCC unroll 4
+	for (size_t i = 129; i > 0; i--)
+	{
+		const float aRe = *cmplxA++;
+		const float aIm = *cmplxA++;
+		const float bRe = *cmplxB++;
+		const float bIm = *cmplxB++;
+
+		*cmplxAccum++ += (aRe * bRe) - (aIm * bIm);
+		*cmplxAccum++ += (aRe * bIm) + (aIm * bRe);
+	}
+}
+
+/**
+ * @brief Complex multiply-accumulate over the first bins of two spectra, for filters whose upper bins carry no energy
+ * 
+ * @param cmplxA Pointer to the first array of interleaved complex values
+ * @param cmplxB Pointer to the second array of interleaved complex values
+ * @param cmplxAccum Pointer to the accumulator
+ * @param bins Number of complex values to multiply
+ */
+void cmacBins512(const float *cmplxA, const float *cmplxB, float *cmplxAccum, const size_t bins)
+{
+#pragma GCC unroll 4
+	for (size_t i = bins; i > 0; i--)
+	{
+		const float aRe = *cmplxA++;
+		const float aIm = *cmplxA++;
+		const float bRe = *cmplxB++;
+		const float bIm = *cmplxB++;
+
+		*cmplxAccum++ += (aRe * bRe) - (aIm * bIm);
+		*cmplxAccum++ += (aRe * bIm) + (aIm * bRe);
+	}
+}
+
+/**
+ * @brief cmacDual512() over the first bins of the spectra
+ * 
+ * @param cmplxA Pointer to the shared array of interleaved complex values
+ * @param cmplxLeft Pointer to the left ear filter
+ * @param cmplxRight Pointer to the right ear filter
+ * @param accumLeft Pointer to the left ear accumulator
+ * @param accumRight Pointer to the right ear accumulator
+ * @param bins Number of complex values to multiply
+ */
+void cmacDualBins512(const float *cmplxA, const float *cmplxLeft, const float *cmplxRight, float *accumLeft, float *accumRight, const size_t bins)
+{
+#pragma GCC unroll 4
+	for (size_t i = bins; i > 0; i--)
+	{
+		const float aRe = *cmplxA++;
+		const float aIm = *cmplxA++;
+		const float leftRe = *cmplxLeft++;
+		const float leftIm = *cmplxLeft++;
+		const float rightRe = *cmplxRight++;
+		const float rightIm = *cmplxRight++;
+
+		*accumLeft++ += (aRe * leftRe) - (aIm * leftIm);
+		*accumLeft++ += (aRe * leftIm) + (aIm * leftRe);
+		*accumRight++ += (aRe * rightRe) - (aIm * rightIm);
+		*accumRight++ += (aRe * rightIm) + (aIm * rightRe);
+	}
+}
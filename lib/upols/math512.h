@@ -21,8 +21,21 @@ extern "C"
 {
 #endif
 	void cmac512(const float *cmplxA, const float *cmplxB, float *cmplxAccum);
+	void cmacDual512(const float *cmplxA, const float *cmplxLeft, const float *cmplxRight, float *accumLeft, float *accumRight);
 	void cp512(const float *src, float *dest);
 	void clear512(float *dest);
+	void smac512(const float *src, const float gain, float *dest);
+	float packBfp512(const float *src, int16_t *dest);
+	void cmacBfp512(const int16_t *cmplxA, const int16_t *cmplxB, const float scale, float *cmplxAccum);
+	void cmacBfpDual512(const int16_t *cmplxA, const int16_t *cmplxLeft, const int16_t *cmplxRight, const float scaleLeft, const float scaleRight, float *accumLeft, float *accumRight);
+	void cmacBinMajor512(const float *delayLine, const float *filterLeft, const float *filterRight, const size_t partitions, const size_t newest,
+						 const size_t firstPartition, float *accumLeft, float *accumRight);
+	void splitHalf512(const float *packed, float *halfA, float *halfB);
+	void mergeHalf512(const float *halfA, const float *halfB, float *packed);
+	void cmacHalf512(const float *cmplxA, const float *cmplxB, float *cmplxAccum);
+	void cmacHalfDual512(const float *inputLeft, const float *inputRight, const float *filterLeft, const float *filterRight, float *accumLeft, float *accumRight);
+	void cmacBins512(const float *cmplxA, const float *cmplxB, float *cmplxAccum, const size_t bins);
+	void cmacDualBins512(const float *cmplxA, const float *cmplxLeft, const float *cmplxRight, float *accumLeft, float *accumRight, const size_t bins);
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,711 @@
+/**
+ * @file nupols.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Stereo Convolution using a Non-Uniformly-Partitioned Overlap-Save Scheme
+ * @version 0.1
+ * @date 2021-12-06
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ * @details
+ * The filter is split into stages of increasing block size. The head stage is the regular
+ * 128-sample UPOLS over the first 1024 taps, so input-to-output latency is unchanged. Each
+ * larger stage collects its own block of input and starts two of its own blocks into the
+ * filter, so the output of a block isn't read until a whole block after the block fires.
+ * Firing only stores the input. The forward FFT, the CMAC over every partition and the
+ * inverse FFT then run as a job that takes an even share of the work each block until the
+ * next firing. The transforms are split by radix-4 decimation in time down to 256-point
+ * FFTs, so no step of a job is bigger than the head stage's own FFT. The tail stage starts
+ * part-filled, so the middle stage fires on blocks 3, 7, 11, 15 of every 16 and the tail on
+ * block 13, never both on one block. As in UPOLS_HALF_SPECTRUM, both ears are merged into
+ * one spectrum so each stage needs one inverse transform per block.
+ *
+ * CMAC work per ear per block (complex bins):
+ *   UPOLS:  64 * 256                                   = 16384
+ *   NUPOLS: 8 * 256 + 6 * 1024 / 4 + 2 * 4096 / 16    = 4096
+ *
+ */
+
+#include "nupols.h"
+
+// The layout is fixed for 8192-tap HRIRs. Shorter filters only build when the non-uniform engine isn't used
+#if defined(UPOLS_NONUNIFORM) || (UPOLS_PARTITION_COUNT == 64)
+_Static_assert(HeadBlockSize * HeadPartitions + MidBlockSize * MidPartitions + TailBlockSize * TailPartitions == ImpulseSamples,
+			   "Non-uniform layout must cover exactly ImpulseSamples taps");
+#endif
+_Static_assert(HeadBlockSize * HeadPartitions >= 2 * MidBlockSize, "Middle stage needs a whole block to spread its work over");
+_Static_assert(HeadBlockSize * HeadPartitions + MidBlockSize * MidPartitions >= 2 * TailBlockSize,
+			   "Tail stage needs a whole block to spread its work over");
+_Static_assert((TailPhase % MidBlockSize) != 0, "Tail must not fire on the same blocks as the middle stage");
+
+enum SplitTransform
+{
+	SplitRadix = 4,							  // Each split turns one transform into four quarter-length ones and a combining pass
+	SplitLeafBins = 2 * PartitionSize,		  // Splitting stops at transforms the size of the head stage's
+	SplitTwiddles = 3 * 2 * TailBlockSize / 4 // W^(r * q) of the largest transform, r < 4, q < N / 4
+};
+
+// One of the transforms a split transform is made of
+typedef struct splitNode_t
+{
+	uint32_t level;	  // Splits from the full transform, splitLevels for a leaf FFT
+	uint32_t residue; // Covers input elements residue, residue + 4^level, ...
+	uint32_t offset;  // Complex offset into the scratch buffer
+} splitNode_t;
+
+_section_ocram static float32_t splitTwiddles[2 * SplitTwiddles]; // cos, sin of 2 * pi * k / (2 * TailBlockSize)
+
+/**
+ * @brief Complex multiply-accumulate over an arbitrary number of bins
+ *
+ * @param cmplxA Pointer to first array of interleaved complex values
+ * @param cmplxB Pointer to second array of interleaved complex values
+ * @param cmplxAccum Pointer to accumulator buffer
+ * @param bins Number of complex values
+ */
+static void cmac(const float32_t *cmplxA, const float32_t *cmplxB, float32_t *cmplxAccum, size_t bins)
+{
+#pragma GCC unroll 4
+	for (size_t i = bins; i > 0; i--)
+	{
+		const float32_t aRe = *cmplxA++;
+		const float32_t aIm = *cmplxA++;
+		const float32_t bRe = *cmplxB++;
+		const float32_t bIm = *cmplxB++;
+
+		*cmplxAccum++ += (aRe * bRe) - (aIm * bIm);
+		*cmplxAccum++ += (aRe * bIm) + (aIm * bRe);
+	}
+}
+
+/**
+ * @brief Number of transforms in a split transform, leaves and combining passes, in the order they run
+ *
+ * @param levels Radix-4 splits
+ */
+static uint32_t splitSteps(uint32_t levels)
+{
+	return ((1u << (2 * (levels + 1))) - 1) / 3;
+}
+
+/**
+ * @brief Steps in a deferred stage's job: forward transform, CMAC, ear merge, inverse transform
+ *
+ * @param stage Deferred stage
+ */
+static uint32_t jobSteps(const nupolsStage_t *stage)
+{
+	return 2 * stage->transformSteps + 2;
+}
+
+/**
+ * @brief Find which transform a step of a split transform runs. Children come before their parent, so every combining
+ * pass finds its four quarters ready
+ *
+ * @param stage Deferred stage
+ * @param step Step within one transform, less than transformSteps
+ */
+static splitNode_t splitNode(const nupolsStage_t *stage, uint32_t step)
+{
+	splitNode_t node = {0, 0, 0};
+	uint32_t length = 2 * stage->blockSize;
+
+	for (uint32_t height = stage->splitLevels; height && (step != splitSteps(height) - 1); height--)
+	{
+		const uint32_t childSteps = splitSteps(height - 1);
+		const uint32_t child = step / childSteps;
+		step %= childSteps;
+		length /= SplitRadix;
+
+		node.residue += child << (2 * node.level);
+		node.offset += child * length;
+		node.level++;
+	}
+	return node;
+}
+
+/**
+ * @brief Rough cost of a complex FFT in CMAC bins, taking a radix-2 butterfly as two and a half bins
+ *
+ * @param bins FFT length
+ */
+static uint32_t fftCost(uint32_t bins)
+{
+	uint32_t stages = 0;
+	for (uint32_t n = bins; n > 1; n >>= 1)
+	{
+		stages++;
+	}
+	return 5 * bins / 4 * stages;
+}
+
+/**
+ * @brief Cost of one step of a stage's job other than the CMAC, in CMAC bins
+ *
+ * @param stage Deferred stage
+ * @param step Step of the job
+ */
+static uint32_t jobStepCost(const nupolsStage_t *stage, uint32_t step)
+{
+	const uint32_t bins = 2 * stage->blockSize;
+	if (step == stage->transformSteps + 1)
+	{
+		return bins; // Ear merge
+	}
+
+	const uint32_t transformStep = (step < stage->transformSteps) ? step : step - stage->transformSteps - 2;
+	const splitNode_t node = splitNode(stage, transformStep);
+	const uint32_t length = bins >> (2 * node.level);
+	return (node.level == stage->splitLevels) ? fftCost(length) + length : length;
+}
+
+/**
+ * @brief Fill the shared twiddle table on first use
+ *
+ */
+static void initSplitTwiddles(void)
+{
+	static bool twiddlesReady;
+	if (twiddlesReady)
+	{
+		return;
+	}
+
+	for (size_t k = 0; k < SplitTwiddles; k++)
+	{
+		const double angle = 2.0 * M_PI * (double)k / (double)(2 * TailBlockSize);
+		splitTwiddles[2 * k] = (float32_t)cos(angle);
+		splitTwiddles[2 * k + 1] = (float32_t)sin(angle);
+	}
+	twiddlesReady = true;
+}
+
+/**
+ * @brief Set up a convolver in memory provided by the caller. Nothing needs to be zeroed beforehand
+ *
+ * @param nupols Convolver to initialize
+ * @param fastMemory NupolsFastFloats floats for the filters and delay lines
+ * @param slowMemory NupolsSlowFloats floats for the windows, accumulators and the output ring, can be slower memory
+ */
+void nupolsInit(nupols_t *nupols, float32_t *fastMemory, float32_t *slowMemory)
+{
+	const uint16_t layout[NupolsStageCount][3] = {
+		{HeadBlockSize, HeadPartitions, 0},
+		{MidBlockSize, MidPartitions, 0},
+		{TailBlockSize, TailPartitions, TailPhase},
+	};
+
+	initSplitTwiddles();
+
+	memset(nupols, 0, sizeof(*nupols));
+	memset(fastMemory, 0, NupolsFastFloats * sizeof(float32_t));
+	memset(slowMemory, 0, NupolsSlowFloats * sizeof(float32_t));
+	nupols->fastMemory = fastMemory;
+	nupols->slowMemory = slowMemory;
+
+	float32_t *fast = fastMemory;
+	float32_t *slow = slowMemory;
+	uint16_t tapOffset = 0;
+
+	for (size_t s = 0; s < NupolsStageCount; s++)
+	{
+		nupolsStage_t *stage = &nupols->stages[s];
+		const size_t spectrumLength = 4 * layout[s][0];
+
+		stage->blockSize = layout[s][0];
+		stage->partitionCount = layout[s][1];
+		stage->fillCount = layout[s][2];
+		stage->tapOffset = tapOffset;
+		stage->blocksPerFiring = stage->blockSize / PartitionSize;
+
+		while (((2 * stage->blockSize) >> (2 * stage->splitLevels)) > SplitLeafBins)
+		{
+			stage->splitLevels++;
+		}
+		stage->transformSteps = splitSteps(stage->splitLevels);
+		stage->jobStep = jobSteps(stage);
+
+		uint32_t jobCost = 2 * stage->partitionCount * 2 * stage->blockSize;
+		for (uint32_t step = 0; step < jobSteps(stage); step++)
+		{
+			jobCost += (step == stage->transformSteps) ? 0 : jobStepCost(stage, step);
+		}
+		stage->jobShare = (jobCost + stage->blocksPerFiring - 1) / stage->blocksPerFiring;
+
+		stage->filters[LeftFilter] = fast;
+		fast += stage->partitionCount * spectrumLength;
+		stage->filters[RightFilter] = fast;
+		fast += stage->partitionCount * spectrumLength;
+		stage->delayLine = fast;
+		fast += stage->partitionCount * spectrumLength;
+
+		stage->slidingWindow = slow;
+		slow += spectrumLength;
+		stage->accum[LeftFilter] = slow;
+		slow += spectrumLength;
+		stage->accum[RightFilter] = slow;
+		slow += spectrumLength;
+		stage->scratch = slow;
+		slow += spectrumLength;
+
+		tapOffset += stage->blockSize * stage->partitionCount;
+	}
+
+	nupols->outputRing[LeftFilter] = slow;
+	slow += OutputRingSize;
+	nupols->outputRing[RightFilter] = slow;
+}
+
+/**
+ * @brief Allocate a convolver and both of its memory pools
+ *
+ * @return New convolver, or NULL if there isn't enough memory
+ */
+nupols_t *nupolsCreate(void)
+{
+	nupols_t *nupols = malloc(sizeof(nupols_t));
+	float32_t *fastMemory = malloc(NupolsFastFloats * sizeof(float32_t));
+	float32_t *slowMemory = malloc(NupolsSlowFloats * sizeof(float32_t));
+
+	if (!nupols || !fastMemory || !slowMemory)
+	{
+		free(nupols);
+		free(fastMemory);
+		free(slowMemory);
+		return NULL;
+	}
+
+	nupolsInit(nupols, fastMemory, slowMemory);
+	nupols->ownsMemory = true;
+	return nupols;
+}
+
+/**
+ * @brief Free a convolver from nupolsCreate(). Convolvers set up with nupolsInit() belong to the caller
+ *
+ * @param nupols Convolver to free, may be NULL
+ */
+void nupolsDestroy(nupols_t *nupols)
+{
+	if (nupols && nupols->ownsMemory)
+	{
+		free(nupols->fastMemory);
+		free(nupols->slowMemory);
+		free(nupols);
+	}
+}
+
+/**
+ * @brief Compute partition spectra for every stage from the time-domain HRIR pair
+ *
+ * @param nupols Convolver to update
+ * @param irIndex Index of the HRIR pair
+ */
+void nupolsProcessFilters(nupols_t *nupols, const uint16_t irIndex)
+{
+	const hrirBlend_t blend = hrirBlendSingle(irIndex);
+	nupolsProcessBlend(nupols, &blend);
+}
+
+/**
+ * @brief Compute partition spectra for every stage from a weighted mix of HRIR pairs
+ *
+ * @param nupols Convolver to update
+ * @param blend HRIR pairs and weights, as returned by hrirLookup()
+ */
+void nupolsProcessBlend(nupols_t *nupols, const hrirBlend_t *blend)
+{
+	for (size_t s = 0; s < NupolsStageCount; s++)
+	{
+		nupolsStage_t *stage = &nupols->stages[s];
+		const size_t spectrumLength = 4 * stage->blockSize;
+
+		for (size_t i = 0; i < 2; i++)
+		{
+			for (size_t j = 0; j < stage->partitionCount; j++)
+			{
+				float32_t *subfilterSpectra = &stage->filters[i][spectrumLength * j];
+				memset(subfilterSpectra, 0, spectrumLength * sizeof(float32_t));
+
+				const size_t firstTap = stage->tapOffset + stage->blockSize * j;
+				for (size_t d = 0; d < BlendDirections; d++)
+				{
+					if (blend->weight[d] == 0)
+					{
+						continue;
+					}
+
+					const float32_t *hrir = &hrirPair(blend->irIndex[d])[ImpulseSamples * i + firstTap];
+					for (size_t k = 0; k < stage->blockSize; k++)
+					{
+						// Zero-padded on the left side
+						subfilterSpectra[2 * (k + stage->blockSize)] += blend->weight[d] * hrir[k];
+					}
+				}
+
+				dspCfft(subfilterSpectra, 2 * stage->blockSize, ForwardFFT);
+			}
+		}
+	}
+}
+
+/**
+ * @brief Multiply-accumulate the newest spectrum and its predecessors against every partition, continuing from the job cursor
+ *
+ * @param stage Stage being advanced
+ * @param remaining Complex bins to process at most
+ * @return Complex bins processed
+ */
+static uint32_t accumulatePartitions(nupolsStage_t *stage, uint32_t remaining)
+{
+	const uint32_t bins = 2 * stage->blockSize; // Complex bins per spectrum
+	const uint32_t totalBins = 2 * stage->partitionCount * bins;
+
+	uint32_t done = 0;
+	while (remaining && stage->jobCursor < totalBins)
+	{
+		const uint32_t task = stage->jobCursor / bins;
+		const uint32_t binOffset = stage->jobCursor % bins;
+		const uint32_t ear = task / stage->partitionCount;
+		const uint32_t partition = task % stage->partitionCount;
+		const uint32_t slot = (stage->currentIndex + stage->partitionCount - partition) % stage->partitionCount;
+
+		uint32_t count = bins - binOffset;
+		count = (count < remaining) ? count : remaining;
+
+		cmac(&stage->delayLine[2 * (slot * bins + binOffset)],
+			 &stage->filters[ear][2 * (partition * bins + binOffset)],
+			 &stage->accum[ear][2 * binOffset], count);
+
+		stage->jobCursor += count;
+		remaining -= count;
+		done += count;
+	}
+	return done;
+}
+
+/**
+ * @brief Merge both ear accumulators into the left one, so a single inverse transform returns the left ear in the real
+ * part and the right ear in the imaginary part. The right accumulator is cleared for the next job
+ *
+ * @param stage Stage with both accumulators complete
+ */
+static void mergeEars(nupolsStage_t *stage)
+{
+	const uint32_t bins = 2 * stage->blockSize;
+	float32_t *left = stage->accum[LeftFilter];
+	float32_t *right = stage->accum[RightFilter];
+
+	// Hermitian part of the left spectrum plus the anti-Hermitian part of the right, pairing bin k with bin N - k
+	for (size_t k = 0; k <= bins / 2; k++)
+	{
+		const size_t mirror = (bins - k) % bins;
+
+		const float32_t leftRe = left[2 * k], leftIm = left[2 * k + 1];
+		const float32_t rightRe = right[2 * k], rightIm = right[2 * k + 1];
+		const float32_t leftMirrorRe = left[2 * mirror], leftMirrorIm = left[2 * mirror + 1];
+		const float32_t rightMirrorRe = right[2 * mirror], rightMirrorIm = right[2 * mirror + 1];
+
+		left[2 * k] = 0.5f * ((leftRe + leftMirrorRe) + (rightRe - rightMirrorRe));
+		left[2 * k + 1] = 0.5f * ((leftIm - leftMirrorIm) + (rightIm + rightMirrorIm));
+		left[2 * mirror] = 0.5f * ((leftMirrorRe + leftRe) + (rightMirrorRe - rightRe));
+		left[2 * mirror + 1] = 0.5f * ((leftMirrorIm - leftIm) + (rightMirrorIm + rightIm));
+	}
+	memset(right, 0, 2 * bins * sizeof(float32_t));
+}
+
+/**
+ * @brief Radix-4 decimation-in-time pass joining four quarter-length transforms, stored one after the other
+ *
+ * @param quarters Quarter-length transforms
+ * @param result Full-length transform, may be the same buffer as quarters
+ * @param quarterBins Length of each quarter
+ * @param direction ForwardFFT or InverseFFT
+ */
+static void combineQuarters(const float32_t *quarters, float32_t *result, uint32_t quarterBins, uint8_t direction)
+{
+	const uint32_t stride = 2 * TailBlockSize / (SplitRadix * quarterBins);
+	const float32_t sign = direction ? -1.0f : 1.0f; // Forward twiddles are e^(-j * 2 * pi * r * q / N)
+
+	for (size_t q = 0; q < quarterBins; q++)
+	{
+		float32_t re[SplitRadix];
+		float32_t im[SplitRadix];
+		re[0] = quarters[2 * q];
+		im[0] = quarters[2 * q + 1];
+		for (size_t r = 1; r < SplitRadix; r++)
+		{
+			const float32_t *twiddle = &splitTwiddles[2 * r * q * stride];
+			const float32_t yRe = quarters[2 * (r * quarterBins + q)];
+			const float32_t yIm = quarters[2 * (r * quarterBins + q) + 1];
+			const float32_t twiddleIm = sign * twiddle[1];
+			re[r] = twiddle[0] * yRe + twiddleIm * yIm;
+			im[r] = twiddle[0] * yIm - twiddleIm * yRe;
+		}
+
+		const float32_t sumRe = re[0] + re[2], sumIm = im[0] + im[2];
+		const float32_t diffRe = re[0] - re[2], diffIm = im[0] - im[2];
+		const float32_t oddSumRe = re[1] + re[3], oddSumIm = im[1] + im[3];
+		const float32_t oddDiffRe = sign * (re[1] - re[3]), oddDiffIm = sign * (im[1] - im[3]);
+
+		// Times -j for the forward transform, +j for the inverse
+		result[2 * q] = sumRe + oddSumRe;
+		result[2 * q + 1] = sumIm + oddSumIm;
+		result[2 * (q + quarterBins)] = diffRe + oddDiffIm;
+		result[2 * (q + quarterBins) + 1] = diffIm - oddDiffRe;
+		result[2 * (q + 2 * quarterBins)] = sumRe - oddSumRe;
+		result[2 * (q + 2 * quarterBins) + 1] = sumIm - oddSumIm;
+		result[2 * (q + 3 * quarterBins)] = diffRe - oddDiffIm;
+		result[2 * (q + 3 * quarterBins) + 1] = diffIm + oddDiffRe;
+	}
+}
+
+/**
+ * @brief Last inverse combining pass, for the first half of the output only, adding both ears to the output ring
+ *
+ * @param engine nupols_t instance
+ * @param stage Deferred stage
+ */
+static void combineOutput(nupols_t *engine, const nupolsStage_t *stage)
+{
+	const uint32_t quarterBins = 2 * stage->blockSize / SplitRadix;
+	const uint32_t stride = 2 * TailBlockSize / (2 * stage->blockSize);
+	const float32_t *quarters = stage->scratch;
+	const float32_t scale = (float32_t)SplitLeafBins / (float32_t)(2 * stage->blockSize); // Leaf FFTs only scale by 1 / SplitLeafBins
+
+	for (size_t q = 0; q < quarterBins; q++)
+	{
+		float32_t re[SplitRadix];
+		float32_t im[SplitRadix];
+		re[0] = quarters[2 * q];
+		im[0] = quarters[2 * q + 1];
+		for (size_t r = 1; r < SplitRadix; r++)
+		{
+			const float32_t *twiddle = &splitTwiddles[2 * r * q * stride];
+			const float32_t yRe = quarters[2 * (r * quarterBins + q)];
+			const float32_t yIm = quarters[2 * (r * quarterBins + q) + 1];
+			re[r] = twiddle[0] * yRe - twiddle[1] * yIm;
+			im[r] = twiddle[0] * yIm + twiddle[1] * yRe;
+		}
+
+		// Second half of the output is the time-aliased portion and isn't needed
+		const uint32_t first = (stage->outputStart + q) % OutputRingSize;
+		const uint32_t second = (stage->outputStart + q + quarterBins) % OutputRingSize;
+		engine->outputRing[LeftFilter][first] += scale * (re[0] + re[1] + re[2] + re[3]);
+		engine->outputRing[RightFilter][first] += scale * (im[0] + im[1] + im[2] + im[3]);
+		engine->outputRing[LeftFilter][second] += scale * ((re[0] - re[2]) - (im[1] - im[3]));
+		engine->outputRing[RightFilter][second] += scale * ((im[0] - im[2]) + (re[1] - re[3]));
+	}
+}
+
+/**
+ * @brief Run one step of a split transform: gather and transform a leaf, or combine four finished quarters
+ *
+ * @param engine nupols_t instance
+ * @param stage Deferred stage
+ * @param source Full-length input of the transform
+ * @param step Step within the transform
+ * @param direction ForwardFFT, writing the spectrum back to source, or InverseFFT, writing to the output ring
+ */
+static void splitTransformStep(nupols_t *engine, nupolsStage_t *stage, float32_t *source, uint32_t step, uint8_t direction)
+{
+	const splitNode_t node = splitNode(stage, step);
+	const uint32_t length = (2 * stage->blockSize) >> (2 * node.level);
+	float32_t *part = &stage->scratch[2 * node.offset];
+
+	if (node.level == stage->splitLevels)
+	{
+		const uint32_t spacing = 1u << (2 * node.level);
+		for (size_t n = 0; n < length; n++)
+		{
+			part[2 * n] = source[2 * (spacing * n + node.residue)];
+			part[2 * n + 1] = source[2 * (spacing * n + node.residue) + 1];
+		}
+		dspCfft(part, length, direction);
+	}
+	else if (node.level)
+	{
+		combineQuarters(part, part, length / SplitRadix, direction);
+	}
+	else if (direction == ForwardFFT)
+	{
+		combineQuarters(stage->scratch, source, length / SplitRadix, ForwardFFT);
+	}
+	else
+	{
+		combineOutput(engine, stage);
+	}
+}
+
+/**
+ * @brief Run one step of a deferred stage's job other than the CMAC
+ *
+ * @param engine nupols_t instance
+ * @param stage Deferred stage
+ * @param step Step to run
+ */
+static void runJobStep(nupols_t *engine, nupolsStage_t *stage, uint32_t step)
+{
+	const uint32_t bins = 2 * stage->blockSize;
+
+	if (step < stage->transformSteps)
+	{
+		splitTransformStep(engine, stage, &stage->delayLine[2 * stage->currentIndex * bins], step, ForwardFFT);
+	}
+	else if (step == stage->transformSteps + 1)
+	{
+		mergeEars(stage);
+	}
+	else
+	{
+		const uint32_t transformStep = step - stage->transformSteps - 2;
+		splitTransformStep(engine, stage, stage->accum[LeftFilter], transformStep, InverseFFT);
+		if (transformStep == stage->transformSteps - 1u)
+		{
+			memset(stage->accum[LeftFilter], 0, 2 * bins * sizeof(float32_t));
+		}
+	}
+}
+
+/**
+ * @brief Spend this block's share of work on a deferred stage's job, or all of what is left on the last block before its output is read
+ *
+ * @param engine nupols_t instance
+ * @param stage Deferred stage
+ */
+static void advanceJob(nupols_t *engine, nupolsStage_t *stage)
+{
+	const uint32_t steps = jobSteps(stage);
+	if (stage->jobStep == steps)
+	{
+		return;
+	}
+
+	stage->jobCredit += stage->jobShare;
+	const bool finish = (--stage->blocksLeft == 0);
+
+	while ((stage->jobStep < steps) && (finish || (stage->jobCredit > 0)))
+	{
+		const uint32_t step = stage->jobStep;
+		if (step == stage->transformSteps)
+		{
+			const uint32_t remaining = finish ? UINT32_MAX : (uint32_t)stage->jobCredit;
+			stage->jobCredit -= accumulatePartitions(stage, remaining);
+			if (stage->jobCursor == 2 * stage->partitionCount * 2 * stage->blockSize)
+			{
+				stage->jobStep++;
+			}
+			continue;
+		}
+
+		// Steps can't be split, so one only starts if at least half of it fits in what is left of the share
+		const int32_t cost = (int32_t)jobStepCost(stage, step);
+		if (!finish && (2 * stage->jobCredit < cost))
+		{
+			break;
+		}
+		runJobStep(engine, stage, step);
+		stage->jobCredit -= cost;
+		stage->jobStep++;
+	}
+}
+
+/**
+ * @brief Store the completed input block and produce its output, at once for the head stage or as a job for the others
+ *
+ * @param engine nupols_t instance
+ * @param stage Stage with a full block of input
+ */
+static void fireStage(nupols_t *engine, nupolsStage_t *stage)
+{
+	const uint32_t bins = 2 * stage->blockSize;
+	const uint32_t slot = (stage->currentIndex + 1) % stage->partitionCount;
+	float32_t *spectrum = &stage->delayLine[2 * slot * bins];
+
+	memcpy(spectrum, stage->slidingWindow, 2 * bins * sizeof(float32_t));
+
+	// Current block becomes the previous block
+	memcpy(stage->slidingWindow, &stage->slidingWindow[bins], bins * sizeof(float32_t));
+
+	// First output sample of this block lands tapOffset samples after the block started
+	stage->outputStart = engine->sampleClock + PartitionSize + stage->tapOffset - stage->blockSize;
+	stage->currentIndex = slot;
+	stage->jobCursor = 0;
+	stage->fillCount = 0;
+
+	if (stage->tapOffset)
+	{
+		stage->jobStep = 0;
+		stage->jobCredit = 0;
+		stage->blocksLeft = stage->blocksPerFiring;
+		return;
+	}
+
+	// Head stage output is due this block
+	dspCfft(spectrum, bins, ForwardFFT);
+	accumulatePartitions(stage, UINT32_MAX);
+	mergeEars(stage);
+
+	float32_t *cmplxAccum = stage->accum[LeftFilter];
+	dspCfft(cmplxAccum, bins, InverseFFT);
+	for (size_t k = 0; k < stage->blockSize; k++)
+	{
+		// Time-aliased portion isn't copied
+		const uint32_t ringIndex = (stage->outputStart + k) % OutputRingSize;
+		engine->outputRing[LeftFilter][ringIndex] += cmplxAccum[2 * k];
+		engine->outputRing[RightFilter][ringIndex] += cmplxAccum[2 * k + 1];
+	}
+	memset(cmplxAccum, 0, 2 * bins * sizeof(float32_t));
+}
+
+/**
+ * @brief Convolve a block of stereo audio with the non-uniformly partitioned filters
+ *
+ * @param engine Convolver
+ * @param leftAudio Left channel, replaced with the left ear output
+ * @param rightAudio Right channel, replaced with the right ear output
+ */
+void nupolsConvolve(nupols_t *engine, int16_t *leftAudio, int16_t *rightAudio)
+{
+
+	float32_t leftAudioData[PartitionSize];
+	float32_t rightAudioData[PartitionSize];
+
+	dspQ15ToFloat(leftAudio, leftAudioData, PartitionSize);
+	dspQ15ToFloat(rightAudio, rightAudioData, PartitionSize);
+
+	for (size_t s = 0; s < NupolsStageCount; s++)
+	{
+		nupolsStage_t *stage = &engine->stages[s];
+
+		float32_t *window = &stage->slidingWindow[2 * (stage->blockSize + stage->fillCount)];
+		for (size_t i = 0; i < PartitionSize; i++)
+		{
+			window[2 * i] = leftAudioData[i];
+			window[2 * i + 1] = rightAudioData[i];
+		}
+		stage->fillCount += PartitionSize;
+
+		// Last block's job finishes before the next firing reuses the scratch and overwrites the oldest spectrum
+		advanceJob(engine, stage);
+
+		if (stage->fillCount == stage->blockSize)
+		{
+			fireStage(engine, stage);
+		}
+	}
+
+	const uint32_t readIndex = engine->sampleClock % OutputRingSize;
+	for (size_t i = 0; i < PartitionSize; i++)
+	{
+		leftAudioData[i] = engine->outputRing[LeftFilter][readIndex + i];
+		rightAudioData[i] = engine->outputRing[RightFilter][readIndex + i];
+	}
+	memset(&engine->outputRing[LeftFilter][readIndex], 0, PartitionSize * sizeof(float32_t));
+	memset(&engine->outputRing[RightFilter][readIndex], 0, PartitionSize * sizeof(float32_t));
+
+	engine->sampleClock += PartitionSize;
+
+	dspFloatToQ15(leftAudioData, leftAudio, PartitionSize);
+	dspFloatToQ15(rightAudioData, rightAudio, PartitionSize);
+}
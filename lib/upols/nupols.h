@@ -0,0 +1,90 @@
+/**
+ * @file nupols.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Stereo Convolution using a Non-Uniformly-Partitioned Overlap-Save Scheme
+ * @version 0.1
+ * @date 2021-12-06
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ */
+
+#pragma once
+
+#include "upols.h"
+
+// Filter layout: the head runs every block, later stages start at least two of their own blocks into the filter
+enum NonUniformLayout
+{
+	NupolsStageCount = 3,
+	HeadBlockSize = PartitionSize,	   // [0, 1024) in 128-sample partitions, runs every block
+	HeadPartitions = 8,
+	MidBlockSize = 4 * PartitionSize,  // [1024, 4096) in 512-sample partitions, fires every 4th block
+	MidPartitions = 6,
+	TailBlockSize = 16 * PartitionSize, // [4096, 8192) in 2048-sample partitions, fires every 16th block
+	TailPartitions = 2,
+	TailPhase = 2 * PartitionSize,	   // Tail starts part-filled, so it never fires on the same block as the middle stage
+	OutputRingSize = 2 * TailBlockSize
+};
+
+// Per stage: filters (2 * P spectra) + delay line (P spectra)
+#define NUPOLS_FAST_FLOATS(B, P) (3 * (P) * 4 * (B))
+// Per stage: sliding window + two accumulators + split transform scratch
+#define NUPOLS_SLOW_FLOATS(B) (4 * 4 * (B))
+
+// Memory a convolver is carved out of. The fast pool is touched by every CMAC, the slow pool can sit in OCRAM
+enum NonUniformMemory
+{
+	NupolsFastFloats = NUPOLS_FAST_FLOATS(HeadBlockSize, HeadPartitions) + NUPOLS_FAST_FLOATS(MidBlockSize, MidPartitions) +
+					   NUPOLS_FAST_FLOATS(TailBlockSize, TailPartitions),
+	NupolsSlowFloats = NUPOLS_SLOW_FLOATS(HeadBlockSize) + NUPOLS_SLOW_FLOATS(MidBlockSize) + NUPOLS_SLOW_FLOATS(TailBlockSize) +
+					   2 * OutputRingSize
+};
+
+typedef struct nupolsStage_t
+{
+	uint16_t blockSize;		  // Samples per partition
+	uint16_t partitionCount;  // Number of partitions in this stage
+	uint16_t tapOffset;		  // First filter tap handled by this stage
+	uint16_t fillCount;		  // Samples collected towards the next block
+	uint16_t currentIndex;	  // Delay line index of the newest spectrum
+	uint16_t blocksPerFiring; // Blocks of PartitionSize between firings
+	uint16_t splitLevels;	  // Radix-4 splits between the full transform and the leaf FFTs
+	uint16_t transformSteps;  // Leaf FFTs and combining passes in one transform
+	uint16_t jobStep;		  // Next step of the job started by the last firing, jobSteps() when done
+	uint16_t blocksLeft;	  // Blocks left to finish the job in
+	uint32_t jobCursor;		  // Progress through the CMAC step, in complex bins
+	int32_t jobCredit;		  // Work the job may still do this block, negative when a step overran its share
+	uint32_t jobShare;		  // Work added to the credit every block
+	uint32_t outputStart;	  // Sample clock of the job's first output sample
+	float32_t *slidingWindow; // Previous and current block, stereo interleaved
+	float32_t *delayLine;	  // Frequency-domain delay line
+	float32_t *filters[2];	  // Partition spectra for each ear
+	float32_t *accum[2];	  // Frequency-domain accumulator for each ear
+	float32_t *scratch;		  // Partial transforms of a split transform
+} nupolsStage_t;
+
+// Convolver state. Independent instances only share the read-only HRIR and twiddle tables
+typedef struct nupols_t
+{
+	nupolsStage_t stages[NupolsStageCount];
+	uint32_t sampleClock;	 // Samples processed so far, indexes outputRing
+	float32_t *outputRing[2]; // Time-domain output from every stage, summed per ear
+	float32_t *fastMemory;	 // Pools the stages were carved out of
+	float32_t *slowMemory;
+	bool ownsMemory; // Pools were allocated by nupolsCreate()
+} nupols_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+	nupols_t *nupolsCreate(void);
+	void nupolsInit(nupols_t *nupols, float32_t *fastMemory, float32_t *slowMemory);
+	void nupolsDestroy(nupols_t *nupols);
+	void nupolsProcessFilters(nupols_t *nupols, const uint16_t irIndex);
+	void nupolsProcessBlend(nupols_t *nupols, const hrirBlend_t *blend);
+	void nupolsConvolve(nupols_t *nupols, int16_t *leftAudio, int16_t *rightAudio);
+#ifdef __cplusplus
+}
+#endif
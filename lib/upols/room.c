@@ -0,0 +1,334 @@
+/**
+ * @file room.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Early reflections and late reverb added to the direct-path HRIR
+ * @version 0.1
+ * @date 2021-12-21
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ * @details
+ * A measured BRIR runs for hundreds of milliseconds, far more than the filter banks can hold. With
+ * UPOLS_ROOM the HRIR convolution in upols.c stays the direct path, and the room is added on top
+ * from a model:
+ *
+ *   Early reflections: the 24 first and second order image sources of a shoebox room, each a
+ *   single delayed tap per ear. The far ear gets the Woodworth interaural delay and a crude head
+ *   shadow. One-pole wall absorption is applied to their sum.
+ *
+ *   Late reverb: an 8-line feedback delay network with a Hadamard mixing matrix. Each line loses
+ *   the gain for UPOLS_ROOM_RT60_MS per trip, plus a little high-frequency damping. The two ears
+ *   read orthogonal combinations of the lines, so the tail is diffuse and decorrelated.
+ *
+ * The listener faces the length of the room and the source sits UPOLS_ROOM_DISTANCE_CM away in
+ * the direction given to roomSetSource(). Moving the source moves the image sources, and the new
+ * taps are crossfaded in over one block. The request is handed to the audio path like an HRIR
+ * request, and upols only lets the room move once the HRIR crossfade to the same direction starts. Per block this is a few thousand multiply-accumulates,
+ * about the cost of a handful of CMAC passes.
+ *
+ */
+
+#include "room.h"
+#include <math.h>
+
+#ifdef UPOLS_ROOM
+
+// Lengths of the late reverb lines, mutually prime and 14 to 31 ms long
+static const uint16_t fdnLengths[RoomFdnLines] = {601, 691, 797, 907, 1009, 1123, 1259, 1361};
+
+static const float32_t sampleRate = 44100.0f;
+static const float32_t speedOfSound = 343.0f; // Metres per second
+static const float32_t headRadius = 0.0875f;  // Metres
+static const float32_t wallCoefficient = 0.58f; // One-pole lowpass at about 6 kHz
+static const float32_t lineCoefficient = 0.8f;	// One-pole lowpass at about 11 kHz
+
+/**
+ * @brief Position of an image source along one axis of the room
+ *
+ * @param n Image number, negative for the reflections off the wall at 0
+ * @param size Room size along the axis
+ * @param source Source position along the axis
+ */
+static float32_t imageCoordinate(const int n, const float32_t size, const float32_t source)
+{
+	return (n & 1) ? (n + 1) * size - source : n * size + source;
+}
+
+/**
+ * @brief Compute the reflection taps for a source direction into incoming
+ *
+ * @param room Room renderer
+ * @param azimuth Degrees, counter-clockwise from the front like the HRIR tables
+ * @param elevation Degrees
+ */
+static void placeSource(room_t *room, float32_t azimuth, float32_t elevation)
+{
+	const float32_t degToRad = (float32_t)M_PI / 180.0f;
+	const float32_t reflectance = UPOLS_ROOM_REFLECTANCE / 100.0f;
+
+	// x along the length of the room (the listener's front), y to the left, z up
+	const float32_t size[3] = {UPOLS_ROOM_LENGTH_CM / 100.0f, UPOLS_ROOM_WIDTH_CM / 100.0f, UPOLS_ROOM_HEIGHT_CM / 100.0f};
+	const float32_t listener[3] = {0.4f * size[0], 0.45f * size[1], fminf(1.2f, 0.5f * size[2])};
+	const float32_t direction[3] = {cosf(elevation * degToRad) * cosf(azimuth * degToRad),
+									cosf(elevation * degToRad) * sinf(azimuth * degToRad), sinf(elevation * degToRad)};
+
+	// Sources past a wall are pulled back inside
+	float32_t source[3];
+	float32_t directDistance = 0;
+	for (size_t axis = 0; axis < 3; axis++)
+	{
+		source[axis] = listener[axis] + UPOLS_ROOM_DISTANCE_CM / 100.0f * direction[axis];
+		source[axis] = fminf(fmaxf(source[axis], 0.1f), size[axis] - 0.1f);
+		directDistance += (source[axis] - listener[axis]) * (source[axis] - listener[axis]);
+	}
+	directDistance = sqrtf(directDistance);
+
+	size_t r = 0;
+	for (int nx = -2; nx <= 2; nx++)
+	{
+		for (int ny = -2; ny <= 2; ny++)
+		{
+			for (int nz = -2; nz <= 2; nz++)
+			{
+				const int order = abs(nx) + abs(ny) + abs(nz);
+				if ((order == 0) || (order > 2))
+				{
+					continue;
+				}
+
+				const float32_t offset[3] = {imageCoordinate(nx, size[0], source[0]) - listener[0],
+											 imageCoordinate(ny, size[1], source[1]) - listener[1],
+											 imageCoordinate(nz, size[2], source[2]) - listener[2]};
+				const float32_t distance = sqrtf(offset[0] * offset[0] + offset[1] * offset[1] + offset[2] * offset[2]);
+				const float32_t lateral = offset[1] / distance; // 1 straight to the left
+
+				// Woodworth's spherical head for the far ear
+				const float32_t itd = headRadius / speedOfSound * (asinf(fabsf(lateral)) + fabsf(lateral)) * sampleRate;
+				const float32_t delay = (distance - directDistance) / speedOfSound * sampleRate;
+				const float32_t gain = powf(reflectance, (float32_t)order) * directDistance / distance;
+				const size_t farEar = (lateral > 0) ? 1 : 0; // Right ear is further from a source on the left
+
+				for (size_t ear = 0; ear < 2; ear++)
+				{
+					const float32_t earDelay = delay + ((ear == farEar) ? itd : 0);
+					room->incoming[r].delay[ear] = (uint16_t)fminf(earDelay + 0.5f, RoomEarlySamples - RoomBlockSize);
+					room->incoming[r].gain[ear] = (ear == farEar) ? gain * (1.0f - 0.5f * fabsf(lateral)) : gain;
+				}
+				r++;
+			}
+		}
+	}
+	room->pending = true;
+}
+
+/**
+ * @brief Set up a room renderer from the UPOLS_ROOM_* settings with the source straight ahead
+ *
+ * @param room Room renderer
+ */
+void roomInit(room_t *room)
+{
+	memset(room, 0, sizeof(*room));
+
+	for (size_t j = 0; j < RoomFdnLines; j++)
+	{
+		// -60 dB after UPOLS_ROOM_RT60_MS
+		room->fdnGain[j] = powf(10.0f, -3.0f * fdnLengths[j] / (sampleRate * UPOLS_ROOM_RT60_MS / 1000.0f));
+	}
+	room->reverbGain = powf(10.0f, UPOLS_ROOM_REVERB_DB / 20.0f);
+
+	placeSource(room, 0, 0);
+	memcpy(room->reflections, room->incoming, sizeof(room->reflections));
+	room->pending = false;
+}
+
+/**
+ * @brief Clear the input history and the late reverb. The reflections are kept
+ *
+ * @param room Room renderer
+ */
+void roomReset(room_t *room)
+{
+	memset(room->wallState, 0, sizeof(room->wallState));
+	memset(room->history, 0, sizeof(room->history));
+	memset(room->fdn, 0, sizeof(room->fdn));
+	memset(room->fdnIndex, 0, sizeof(room->fdnIndex));
+	memset(room->fdnDamping, 0, sizeof(room->fdnDamping));
+	room->writeIndex = 0;
+}
+
+/**
+ * @brief Queue a new source direction. roomProcess() picks it up once it's told the source may move, and crossfades the taps in
+ * over that block. Replaces any request that hasn't been picked up yet
+ *
+ * @param room Room renderer
+ * @param azimuth Degrees, counter-clockwise from the front like the HRIR tables
+ * @param elevation Degrees
+ */
+void roomSetSource(room_t *room, float32_t azimuth, float32_t elevation)
+{
+	// The audio path skips the request while it's being rewritten
+	room->requestPending = false;
+	room->requestedSource[0] = azimuth;
+	room->requestedSource[1] = elevation;
+	room->requestPending = true;
+}
+
+/**
+ * @brief Add one reflection to a block, with its gain ramped linearly across the block
+ *
+ * @param early Block to add to
+ * @param history Input ring of the ear's channel
+ * @param start Ring position of the first sample of the block
+ * @param delay Samples after the direct path
+ * @param from Gain before the block
+ * @param to Gain at the end of the block
+ */
+static void addReflection(float32_t *early, const float32_t *history, const size_t start, const uint16_t delay, const float32_t from,
+						  const float32_t to)
+{
+	const float32_t step = (to - from) / RoomBlockSize;
+	float32_t gain = from + step;
+	size_t index = (start + RoomEarlySamples - delay) & (RoomEarlySamples - 1);
+
+	for (size_t i = 0; i < RoomBlockSize; i++)
+	{
+		early[i] += gain * history[index];
+		index = (index + 1) & (RoomEarlySamples - 1);
+		gain += step;
+	}
+}
+
+/**
+ * @brief In-place fast Walsh-Hadamard transform of the line outputs, scaled to keep it orthonormal
+ *
+ * @param x RoomFdnLines values
+ */
+static void hadamard(float32_t *x)
+{
+	for (size_t span = 1; span < RoomFdnLines; span <<= 1)
+	{
+		for (size_t j = 0; j < RoomFdnLines; j += 2 * span)
+		{
+			for (size_t k = j; k < j + span; k++)
+			{
+				const float32_t a = x[k];
+				const float32_t b = x[k + span];
+				x[k] = a + b;
+				x[k + span] = a - b;
+			}
+		}
+	}
+
+	const float32_t scale = 0.35355339f; // 1 / sqrt(RoomFdnLines)
+	for (size_t j = 0; j < RoomFdnLines; j++)
+	{
+		x[j] *= scale;
+	}
+}
+
+/**
+ * @brief Add the early reflections and late reverb of a block to the direct-path output
+ *
+ * @param room Room renderer
+ * @param input Block of input, left samples in the even indexes and right in the odd
+ * @param leftAudioData Left ear output to add to, RoomBlockSize samples
+ * @param rightAudioData Right ear output to add to, RoomBlockSize samples
+ * @param moveSource Pick up a direction queued by roomSetSource() this block
+ */
+void roomProcess(room_t *room, const float32_t *input, float32_t *leftAudioData, float32_t *rightAudioData, const bool moveSource)
+{
+	if (moveSource && room->requestPending)
+	{
+		room->requestPending = false; // Cleared before reading so a request racing with this one isn't lost
+		placeSource(room, room->requestedSource[0], room->requestedSource[1]);
+	}
+
+	const size_t mask = RoomEarlySamples - 1;
+	const size_t start = room->writeIndex;
+	float32_t *audio[2] = {leftAudioData, rightAudioData};
+
+	for (size_t i = 0; i < RoomBlockSize; i++)
+	{
+		room->history[0][(start + i) & mask] = input[2 * i];
+		room->history[1][(start + i) & mask] = input[2 * i + 1];
+	}
+
+	for (size_t ear = 0; ear < 2; ear++)
+	{
+		float32_t early[RoomBlockSize];
+		memset(early, 0, sizeof(early));
+
+		for (size_t r = 0; r < RoomReflections; r++)
+		{
+			const reflection_t *current = &room->reflections[r];
+			if (!room->pending)
+			{
+				addReflection(early, room->history[ear], start, current->delay[ear], current->gain[ear], current->gain[ear]);
+				continue;
+			}
+
+			// Fade the old tap out and the new one in, which is exact when the delay hasn't changed
+			const reflection_t *incoming = &room->incoming[r];
+			addReflection(early, room->history[ear], start, current->delay[ear], current->gain[ear], 0);
+			addReflection(early, room->history[ear], start, incoming->delay[ear], 0, incoming->gain[ear]);
+		}
+
+		float32_t state = room->wallState[ear];
+		for (size_t i = 0; i < RoomBlockSize; i++)
+		{
+			state += wallCoefficient * (early[i] - state);
+			audio[ear][i] += state;
+		}
+		room->wallState[ear] = state;
+	}
+
+	if (room->pending)
+	{
+		memcpy(room->reflections, room->incoming, sizeof(room->reflections));
+		room->pending = false;
+	}
+
+	float32_t *lines[RoomFdnLines];
+	lines[0] = room->fdn;
+	for (size_t j = 1; j < RoomFdnLines; j++)
+	{
+		lines[j] = lines[j - 1] + fdnLengths[j - 1];
+	}
+
+	for (size_t i = 0; i < RoomBlockSize; i++)
+	{
+		const size_t late = (start + RoomEarlySamples + i - RoomLateDelay) & mask;
+		const float32_t excitation = 0.5f * room->reverbGain * (room->history[0][late] + room->history[1][late]);
+
+		float32_t output[RoomFdnLines];
+		float32_t feedback[RoomFdnLines];
+		for (size_t j = 0; j < RoomFdnLines; j++)
+		{
+			output[j] = lines[j][room->fdnIndex[j]];
+			room->fdnDamping[j] += lineCoefficient * (output[j] - room->fdnDamping[j]);
+			feedback[j] = room->fdnGain[j] * room->fdnDamping[j];
+		}
+		hadamard(feedback);
+
+		float32_t left = 0;
+		float32_t right = 0;
+		for (size_t j = 0; j < RoomFdnLines; j++)
+		{
+			// Orthogonal rows of the Hadamard matrix for each ear, and alternating signs into the lines
+			left += (j & 1) ? -output[j] : output[j];
+			right += (j & 2) ? -output[j] : output[j];
+
+			lines[j][room->fdnIndex[j]] = feedback[j] + ((j & 4) ? -excitation : excitation);
+			if (++room->fdnIndex[j] == fdnLengths[j])
+			{
+				room->fdnIndex[j] = 0;
+			}
+		}
+		leftAudioData[i] += 0.35355339f * left;
+		rightAudioData[i] += 0.35355339f * right;
+	}
+
+	room->writeIndex = (uint16_t)((start + RoomBlockSize) & mask);
+}
+#endif
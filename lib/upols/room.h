@@ -0,0 +1,93 @@
+/**
+ * @file room.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Early reflections and late reverb added to the direct-path HRIR
+ * @version 0.1
+ * @date 2021-12-21
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ */
+
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "dspBackend.h"
+
+// Shoebox room, centimetres. The listener stands off-centre so opposite walls don't reflect at the same delay
+#ifndef UPOLS_ROOM_WIDTH_CM
+#define UPOLS_ROOM_WIDTH_CM 420
+#endif
+#ifndef UPOLS_ROOM_LENGTH_CM
+#define UPOLS_ROOM_LENGTH_CM 560
+#endif
+#ifndef UPOLS_ROOM_HEIGHT_CM
+#define UPOLS_ROOM_HEIGHT_CM 270
+#endif
+
+// Distance of the source from the listener, centimetres
+#ifndef UPOLS_ROOM_DISTANCE_CM
+#define UPOLS_ROOM_DISTANCE_CM 150
+#endif
+
+// Share of the pressure every wall reflects, percent
+#ifndef UPOLS_ROOM_REFLECTANCE
+#define UPOLS_ROOM_REFLECTANCE 70
+#endif
+
+// Decay time of the late reverb, milliseconds
+#ifndef UPOLS_ROOM_RT60_MS
+#define UPOLS_ROOM_RT60_MS 450
+#endif
+
+// Level of the late reverb, dB
+#ifndef UPOLS_ROOM_REVERB_DB
+#define UPOLS_ROOM_REVERB_DB -20
+#endif
+
+enum RoomLengths
+{
+	RoomBlockSize = 128,	   // Samples per roomProcess() call, one UPOLS partition
+	RoomReflections = 24,	   // Image sources of first and second order
+	RoomEarlySamples = 4096,   // Input history of each channel, a power of two
+	RoomLateDelay = 882,	   // 20 ms from the direct path to the input of the late reverb
+	RoomFdnLines = 8,		   // Feedback delay network lines, mixed by a Hadamard matrix
+	RoomFdnSamples = 8192	   // Storage shared by the lines, at least the sum of their lengths
+};
+
+typedef struct reflection_t
+{
+	uint16_t delay[2]; // Samples after the direct path, per ear
+	float32_t gain[2]; // Per ear
+} reflection_t;
+
+typedef struct room_t
+{
+	reflection_t reflections[RoomReflections]; // Taps in use
+	reflection_t incoming[RoomReflections];	   // Taps of the newest source direction, faded in over the next block
+	bool pending;							   // incoming differs from reflections
+	volatile bool requestPending;			   // Set by roomSetSource(), consumed by roomProcess()
+	volatile float32_t requestedSource[2];	   // Azimuth and elevation asked for by roomSetSource()
+	float32_t wallState[2];					   // One-pole wall absorption of the early reflections, per ear
+	float32_t history[2][RoomEarlySamples];	   // Input ring of each channel
+	uint16_t writeIndex;					   // Next sample of history
+	float32_t fdn[RoomFdnSamples];			   // Delay lines of the late reverb, back to back
+	uint16_t fdnIndex[RoomFdnLines];		   // Read and write position within each line
+	float32_t fdnGain[RoomFdnLines];		   // Loss per trip around each line for UPOLS_ROOM_RT60_MS
+	float32_t fdnDamping[RoomFdnLines];		   // One-pole state of the high-frequency loss of each line
+	float32_t reverbGain;
+} room_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+	void roomInit(room_t *room);
+	void roomReset(room_t *room);
+	void roomSetSource(room_t *room, float32_t azimuth, float32_t elevation);
+	void roomProcess(room_t *room, const float32_t *input, float32_t *leftAudioData, float32_t *rightAudioData, const bool moveSource);
+#ifdef __cplusplus
+}
+#endif
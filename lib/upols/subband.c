@@ -0,0 +1,298 @@
+/**
+ * @file subband.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Multirate convolution of the low-frequency HRIR tail
+ * @version 0.1
+ * @date 2021-12-20
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ * @details
+ * Past the first few milliseconds an HRIR, and even more so a room response, carries little above
+ * a few kHz. With UPOLS_SUBBAND the full-rate engine in upols.c only convolves the first
+ * PartitionCount partitions, and the following SubbandPartitions go through a second uniformly
+ * partitioned convolver running at 1 / SubbandFactor of the sample rate:
+ *
+ *   input -> lowpass -> keep every SubbandFactor-th sample -> low-rate UPOLS -> zero-stuff -> lowpass -> + output
+ *
+ * Each block gives SubbandBlockSize low-rate samples. These are convolved in SubbandBlockSize-tap
+ * partitions with SubbandFftLength-point FFTs, with the stereo packing of upols.c. A low-rate
+ * partition covers the same 128 full-rate taps as a full-rate one for 1 / SubbandFactor of the
+ * CMAC work.
+ *
+ * The low-rate filters are the tail taps, lowpassed and decimated at preparation time. They are
+ * moved ahead by the delay of the two linear-phase lowpass filters in the signal path, so the tail
+ * still starts at tap 128 * PartitionCount. The lead-in this spreads before that tap is why the
+ * low-rate filters start one partition early.
+ *
+ */
+
+#include "subband.h"
+
+#ifdef UPOLS_SUBBAND
+
+/**
+ * @brief Blackman-windowed sinc shared by the decimator, the interpolator and the low-rate filters. Half gain at 0.8 of the
+ * low-rate Nyquist frequency, unity at DC
+ *
+ * @return SubbandFirTaps coefficients, symmetric
+ */
+static const float32_t *lowpass(void)
+{
+	static float32_t coeffs[SubbandFirTaps];
+	static bool designed = false;
+
+	if (!designed)
+	{
+		const float32_t cutoff = 0.4f / SubbandFactor; // Cycles per sample
+		const float32_t pi = (float32_t)M_PI;
+		float32_t sum = 0;
+
+		for (size_t j = 0; j < SubbandFirTaps; j++)
+		{
+			const float32_t x = (float32_t)j - SubbandFirDelay;
+			const float32_t sinc = (x == 0) ? 2 * cutoff : sinf(2 * pi * cutoff * x) / (pi * x);
+			const float32_t phase = 2 * pi * j / (SubbandFirTaps - 1);
+			const float32_t window = 0.42f - 0.5f * cosf(phase) + 0.08f * cosf(2 * phase);
+			coeffs[j] = sinc * window;
+			sum += coeffs[j];
+		}
+
+		for (size_t j = 0; j < SubbandFirTaps; j++)
+		{
+			coeffs[j] /= sum;
+		}
+		designed = true;
+	}
+	return coeffs;
+}
+
+/**
+ * @brief Clear the decimator, delay line and interpolator
+ *
+ * @param subband Low-rate convolver
+ */
+void subbandReset(subband_t *subband)
+{
+	memset(subband, 0, sizeof(*subband));
+	lowpass();
+}
+
+/**
+ * @brief Add the lowpassed and decimated tails of a set of HRIRs to one part of a low-rate filter partition
+ *
+ * @param spectrum Partition being built, taps zero-padded on the left
+ * @param irIndex HRIR pairs to mix
+ * @param weights Weight of each pair, signed
+ * @param ear LeftFilter or RightFilter
+ * @param partition Low-rate partition, 0 to SubbandFilterPartitions - 1
+ * @param part 0 for the real part, 1 for the imaginary part
+ */
+static void addLowRateTaps(float32_t *spectrum, const uint16_t *irIndex, const float32_t *weights, const size_t ear,
+						   const size_t partition, const size_t part)
+{
+	const float32_t *coeffs = lowpass();
+	const ptrdiff_t tailStart = PartitionSize * PartitionCount;
+
+	for (size_t j = 0; j < BlendDirections; j++)
+	{
+		const float32_t weight = weights[j];
+		if (weight == 0)
+		{
+			continue;
+		}
+
+		const float32_t *hrir = &hrirPair(irIndex[j])[ImpulseSamples * ear];
+		for (size_t t = 0; t < SubbandBlockSize; t++)
+		{
+			// Full-rate tap of this low-rate tap, moved ahead by the delay of the decimator and interpolator
+			const size_t lowTap = SubbandBlockSize * (PartitionCount - 1 + partition) + t;
+			const ptrdiff_t centre = SubbandFactor * lowTap + 3 * SubbandFirDelay;
+
+			float32_t sum = 0;
+			for (size_t k = 0; k < SubbandFirTaps; k++)
+			{
+				const ptrdiff_t tap = centre - (ptrdiff_t)k;
+				if ((tap >= tailStart) && (tap < ImpulseSamples))
+				{
+					sum += coeffs[k] * hrir[tap];
+				}
+			}
+
+			// Zero-padded on the left side, like the full-rate partitions
+			spectrum[2 * (t + SubbandBlockSize) + part] += weight * SubbandFactor * sum;
+		}
+	}
+}
+
+/**
+ * @brief Compute the spectrum of one low-rate filter partition from the tails of the blended HRIRs
+ *
+ * @param bank Filter bank to write to
+ * @param blend HRIR pairs to mix
+ * @param ear LeftFilter or RightFilter
+ * @param partition Low-rate partition, 0 to SubbandFilterPartitions - 1
+ */
+void subbandPreparePartition(filters_t *bank, const hrirBlend_t *blend, const size_t ear, const size_t partition)
+{
+	float32_t spectrum[SubbandSpectrumFloats];
+	memset(spectrum, 0, sizeof(spectrum));
+
+#ifdef UPOLS_STEREO_MATRIX
+	// Own path in the real part, the other input channel's in the imaginary part, as in upols.c
+	float32_t crossWeights[BlendDirections];
+	for (size_t j = 0; j < BlendDirections; j++)
+	{
+		crossWeights[j] = ear ? blend->weight[j] : -blend->rightWeight[j];
+	}
+
+	if (ear == RightFilter)
+	{
+		addLowRateTaps(spectrum, blend->rightIrIndex, blend->rightWeight, ear, partition, 0);
+		addLowRateTaps(spectrum, blend->irIndex, crossWeights, ear, partition, 1);
+	}
+	else
+	{
+		addLowRateTaps(spectrum, blend->irIndex, blend->weight, ear, partition, 0);
+		addLowRateTaps(spectrum, blend->rightIrIndex, crossWeights, ear, partition, 1);
+	}
+#else
+	addLowRateTaps(spectrum, blend->irIndex, blend->weight, ear, partition, 0);
+#endif
+
+	dspCfft(spectrum, SubbandFftLength, ForwardFFT);
+	memcpy(&bank->subband[ear][SubbandSpectrumFloats * partition], spectrum, sizeof(spectrum));
+}
+
+/**
+ * @brief Decimate a block of input and push its spectrum into the low-rate delay line
+ *
+ * @param subband Low-rate convolver
+ * @param leftAudioData Left channel, PartitionSize samples
+ * @param rightAudioData Right channel, PartitionSize samples
+ */
+void subbandAnalyze(subband_t *subband, const float32_t *leftAudioData, const float32_t *rightAudioData)
+{
+	const float32_t *coeffs = lowpass();
+	const float32_t *audio[2] = {leftAudioData, rightAudioData};
+	float32_t window[SubbandSpectrumFloats];
+
+	for (size_t channel = 0; channel < 2; channel++)
+	{
+		float32_t *history = subband->inputHistory[channel];
+		memcpy(&history[SubbandFirTaps - 1], audio[channel], sizeof(float32_t) * PartitionSize);
+
+		for (size_t m = 0; m < SubbandBlockSize; m++)
+		{
+			const float32_t *newest = &history[SubbandFirTaps - 1 + SubbandFactor * m];
+			float32_t sample = 0;
+			for (size_t k = 0; k < SubbandFirTaps; k++)
+			{
+				sample += coeffs[k] * *(newest - k);
+			}
+
+			// Previous low-rate block in the first half of the window, this one in the second
+			window[2 * m + channel] = subband->previousInput[2 * m + channel];
+			window[2 * (m + SubbandBlockSize) + channel] = sample;
+			subband->previousInput[2 * m + channel] = sample;
+		}
+
+		memmove(history, &history[PartitionSize], sizeof(float32_t) * (SubbandFirTaps - 1));
+	}
+
+	dspCfft(window, SubbandFftLength, ForwardFFT);
+	memcpy(&subband->delayLine[SubbandSpectrumFloats * subband->currentIndex], window, sizeof(window));
+	subband->currentIndex = (subband->currentIndex + 1) % SubbandSlots;
+}
+
+/**
+ * @brief Convolve the low-rate delay line with a bank's tail filters
+ *
+ * @param subband Low-rate convolver
+ * @param bank Filter bank to convolve with
+ * @param lookahead 0 for the block just analyzed, 1 for the block after it (hybrid mode)
+ * @param leftOutput Left ear, SubbandBlockSize low-rate samples
+ * @param rightOutput Right ear, SubbandBlockSize low-rate samples
+ */
+void subbandConvolve(const subband_t *subband, const filters_t *bank, const size_t lookahead, float32_t *leftOutput, float32_t *rightOutput)
+{
+	float32_t leftAccum[SubbandSpectrumFloats];
+	float32_t rightAccum[SubbandSpectrumFloats];
+	memset(leftAccum, 0, sizeof(leftAccum));
+	memset(rightAccum, 0, sizeof(rightAccum));
+
+	for (size_t i = 0; i < SubbandFilterPartitions; i++)
+	{
+		// Low-rate partition PartitionCount - 1 + i pairs with the block that many blocks before the output
+		const size_t age = PartitionCount - 1 + i - lookahead;
+		const size_t slot = (subband->currentIndex + 2 * SubbandSlots - 1 - age) % SubbandSlots;
+		cmacDualBins512(&subband->delayLine[SubbandSpectrumFloats * slot], &bank->subband[LeftFilter][SubbandSpectrumFloats * i],
+						&bank->subband[RightFilter][SubbandSpectrumFloats * i], leftAccum, rightAccum, SubbandFftLength);
+	}
+
+	dspCfft(leftAccum, SubbandFftLength, InverseFFT);
+	dspCfft(rightAccum, SubbandFftLength, InverseFFT);
+
+	for (size_t i = 0; i < SubbandBlockSize; i++)
+	{
+		// Time-aliased portion isn't copied
+		leftOutput[i] = leftAccum[2 * i];
+		rightOutput[i] = rightAccum[2 * i + 1];
+	}
+}
+
+/**
+ * @brief Linear crossfade of the low-rate output, in step with the full-rate crossfade
+ *
+ * @param output Output from the active filters, replaced with the mix
+ * @param incomingOutput Output from the incoming filters
+ * @param fadeBlock Crossfade block number
+ */
+void subbandCrossfade(float32_t *output, const float32_t *incomingOutput, const uint16_t fadeBlock)
+{
+	const float32_t step = 1.0f / (CrossfadeBlocks * SubbandBlockSize);
+	float32_t gain = step * (fadeBlock * SubbandBlockSize + 1);
+
+	for (size_t i = 0; i < SubbandBlockSize; i++)
+	{
+		output[i] += gain * (incomingOutput[i] - output[i]);
+		gain += step;
+	}
+}
+
+/**
+ * @brief Interpolate the low-rate output back to the full rate and add it to a block
+ *
+ * @param subband Low-rate convolver
+ * @param leftOutput Left ear, SubbandBlockSize low-rate samples
+ * @param rightOutput Right ear, SubbandBlockSize low-rate samples
+ * @param leftAudioData Left ear output to add to, PartitionSize samples
+ * @param rightAudioData Right ear output to add to, PartitionSize samples
+ */
+void subbandSynthesize(subband_t *subband, const float32_t *leftOutput, const float32_t *rightOutput, float32_t *leftAudioData,
+					   float32_t *rightAudioData)
+{
+	const float32_t *coeffs = lowpass();
+	const float32_t *output[2] = {leftOutput, rightOutput};
+	float32_t *audio[2] = {leftAudioData, rightAudioData};
+
+	for (size_t channel = 0; channel < 2; channel++)
+	{
+		float32_t *history = subband->outputHistory[channel];
+		memcpy(&history[SubbandHistory], output[channel], sizeof(float32_t) * SubbandBlockSize);
+
+		for (size_t i = 0; i < PartitionSize; i++)
+		{
+			// Only every SubbandFactor-th tap lands on a low-rate sample, the zeros in between are skipped
+			float32_t sample = 0;
+			for (size_t k = i % SubbandFactor; k < SubbandFirTaps; k += SubbandFactor)
+			{
+				sample += coeffs[k] * history[(SubbandFactor * SubbandHistory + i - k) / SubbandFactor];
+			}
+			audio[channel][i] += SubbandFactor * sample;
+		}
+
+		memmove(history, &history[SubbandBlockSize], sizeof(float32_t) * SubbandHistory);
+	}
+}
+#endif
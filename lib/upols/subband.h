@@ -0,0 +1,29 @@
+/**
+ * @file subband.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Multirate convolution of the low-frequency HRIR tail
+ * @version 0.1
+ * @date 2021-12-20
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ */
+
+#pragma once
+
+#include "upols.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+	void subbandReset(subband_t *subband);
+	void subbandPreparePartition(filters_t *bank, const hrirBlend_t *blend, const size_t ear, const size_t partition);
+	void subbandAnalyze(subband_t *subband, const float32_t *leftAudioData, const float32_t *rightAudioData);
+	void subbandConvolve(const subband_t *subband, const filters_t *bank, const size_t lookahead, float32_t *leftOutput, float32_t *rightOutput);
+	void subbandCrossfade(float32_t *output, const float32_t *incomingOutput, const uint16_t fadeBlock);
+	void subbandSynthesize(subband_t *subband, const float32_t *leftOutput, const float32_t *rightOutput, float32_t *leftAudioData,
+						   float32_t *rightAudioData);
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,142 @@
+/**
+ * @file txRing.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Handoff of blocks written in place into a two-half DMA transmit ring
+ * @version 0.1
+ * @date 2021-12-23
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ * @details
+ * The DMA loops over a ring of two halves and interrupts whenever it moves from one to the other.
+ * Instead of queueing blocks for the interrupt to copy into the half it just left, the producer
+ * writes its block straight into that half:
+ *
+ *   DMA interrupt: half it left -> TxHalfFree, half it entered -> TxHalfPlaying
+ *   txRingAcquire(): TxHalfFree -> TxHalfWriting, the producer fills the half in place
+ *   txRingPublish(): TxHalfWriting -> TxHalfFlushing, the producer writes the half back from its data cache
+ *   txRingCommit(): TxHalfFlushing -> TxHalfReady
+ *
+ * A half the DMA enters before the producer has claimed it is an underrun. One it enters while the
+ * producer is still filling or writing it back is late. Either way it's zeroed on the spot so the
+ * block from two periods ago isn't repeated, the DMA has only taken a frame or so of it by then.
+ * The producer finds out from the failed transition and has to drop the block without writing any
+ * more of it back, or it would land on top of the silence while the DMA is reading it. Nothing is
+ * written back before txRingPublish() succeeds for that reason. A producer with no free half counts
+ * an overrun and drops its block.
+ *
+ * The producer's transitions are compare-and-swaps and the interrupt swaps a half's state out
+ * whole, so the two can't both claim a half. The same holds when the interrupt is modelled by
+ * another thread on the host.
+ *
+ */
+
+#include "txRing.h"
+
+/**
+ * @brief Move a half from one state to another if nothing else moved it first
+ *
+ * @param state State of the half
+ * @param from Expected state
+ * @param to New state
+ * @return true if the half was in state from
+ */
+static inline bool claimHalf(volatile uint8_t *state, uint8_t from, const uint8_t to)
+{
+	return __atomic_compare_exchange_n(state, &from, to, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Start with the DMA in a silent first half and the second half free
+ *
+ * @param ring Transmit ring
+ * @param buffer TxRingHalves * TxRingHalfWords words, read by the DMA
+ */
+void txRingInit(txRing_t *ring, int32_t *buffer)
+{
+	memset(buffer, 0, sizeof(int32_t) * TxRingHalves * TxRingHalfWords);
+	ring->buffer = buffer;
+	ring->state[0] = TxHalfPlaying;
+	ring->state[1] = TxHalfFree;
+	ring->underruns = 0;
+	ring->lateHalves = 0;
+	ring->overruns = 0;
+}
+
+/**
+ * @brief Claim the free half for the next block
+ *
+ * @param ring Transmit ring
+ * @return TxRingHalfWords words to fill, or NULL when the DMA hasn't released a half since the last block
+ */
+int32_t *txRingAcquire(txRing_t *ring)
+{
+	for (size_t i = 0; i < TxRingHalves; i++)
+	{
+		if (claimHalf(&ring->state[i], TxHalfFree, TxHalfWriting))
+		{
+			return &ring->buffer[TxRingHalfWords * i];
+		}
+	}
+	__atomic_fetch_add(&ring->overruns, 1, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+/**
+ * @brief Index of a half from its first word
+ *
+ * @param ring Transmit ring
+ * @param half Half from txRingAcquire()
+ */
+static inline size_t halfIndex(const txRing_t *ring, const int32_t *half)
+{
+	return (size_t)(half - ring->buffer) / TxRingHalfWords;
+}
+
+/**
+ * @brief Claim a filled half for the DMA before writing it back from the data cache
+ *
+ * @param ring Transmit ring
+ * @param half Half from txRingAcquire()
+ * @return false if the DMA reached the half first and is sending silence, the block must be dropped without writing
+ * any of it back
+ */
+bool txRingPublish(txRing_t *ring, const int32_t *half)
+{
+	return claimHalf(&ring->state[halfIndex(ring, half)], TxHalfWriting, TxHalfFlushing);
+}
+
+/**
+ * @brief Hand a published half to the DMA once it has been written back
+ *
+ * @param ring Transmit ring
+ * @param half Half from txRingPublish()
+ * @return false if the DMA reached the half during the write-back and sent silence instead
+ */
+bool txRingCommit(txRing_t *ring, const int32_t *half)
+{
+	return claimHalf(&ring->state[halfIndex(ring, half)], TxHalfFlushing, TxHalfReady);
+}
+
+/**
+ * @brief DMA interrupt: the DMA has moved on to playingHalf and released the other one
+ *
+ * @param ring Transmit ring
+ * @param playingHalf Half the DMA is now reading
+ * @return true if playingHalf wasn't ready and was zeroed, so the caller can flush it from the data cache
+ */
+bool txRingDmaEvent(txRing_t *ring, const size_t playingHalf)
+{
+	const uint8_t previous = __atomic_exchange_n(&ring->state[playingHalf], TxHalfPlaying, __ATOMIC_ACQ_REL);
+	const bool silenced = (previous != TxHalfReady);
+
+	if (silenced)
+	{
+		// The producer's next transition fails, so nothing it still holds for this half gets written back
+		memset(&ring->buffer[TxRingHalfWords * playingHalf], 0, sizeof(int32_t) * TxRingHalfWords);
+		__atomic_fetch_add((previous == TxHalfFree) ? &ring->underruns : &ring->lateHalves, 1, __ATOMIC_RELAXED);
+	}
+
+	__atomic_store_n(&ring->state[!playingHalf], TxHalfFree, __ATOMIC_RELEASE);
+	return silenced;
+}
@@ -0,0 +1,56 @@
+/**
+ * @file txRing.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Handoff of blocks written in place into a two-half DMA transmit ring
+ * @version 0.1
+ * @date 2021-12-23
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+
+enum TxRingLengths
+{
+	TxRingHalves = 2,
+	TxRingFrames = 128,				   // Stereo frames per half, one audio block
+	TxRingHalfWords = 2 * TxRingFrames // Interleaved left and right words per half
+};
+
+// Owner of each half. Only the DMA side moves a half out of TxHalfPlaying, only the producer moves it out of TxHalfFree
+enum TxHalfStates
+{
+	TxHalfFree,		// Released by the DMA, waiting for the producer
+	TxHalfWriting,	// Being filled by the producer
+	TxHalfFlushing, // Filled, being written back from the producer's data cache
+	TxHalfReady,	// Filled, waiting for the DMA
+	TxHalfPlaying	// Being read by the DMA
+};
+
+typedef struct txRing_t
+{
+	int32_t *buffer;					  // TxRingHalves * TxRingHalfWords words, read by the DMA
+	volatile uint8_t state[TxRingHalves]; // TxHalfStates
+	volatile uint32_t underruns;		  // Halves the DMA reached before the producer claimed them, sent as silence
+	volatile uint32_t lateHalves;		  // Halves the DMA reached while the producer was still filling them, sent as silence and the block dropped
+	volatile uint32_t overruns;			  // Blocks the producer had no free half for
+} txRing_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+	void txRingInit(txRing_t *ring, int32_t *buffer);
+	int32_t *txRingAcquire(txRing_t *ring);
+	bool txRingPublish(txRing_t *ring, const int32_t *half);
+	bool txRingCommit(txRing_t *ring, const int32_t *half);
+	bool txRingDmaEvent(txRing_t *ring, size_t playingHalf);
+#ifdef __cplusplus
+}
+#endif
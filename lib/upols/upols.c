@@ -13,87 +13,1311 @@
  * The HRTF is the Discrete Fourier Transform of the HRIR
  * The filters_t struct holds two filters, one for each ear.
  *
+ * Hybrid mode (upolsProcessHead() followed by upolsProcessTail()) applies the first HybridHeadTaps of
+ * each HRIR with a direct-form FIR. The remaining partitions only depend on previous blocks, so
+ * their contribution to the next block is computed by upolsProcessTail() after the current block has
+ * already been sent on, and the FFT work never sits between input and output. Filter swaps crossfade
+ * here too: the incoming heads run on a copy of the FIR history and the tail is convolved with both banks.
+ *
+ * With UPOLS_SPECTRAL_BANK, partition spectra for every HRIR are generated at build time
+ * (tools/spectralBank.c) and read straight from flash, so selecting an HRIR is a pointer swap.
+ *
+ * upolsRequestBlend() interpolates between up to three HRIR pairs (see hrirLookup()). The mix is
+ * prepared into a RAM bank a few partitions per block, from the time-domain taps or from the
+ * flash spectra with UPOLS_SPECTRAL_BANK, then crossfaded in like any other swap.
+ *
+ * With UPOLS_COMPACT_STORAGE, filter and delay line spectra are kept as q15 mantissas with one
+ * power-of-two scale per partition. Each CMAC pass multiplies the mantissas as integers and applies
+ * the product of the two scales once per bin, so storage and memory traffic are halved.
+ *
+ * With UPOLS_BIN_MAJOR, filters and the delay line hold every partition of a bin side by side, and
+ * the filters are stored with their partitions reversed. The sum over partitions for a bin is then
+ * two contiguous dot products (split where the delay line ring wraps) whose sums stay in registers,
+ * instead of 64 passes that each stride 2 KB and read-modify-write the accumulator.
+ *
+ * With UPOLS_HALF_SPECTRUM, filters keep bins 0 to 128 only, since the taps are real and the upper bins are
+ * their mirrored conjugates. Each block's stereo FFT is split into the half spectra of the left and right
+ * channels, each ear is accumulated over 129 bins instead of 256, and the two half spectra are merged back
+ * into one complex spectrum so a single inverse FFT returns the left ear in the real part and the right in
+ * the imaginary part. Filter storage and the filter side of the CMAC traffic are roughly halved.
+ *
+ * With UPOLS_MINIMUM_PHASE, irTable holds minimum-phase HRIRs and irDelay the interaural time delay
+ * that tools/hrirc.cpp split off each ear. Minimum-phase taps carry their energy in the first few
+ * milliseconds, so the filters default to 8 partitions instead of 64. The delay is blended along with
+ * the spectra and applied to each ear's output by a cubic Lagrange fractional delay line, gliding
+ * across the block whenever it changes. Onsets of blended HRIRs line up, so interpolating between
+ * directions doesn't comb filter.
+ *
+ * With UPOLS_PARTITION_PRUNING, the energy of every partition is noted as it is prepared, and once a
+ * bank is complete pruneFilters() lists the partitions holding at least UPOLS_PRUNE_THRESHOLD_DB of
+ * each ear's energy. The CMAC loop only visits those, with a single-ear pass where only one ear
+ * needs the partition. Zero-padded or fast-decaying HRIRs skip most of their tail.
+ *
+ * UPOLS_BAND_PRUNING trims the bins instead: limitFilterBands() keeps the lowest bins of every
+ * partition that hold all but UPOLS_BAND_THRESHOLD_DB of the ear's energy, and the CMAC stops at
+ * that band and its mirror image. Tail partitions are mostly low-frequency, so their bands narrow.
+ *
+ * With UPOLS_SUBBAND, only the first PartitionCount partitions are convolved here. The rest of the
+ * HRIR is lowpassed, decimated and convolved at a fraction of the sample rate by subband.c, whose
+ * output is interpolated back and added to each block.
+ *
+ * With UPOLS_ROOM the HRIR is only the direct path, and room.c adds modelled early reflections and a
+ * late reverb to every block, after the interaural delay. previousAudio still holds the block's
+ * input at that point, which is what the room is driven from.
+ *
+ * With UPOLS_STEREO_MATRIX, each input channel is a virtual speaker with its own HRIR pair, so both
+ * ears hear both channels. The packed input spectrum already carries both channels, so the other
+ * channel's path rides in the imaginary part of each ear's filter: left ear filter = LL - j RL,
+ * right ear filter = RR + j LR. The real part of the left product and the imaginary part of the
+ * right product are then the sums of both paths, for the same two CMAC passes and inverse FFTs.
+ *
+ * With UPOLS_SILENCE_BYPASS, runs of silent input are counted. Once every partition still being
+ * multiplied has seen only silence and the last output rounded to zero, the history is cleared and
+ * blocks are passed through as silence with no FFT or CMAC work until the input comes back.
+ *
+ * All of the state lives in an upols_t, so any number of convolvers can run side by side.
+ * upolsCreate() allocates one with its filter banks on the heap; upolsInit() sets up one placed
+ * by the caller, which is how the Teensy keeps a bank in DTCM and the other in OCRAM.
+ *
+ * upolsProcessFloat() and upolsProcessHeadFloat() leave the output in float, so a sink wider than
+ * 16 bits quantises it once at its own resolution. upolsProcess() and upolsProcessHead() are the
+ * same with the q15 conversion on the end. upolsProcessInterleaved() writes interleaved 24-bit
+ * words, such as into a DMA transmit buffer, straight from the IFFT buffers whenever no crossfade
+ * or float stage (UPOLS_SUBBAND, UPOLS_MINIMUM_PHASE, UPOLS_ROOM) comes after the IFFT.
+ *
  */
 
 #include "upols.h"
+#include <math.h>
+#ifdef UPOLS_SUBBAND
+#include "subband.h"
+#endif
+
+// Partitions prepared per ear: the full-rate filter, followed by the low-rate tail with UPOLS_SUBBAND
+enum PreparedLengths
+{
+	PreparedPartitions = PartitionCount + (SubbandPartitions ? SubbandFilterPartitions : 0)
+};
+
+#ifdef UPOLS_EXTERNAL_IR_TABLE
+extern float32_t irTable[];	   // Supplied by the host build instead of the generated table
+extern const uint16_t irCount; // Number of HRIR pairs in irTable
+#ifdef UPOLS_MINIMUM_PHASE
+extern float32_t irDelay[][2]; // Interaural delay of each ear in samples
+#endif
+#else
 #include "./../../include/tablIR.h"
+static const uint16_t irCount = sizeof(irTable) / (2 * ImpulseSamples * sizeof(irTable[0]));
+#endif
+
+#ifdef UPOLS_SPECTRAL_BANK
+#include "./../../include/spectralBank.h"
+
+/**
+ * @brief Bank entry for an HRIR pair. The bank may hold every SpectralBankStride-th pair to fit in flash
+ *
+ */
+static inline uint16_t spectralBankIndex(const uint16_t irIndex)
+{
+	const uint16_t bankIndex = irIndex / SpectralBankStride;
+	return (bankIndex < SpectralBankCount) ? bankIndex : SpectralBankCount - 1;
+}
+#endif
+
+/**
+ * @brief Time-domain HRIR pair, left ear followed by right ear. Out of range indexes select the last pair
+ *
+ * @param irIndex Index of the HRIR pair
+ * @return Pointer to 2 * ImpulseSamples taps
+ */
+const float32_t *hrirPair(const uint16_t irIndex)
+{
+	return &irTable[2 * ImpulseSamples * ((irIndex < irCount) ? irIndex : irCount - 1)];
+}
+
+/**
+ * @brief Blend that selects a single HRIR pair, for both input channels with UPOLS_STEREO_MATRIX
+ *
+ * @param irIndex Index of the HRIR pair
+ * @return Blend with all of the weight on irIndex
+ */
+hrirBlend_t hrirBlendSingle(const uint16_t irIndex)
+{
+	hrirBlend_t blend;
+	for (size_t j = 0; j < BlendDirections; j++)
+	{
+		blend.irIndex[j] = irIndex;
+		blend.weight[j] = (j == 0) ? 1.0f : 0.0f;
+#ifdef UPOLS_STEREO_MATRIX
+		// Both speakers on the same direction
+		blend.rightIrIndex[j] = irIndex;
+		blend.rightWeight[j] = blend.weight[j];
+#endif
+	}
+	return blend;
+}
+
+/**
+ * @brief Number of HRIR pairs in irTable
+ *
+ */
+uint16_t hrirCount(void)
+{
+	return irCount;
+}
+
+#ifdef UPOLS_MINIMUM_PHASE
+/**
+ * @brief Delay that was split off one ear of a minimum-phase HRIR pair. Out of range indexes select the last pair
+ *
+ * @param irIndex Index of the HRIR pair
+ * @param ear LeftFilter or RightFilter
+ * @return Delay in samples, relative to the earlier ear
+ */
+float32_t hrirDelay(const uint16_t irIndex, const size_t ear)
+{
+	return irDelay[(irIndex < irCount) ? irIndex : irCount - 1][ear];
+}
+#endif
+
+#ifdef UPOLS_BIN_MAJOR
+/**
+ * @brief Scatter a 512 float spectrum into one slot of a bin-major array
+ *
+ * @param src Spectrum, 256 interleaved complex bins
+ * @param dest Bin-major array of PartitionCount slots
+ * @param slot Slot to write
+ */
+static void storeBinMajor(const float32_t *src, float32_t *dest, const size_t slot)
+{
+	dest += 2 * slot;
+	for (size_t bin = 0; bin < 256; bin++)
+	{
+		dest[0] = *src++;
+		dest[1] = *src++;
+		dest += 2 * PartitionCount;
+	}
+}
+#endif
+
+#ifdef UPOLS_PARTITION_PRUNING
+/**
+ * @brief Energy of a filter partition's taps from its spectrum (Parseval). Half spectra count the mirrored bins twice
+ *
+ * @param spectrum Partition spectrum, FilterSpectrumFloats floats
+ */
+static float32_t partitionEnergy(const float32_t *spectrum)
+{
+	float32_t energy = 0;
+	for (size_t k = 0; k < FilterSpectrumFloats; k++)
+	{
+#ifdef UPOLS_HALF_SPECTRUM
+		const float32_t weight = ((k < 2) || (k >= FilterSpectrumFloats - 2)) ? 1.0f : 2.0f;
+#else
+		const float32_t weight = 1.0f;
+#endif
+		energy += weight * spectrum[k] * spectrum[k];
+	}
+	return energy / 256;
+}
+
+/**
+ * @brief Build the active partition list of a complete filter bank. An ear skips every partition holding less than
+ * UPOLS_PRUNE_THRESHOLD_DB of its total energy
+ *
+ * @param bank Filter bank with every partition prepared
+ */
+void pruneFilters(filters_t *bank)
+{
+	partitionPruning_t *pruning = &bank->pruning;
+	const float32_t ratio = powf(10.0f, (float32_t)UPOLS_PRUNE_THRESHOLD_DB / 10.0f);
+	float32_t threshold[2] = {0, 0};
+
+	for (size_t ear = 0; ear < 2; ear++)
+	{
+		for (size_t i = 0; i < PartitionCount; i++)
+		{
+			threshold[ear] += pruning->energy[ear][i];
+		}
+		threshold[ear] *= ratio;
+	}
+
+	pruning->activeCount = 0;
+	for (size_t i = 0; i < PartitionCount; i++)
+	{
+		uint8_t ears = 0;
+		for (size_t ear = 0; ear < 2; ear++)
+		{
+			if (pruning->energy[ear][i] > threshold[ear])
+			{
+				ears |= (uint8_t)(1 << ear);
+			}
+		}
+
+		pruning->activeEars[i] = ears;
+		if (ears)
+		{
+			pruning->activeList[pruning->activeCount++] = (uint16_t)i;
+		}
+	}
+}
+
+#endif
+
+#ifdef UPOLS_BAND_PRUNING
+/**
+ * @brief Energy of bin k of a partition spectrum, together with its mirror image 256 - k
+ *
+ * @param spectrum Partition spectrum, FilterSpectrumFloats floats
+ * @param k Bin, 0 to 128
+ */
+static float32_t binEnergy(const float32_t *spectrum, const size_t k)
+{
+	const float32_t energy = spectrum[2 * k] * spectrum[2 * k] + spectrum[2 * k + 1] * spectrum[2 * k + 1];
+	if ((k == 0) || (k == HalfSpectrumBins - 1))
+	{
+		return energy;
+	}
+#ifdef UPOLS_HALF_SPECTRUM
+	return 2 * energy;
+#else
+	const size_t mirror = 256 - k;
+	return energy + spectrum[2 * mirror] * spectrum[2 * mirror] + spectrum[2 * mirror + 1] * spectrum[2 * mirror + 1];
+#endif
+}
+
+/**
+ * @brief Find the band of every partition worth multiplying. The upper bins of a partition are dropped while they hold less
+ * than UPOLS_BAND_THRESHOLD_DB of the ear's energy, so late partitions that only ring at low frequencies keep a narrow band
+ *
+ * @param bank Filter bank with every partition prepared
+ */
+void limitFilterBands(filters_t *bank)
+{
+	const float32_t ratio = powf(10.0f, (float32_t)UPOLS_BAND_THRESHOLD_DB / 10.0f);
+
+	for (size_t ear = 0; ear < 2; ear++)
+	{
+		const spectrum_t *filters = ear ? bank->right : bank->left;
+
+		float32_t threshold = 0;
+		for (size_t i = 0; i < PartitionCount; i++)
+		{
+			for (size_t k = 0; k < HalfSpectrumBins; k++)
+			{
+				threshold += binEnergy(&filters[FilterSpectrumFloats * i], k);
+			}
+		}
+		threshold *= ratio;
+
+		for (size_t i = 0; i < PartitionCount; i++)
+		{
+			const float32_t *spectrum = &filters[FilterSpectrumFloats * i];
+
+			// Drop bins from the top while the dropped energy stays under the threshold
+			size_t bins = HalfSpectrumBins;
+			float32_t dropped = 0;
+			while (bins && ((dropped + binEnergy(spectrum, bins - 1)) <= threshold))
+			{
+				dropped += binEnergy(spectrum, --bins);
+			}
+			bank->bandBins[ear][i] = (uint8_t)((bins < BandLimitBins) ? bins : BandLimitBins);
+		}
+	}
+}
+#endif
+
+/**
+ * @brief Work out which partitions and bins of a complete bank are worth multiplying
+ *
+ * @param bank Filter bank with every partition prepared
+ */
+static void analyzeFilters(filters_t *bank)
+{
+#ifdef UPOLS_PARTITION_PRUNING
+	pruneFilters(bank);
+#endif
+#ifdef UPOLS_BAND_PRUNING
+	limitFilterBands(bank);
+#endif
+	(void)bank;
+}
+
+/**
+ * @brief Number of partitions a filter bank multiplies for one ear, PartitionCount unless built with UPOLS_PARTITION_PRUNING
+ *
+ * @param bank Filter bank
+ * @param ear LeftFilter or RightFilter
+ */
+uint16_t activePartitions(const filters_t *bank, const size_t ear)
+{
+#ifdef UPOLS_PARTITION_PRUNING
+	uint16_t count = 0;
+	for (size_t i = 0; i < PartitionCount; i++)
+	{
+		count += (bank->pruning.activeEars[i] >> ear) & 1;
+	}
+	return count;
+#else
+	(void)bank;
+	(void)ear;
+	return PartitionCount;
+#endif
+}
+
+/**
+ * @brief Number of bins a filter bank multiplies for one ear per block, counting bins 0 to 128 of each active partition.
+ * PartitionCount * HalfSpectrumBins without UPOLS_PARTITION_PRUNING or UPOLS_BAND_PRUNING
+ *
+ * @param bank Filter bank
+ * @param ear LeftFilter or RightFilter
+ */
+uint32_t activeBins(const filters_t *bank, const size_t ear)
+{
+	uint32_t count = 0;
+	for (size_t i = 0; i < PartitionCount; i++)
+	{
+#ifdef UPOLS_PARTITION_PRUNING
+		if (!((bank->pruning.activeEars[i] >> ear) & 1))
+		{
+			continue;
+		}
+#endif
+#ifdef UPOLS_BAND_PRUNING
+		count += bank->bandBins[ear][i];
+#else
+		count += HalfSpectrumBins;
+#endif
+	}
+	(void)bank;
+	(void)ear;
+	return count;
+}
+
+#ifdef UPOLS_STEREO_MATRIX
+/**
+ * @brief Add the path from the other input channel to an ear, in the imaginary part of a partition. With the input packed as
+ * left + j right, the real part of its product with (own - j other) is the left ear's sum of both paths, and the imaginary
+ * part of its product with (own + j other) is the right ear's
+ *
+ * @param subfilterSpectra Partition being built, taps zero-padded on the left
+ * @param blend Speakers of both input channels
+ * @param ear LeftFilter or RightFilter
+ * @param partition Partition number
+ */
+static void addCrossPath(float32_t *subfilterSpectra, const hrirBlend_t *blend, const size_t ear, const size_t partition)
+{
+	const uint16_t *irIndex = ear ? blend->irIndex : blend->rightIrIndex;
+	const float32_t *weights = ear ? blend->weight : blend->rightWeight;
+	const float32_t sign = ear ? 1.0f : -1.0f;
+
+	for (size_t j = 0; j < BlendDirections; j++)
+	{
+		const float32_t weight = sign * weights[j];
+		if (weight == 0)
+		{
+			continue;
+		}
+
+		const float32_t *hrir = &hrirPair(irIndex[j])[ImpulseSamples * ear];
+		for (size_t k = 0; k < PartitionSize; k++)
+		{
+			subfilterSpectra[2 * k + 257] += weight * hrir[128 * partition + k];
+		}
+	}
+}
+#endif
+
+/**
+ * @brief Compute the spectrum of a single filter partition. The FFT is linear, so mixing the HRIR taps first interpolates the spectra
+ *
+ * @param bank Filter bank to write to
+ * @param blend HRIR pairs to mix
+ * @param ear LeftFilter or RightFilter
+ * @param partition Partition number
+ */
+static void processPartition(filters_t *bank, const hrirBlend_t *blend, const size_t ear, const size_t partition)
+{
+	float32_t subfilterSpectra[512]; // DFT spectra of an indiviual filter partition
+	spectrum_t *filter = ear ? bank->right : bank->left;
+
+	// Zero out impulsePartitionBuffer at the start of a new partition
+	clear512(subfilterSpectra);
+
+	if (partition == 0)
+	{
+		memset(bank->head[ear], 0, sizeof(bank->head[ear]));
+#ifdef UPOLS_MINIMUM_PHASE
+		bank->delay[ear] = 0;
+#endif
+	}
+
+	const uint16_t *irIndex = blend->irIndex;
+	const float32_t *weights = blend->weight;
+#ifdef UPOLS_STEREO_MATRIX
+	// The right ear's own path starts at the right input channel
+	if (ear == RightFilter)
+	{
+		irIndex = blend->rightIrIndex;
+		weights = blend->rightWeight;
+	}
+#endif
+
+	for (size_t j = 0; j < BlendDirections; j++)
+	{
+		const float32_t weight = weights[j];
+		if (weight == 0)
+		{
+			continue;
+		}
+
+		const float32_t *hrir = &hrirPair(irIndex[j])[ImpulseSamples * ear];
+		for (size_t k = 0; k < PartitionSize; k++)
+		{
+			// Zero-padded on the left side
+			subfilterSpectra[2 * k + 256] += weight * hrir[128 * partition + k];
+		}
+
+		if (partition == 0)
+		{
+			for (size_t k = 0; k < HybridHeadTaps; k++)
+			{
+				bank->head[ear][HybridHeadTaps - 1 - k] += weight * hrir[k];
+			}
+#ifdef UPOLS_MINIMUM_PHASE
+			bank->delay[ear] += weight * hrirDelay(irIndex[j], ear);
+#endif
+		}
+	}
+#ifdef UPOLS_STEREO_MATRIX
+	addCrossPath(subfilterSpectra, blend, ear, partition);
+#endif
+
+	// Compute the DFT of the partition and copy to hrtf
+	dspCfft(subfilterSpectra, 256, ForwardFFT);
+#ifdef UPOLS_PARTITION_PRUNING
+	bank->pruning.energy[ear][partition] = partitionEnergy(subfilterSpectra);
+#endif
+#if defined(UPOLS_COMPACT_STORAGE)
+	bank->scale[ear][partition] = packBfp512(subfilterSpectra, &filter[512 * partition]);
+#elif defined(UPOLS_BIN_MAJOR)
+	storeBinMajor(subfilterSpectra, filter, PartitionCount - 1 - partition);
+#elif defined(UPOLS_HALF_SPECTRUM)
+	memcpy(&filter[FilterSpectrumFloats * partition], subfilterSpectra, sizeof(float32_t) * FilterSpectrumFloats);
+#else
+	cp512(subfilterSpectra, &filter[512 * partition]);
+#endif
+}
+
+#ifdef UPOLS_SPECTRAL_BANK
+/**
+ * @brief Interpolate a single filter partition from the precomputed spectra in flash
+ *
+ * @param bank Filter bank to write to
+ * @param blend HRIR pairs to mix
+ * @param ear LeftFilter or RightFilter
+ * @param partition Partition number
+ */
+static void blendPartition(filters_t *bank, const hrirBlend_t *blend, const size_t ear, const size_t partition)
+{
+	float32_t *filter = &(ear ? bank->right : bank->left)[FilterSpectrumFloats * partition];
+	memset(filter, 0, sizeof(float32_t) * FilterSpectrumFloats);
+
+	if (partition == 0)
+	{
+		memset(bank->head[ear], 0, sizeof(bank->head[ear]));
+#ifdef UPOLS_MINIMUM_PHASE
+		bank->delay[ear] = 0;
+#endif
+	}
+
+	for (size_t j = 0; j < BlendDirections; j++)
+	{
+		const float32_t weight = blend->weight[j];
+		if (weight == 0)
+		{
+			continue;
+		}
+
+		const filters_t *source = &spectralBank[spectralBankIndex(blend->irIndex[j])];
+		const float32_t *spectra = &(ear ? source->right : source->left)[FilterSpectrumFloats * partition];
+#ifdef UPOLS_HALF_SPECTRUM
+		for (size_t k = 0; k < FilterSpectrumFloats; k++)
+		{
+			filter[k] += weight * spectra[k];
+		}
+#else
+		smac512(spectra, weight, filter);
+#endif
+
+		if (partition == 0)
+		{
+			for (size_t k = 0; k < HybridHeadTaps; k++)
+			{
+				bank->head[ear][k] += weight * source->head[ear][k];
+			}
+#ifdef UPOLS_MINIMUM_PHASE
+			bank->delay[ear] += weight * source->delay[ear];
+#endif
+		}
+	}
+
+#ifdef UPOLS_PARTITION_PRUNING
+	bank->pruning.energy[ear][partition] = partitionEnergy(filter);
+#endif
+}
+
+#ifdef UPOLS_SUBBAND
+/**
+ * @brief Interpolate a single low-rate tail partition from the precomputed spectra in flash
+ *
+ * @param bank Filter bank to write to
+ * @param blend HRIR pairs to mix
+ * @param ear LeftFilter or RightFilter
+ * @param partition Low-rate partition
+ */
+static void blendSubbandPartition(filters_t *bank, const hrirBlend_t *blend, const size_t ear, const size_t partition)
+{
+	float32_t *filter = &bank->subband[ear][SubbandSpectrumFloats * partition];
+	memset(filter, 0, sizeof(float32_t) * SubbandSpectrumFloats);
+
+	for (size_t j = 0; j < BlendDirections; j++)
+	{
+		const float32_t weight = blend->weight[j];
+		if (weight != 0)
+		{
+			const float32_t *spectra = &spectralBank[spectralBankIndex(blend->irIndex[j])].subband[ear][SubbandSpectrumFloats * partition];
+			for (size_t k = 0; k < SubbandSpectrumFloats; k++)
+			{
+				filter[k] += weight * spectra[k];
+			}
+		}
+	}
+}
+#endif
+
+/**
+ * @brief Corner carrying all of the weight, if the blend reduces to a single HRIR pair
+ *
+ * @return Index into blend->irIndex, or -1 when more than one pair contributes
+ */
+static int8_t soleDirection(const hrirBlend_t *blend)
+{
+	int8_t sole = -1;
+	for (size_t j = 0; j < BlendDirections; j++)
+	{
+		if (blend->weight[j] != 0)
+		{
+			if (sole >= 0)
+			{
+				return -1;
+			}
+			sole = (int8_t)j;
+		}
+	}
+	return sole;
+}
+#endif
+
+/**
+ * @brief Point the hybrid head FIRs at a filter bank, clearing their history on first use
+ *
+ * @param headFilters Hybrid head state of an upols_t
+ * @param bank Filter bank holding the new HRIR heads
+ */
+static void attachHeadFilters(headFilters_t *headFilters, const filters_t *bank)
+{
+	for (size_t i = 0; i < 2; i++)
+	{
+		if (headFilters->initialized)
+		{
+			headFilters->fir[i].pCoeffs = (float32_t *)bank->head[i];
+		}
+		else
+		{
+			dspFirInit(&headFilters->fir[i], HybridHeadTaps, (float32_t *)bank->head[i], headFilters->state[i], PartitionSize);
+		}
+	}
+	headFilters->initialized = true;
+}
+
+/**
+ * @brief Start the incoming bank's head FIRs from a copy of the active ones' history, so both can run through a crossfade
+ *
+ * @param headFilters Hybrid head state of an upols_t
+ * @param incoming Filter bank being faded in
+ */
+static void forkHeadFilters(headFilters_t *headFilters, const filters_t *incoming)
+{
+	for (size_t i = 0; i < 2; i++)
+	{
+		// Initializing clears the state, so the history is copied in afterwards
+		dspFirInit(&headFilters->incomingFir[i], HybridHeadTaps, (float32_t *)incoming->head[i], headFilters->incomingState[i], PartitionSize);
+		memcpy(headFilters->incomingState[i], headFilters->state[i], sizeof(headFilters->state[i]));
+	}
+}
+
+#ifdef UPOLS_MINIMUM_PHASE
+/**
+ * @brief Limit a filter bank's delay to what the delay line holds. Uninitialized banks read as no delay
+ *
+ */
+static float32_t clampDelay(const float32_t delay)
+{
+	return (delay > 0) ? ((delay < ItdMaxSamples) ? delay : ItdMaxSamples) : 0;
+}
+
+/**
+ * @brief Delay one ear by a fractional number of samples with a cubic Lagrange interpolator, gliding linearly from one delay to the next
+ *
+ * @param ring Delay line of the ear
+ * @param writeIndex Ring position of the first sample of this block
+ * @param audio Ear output, delayed in place
+ * @param from Delay at the end of the previous block
+ * @param to Delay at the end of this block
+ */
+static void delayEar(float32_t *ring, const uint16_t writeIndex, float32_t *audio, const float32_t from, const float32_t to)
+{
+	const float32_t step = (to - from) / PartitionSize;
+	float32_t delay = from + ItdLatency;
+
+	for (size_t i = 0; i < PartitionSize; i++)
+	{
+		const size_t now = writeIndex + i;
+		ring[now & (ItdRingSamples - 1)] = audio[i];
+		delay += step;
+
+		// Interpolate between the samples at whole + 1 and whole taps back, so the newest tap read is now - whole + 1 <= now
+		const size_t whole = (size_t)delay;
+		const float32_t f = 1.0f - (delay - (float32_t)whole);
+		const size_t first = now + ItdRingSamples - whole - 2;
+		const float32_t x0 = ring[first & (ItdRingSamples - 1)];
+		const float32_t x1 = ring[(first + 1) & (ItdRingSamples - 1)];
+		const float32_t x2 = ring[(first + 2) & (ItdRingSamples - 1)];
+		const float32_t x3 = ring[(first + 3) & (ItdRingSamples - 1)];
+
+		// Lagrange basis on nodes -1, 0, 1, 2 evaluated at f
+		const float32_t fPlus = f + 1.0f;
+		const float32_t fMinus = f - 1.0f;
+		const float32_t fMinus2 = f - 2.0f;
+		audio[i] = (-f * fMinus * fMinus2 / 6.0f) * x0 + (fPlus * fMinus * fMinus2 / 2.0f) * x1 + (-fPlus * f * fMinus2 / 2.0f) * x2 +
+				   (fPlus * f * fMinus / 6.0f) * x3;
+	}
+}
+
+/**
+ * @brief Put the interaural delay back on both ears of a block
+ *
+ * @param upols Convolver
+ * @param leftAudioData Left ear output, delayed in place
+ * @param rightAudioData Right ear output, delayed in place
+ * @param target Delay of each ear to reach by the end of the block
+ */
+static void applyItd(upols_t *upols, float32_t *leftAudioData, float32_t *rightAudioData, const float32_t *target)
+{
+	itdDelay_t *itd = &upols->itd;
+	float32_t *ears[2] = {leftAudioData, rightAudioData};
+
+	for (size_t ear = 0; ear < 2; ear++)
+	{
+		const float32_t delay = clampDelay(target[ear]);
+		delayEar(itd->ring[ear], itd->writeIndex, ears[ear], itd->current[ear], delay);
+		itd->current[ear] = delay;
+	}
+	itd->writeIndex = (itd->writeIndex + PartitionSize) & (ItdRingSamples - 1);
+}
+
+/**
+ * @brief Jump straight to a filter bank's delay, without gliding
+ *
+ */
+static void snapItd(upols_t *upols, const filters_t *bank)
+{
+	upols->itd.current[LeftFilter] = clampDelay(bank->delay[LeftFilter]);
+	upols->itd.current[RightFilter] = clampDelay(bank->delay[RightFilter]);
+}
+#endif
 
-// Filter impulse responses
-typedef struct filters_t
+/**
+ * @brief Compute one partition of a filter bank from irTable, full-rate or low-rate
+ *
+ * @param bank Filter bank to write to
+ * @param blend HRIR pairs to mix
+ * @param ear LeftFilter or RightFilter
+ * @param partition Partition number, the low-rate tail follows the PartitionCount full-rate partitions
+ */
+static void computePartition(filters_t *bank, const hrirBlend_t *blend, const size_t ear, const size_t partition)
+{
+#ifdef UPOLS_SUBBAND
+	if (partition >= PartitionCount)
+	{
+		subbandPreparePartition(bank, blend, ear, partition - PartitionCount);
+		return;
+	}
+#endif
+	processPartition(bank, blend, ear, partition);
+}
+
+/**
+ * @brief Prepare one partition of the bank being swapped in, from flash spectra when there are any
+ *
+ * @param bank Filter bank to write to
+ * @param blend HRIR pairs to mix
+ * @param ear LeftFilter or RightFilter
+ * @param partition Partition number, as for computePartition()
+ */
+static void preparePartition(filters_t *bank, const hrirBlend_t *blend, const size_t ear, const size_t partition)
 {
-	float32_t left[512 * PartitionCount];
-	float32_t right[512 * PartitionCount];
-} filters_t;
+#if defined(UPOLS_SPECTRAL_BANK) && defined(UPOLS_SUBBAND)
+	if (partition >= PartitionCount)
+	{
+		blendSubbandPartition(bank, blend, ear, partition - PartitionCount);
+		return;
+	}
+#endif
+#ifdef UPOLS_SPECTRAL_BANK
+	blendPartition(bank, blend, ear, partition);
+#else
+	computePartition(bank, blend, ear, partition);
+#endif
+}
+
+/**
+ * @brief Compute every partition of an HRIR pair into a filter bank
+ *
+ * @param bank Filter bank to write to
+ * @param irIndex Index of the HRIR pair
+ */
+void computeFilters(filters_t *bank, const uint16_t irIndex)
+{
+	const hrirBlend_t blend = hrirBlendSingle(irIndex);
+
+	// Loop twice, left channel when i == 0, right channel when i == 1
+	for (size_t i = 0; i < 2; i++)
+	{
+		for (size_t j = 0; j < PreparedPartitions; j++)
+		{
+			computePartition(bank, &blend, i, j);
+		}
+	}
+
+	analyzeFilters(bank);
+}
+
+/**
+ * @brief Forget every past input sample: the delay line, the hybrid FIR history, the low-rate tail, the room and the interaural
+ * delay line. Filters and swaps are left alone
+ *
+ * @param upols Convolver
+ */
+static void clearHistory(upols_t *upols)
+{
+	upols->currentIndex = 0;
+	memset(upols->previousAudio, 0, sizeof(upols->previousAudio));
+	memset(upols->delayLine, 0, sizeof(upols->delayLine));
+#ifdef UPOLS_COMPACT_STORAGE
+	memset(upols->delayScale, 0, sizeof(upols->delayScale));
+#endif
+
+	// upolsProcessHead() attaches the active bank again
+	memset(&upols->headFilters, 0, sizeof(upols->headFilters));
+
+#ifdef UPOLS_SUBBAND
+	subbandReset(&upols->subband);
+#endif
+#ifdef UPOLS_ROOM
+	roomReset(&upols->room);
+#endif
+
+#ifdef UPOLS_MINIMUM_PHASE
+	memset(&upols->itd, 0, sizeof(upols->itd));
+	snapItd(upols, upols->filterSwap.bank[upols->filterSwap.active]);
+#endif
+}
+
+/**
+ * @brief Set up a convolver in storage provided by the caller. Nothing needs to be zeroed beforehand
+ *
+ * @param upols Convolver to initialize
+ * @param primaryBank Filter bank used until the first swap
+ * @param secondaryBank Filter bank that swaps are prepared into
+ */
+void upolsInit(upols_t *upols, filters_t *primaryBank, filters_t *secondaryBank)
+{
+	memset(upols, 0, sizeof(*upols));
+	upols->ramBank[0] = primaryBank;
+	upols->ramBank[1] = secondaryBank;
+#ifdef UPOLS_ROOM
+	roomInit(&upols->room);
+#endif
+	upolsReset(upols);
+}
+
+/**
+ * @brief Allocate a convolver and both of its filter banks
+ *
+ * @return New convolver, or NULL if there isn't enough memory
+ */
+upols_t *upolsCreate(void)
+{
+	upols_t *upols = malloc(sizeof(upols_t));
+	filters_t *primaryBank = calloc(1, sizeof(filters_t));
+	filters_t *secondaryBank = calloc(1, sizeof(filters_t));
+
+	if (!upols || !primaryBank || !secondaryBank)
+	{
+		free(upols);
+		free(primaryBank);
+		free(secondaryBank);
+		return NULL;
+	}
+
+	upolsInit(upols, primaryBank, secondaryBank);
+	upols->ownsBanks = true;
+	return upols;
+}
 
-typedef struct upols_t
+/**
+ * @brief Return a convolver to silence: clears the input history, the delay line, any swap in progress and the hybrid FIR state. Filters are kept
+ *
+ * @param upols Convolver to reset
+ */
+void upolsReset(upols_t *upols)
+{
+	filterSwap_t *filterSwap = &upols->filterSwap;
+	if (!filterSwap->bank[filterSwap->active])
+	{
+#ifdef UPOLS_SPECTRAL_BANK
+		filterSwap->bank[0] = filterSwap->bank[1] = &spectralBank[0];
+#else
+		filterSwap->bank[0] = upols->ramBank[0];
+		filterSwap->bank[1] = upols->ramBank[1];
+#endif
+	}
+	filterSwap->state = SwapIdle;
+	filterSwap->requestPending = false;
+
+	clearHistory(upols);
+#ifdef UPOLS_SILENCE_BYPASS
+	memset(&upols->silence, 0, sizeof(upols->silence));
+#endif
+}
+
+/**
+ * @brief Free a convolver from upolsCreate(). Convolvers set up with upolsInit() belong to the caller
+ *
+ * @param upols Convolver to free, may be NULL
+ */
+void upolsDestroy(upols_t *upols)
+{
+	if (upols && upols->ownsBanks)
+	{
+		free(upols->ramBank[0]);
+		free(upols->ramBank[1]);
+		free(upols);
+	}
+}
+
+/**
+ * @brief Select an HRIR pair immediately. Without UPOLS_SPECTRAL_BANK this blocks for 128 FFTs, only use while the audio path is idle
+ *
+ * @param upols Convolver to update
+ * @param irIndex Index of the HRIR pair
+ */
+void upolsSetFilters(upols_t *upols, const uint16_t irIndex)
+{
+	filterSwap_t *filterSwap = &upols->filterSwap;
+#ifdef UPOLS_SPECTRAL_BANK
+	filterSwap->bank[filterSwap->active] = &spectralBank[spectralBankIndex(irIndex)];
+#else
+	filterSwap->bank[filterSwap->active] = upols->ramBank[0];
+	filterSwap->bank[!filterSwap->active] = upols->ramBank[1];
+	computeFilters(upols->ramBank[0], irIndex);
+#endif
+
+	upols->headFilters.initialized = false;
+	attachHeadFilters(&upols->headFilters, filterSwap->bank[filterSwap->active]);
+#ifdef UPOLS_MINIMUM_PHASE
+	snapItd(upols, filterSwap->bank[filterSwap->active]);
+#endif
+}
+
+/**
+ * @brief Queue a new HRIR pair. It is prepared in the background by the audio path and crossfaded in once complete
+ *
+ * @param upols Convolver to update
+ * @param irIndex Index of the HRIR pair
+ */
+void upolsRequestFilters(upols_t *upols, const uint16_t irIndex)
+{
+	const hrirBlend_t blend = hrirBlendSingle(irIndex);
+	upolsRequestBlend(upols, &blend);
+}
+
+/**
+ * @brief Queue a weighted mix of HRIR pairs, such as the result of hrirLookup(). Replaces any request that hasn't been picked up yet
+ *
+ * @param upols Convolver to update
+ * @param blend HRIR pairs and weights
+ */
+void upolsRequestBlend(upols_t *upols, const hrirBlend_t *blend)
+{
+	filterSwap_t *filterSwap = &upols->filterSwap;
+
+	// The audio path skips the request while it's being rewritten, it can't interrupt the copy halfway through otherwise
+	filterSwap->requestPending = false;
+	for (size_t j = 0; j < BlendDirections; j++)
+	{
+		filterSwap->requestedBlend.irIndex[j] = blend->irIndex[j];
+		filterSwap->requestedBlend.weight[j] = blend->weight[j];
+#ifdef UPOLS_STEREO_MATRIX
+		filterSwap->requestedBlend.rightIrIndex[j] = blend->rightIrIndex[j];
+		filterSwap->requestedBlend.rightWeight[j] = blend->rightWeight[j];
+#endif
+	}
+	filterSwap->requestPending = true;
+}
+
+/**
+ * @brief Check whether a requested HRIR pair has yet to take over
+ *
+ * @param upols Convolver to check
+ * @return true while a swap is queued, being prepared or crossfading
+ */
+bool upolsFiltersPending(const upols_t *upols)
+{
+	return upols->filterSwap.requestPending || (upols->filterSwap.state != SwapIdle);
+}
+
+/**
+ * @brief Number of partitions the active filters multiply for one ear, PartitionCount unless built with UPOLS_PARTITION_PRUNING
+ *
+ * @param upols Convolver to check
+ * @param ear LeftFilter or RightFilter
+ */
+uint16_t upolsActivePartitions(const upols_t *upols, const size_t ear)
+{
+	return activePartitions(upols->filterSwap.bank[upols->filterSwap.active], ear);
+}
+
+/**
+ * @brief Number of bins the active filters multiply for one ear per block, see activeBins()
+ *
+ * @param upols Convolver to check
+ * @param ear LeftFilter or RightFilter
+ */
+uint32_t upolsActiveBins(const upols_t *upols, const size_t ear)
+{
+	return activeBins(upols->filterSwap.bank[upols->filterSwap.active], ear);
+}
+
+/**
+ * @brief Check whether the convolver is skipping silent blocks, always false without UPOLS_SILENCE_BYPASS
+ *
+ * @param upols Convolver to check
+ */
+bool upolsBypassing(const upols_t *upols)
+{
+#ifdef UPOLS_SILENCE_BYPASS
+	return upols->silence.bypassing;
+#else
+	(void)upols;
+	return false;
+#endif
+}
+
+/**
+ * @brief RAM bank that isn't being convolved with
+ *
+ */
+static filters_t *inactiveRamBank(upols_t *upols)
+{
+	return upols->ramBank[upols->filterSwap.bank[upols->filterSwap.active] == upols->ramBank[0]];
+}
+
+/**
+ * @brief Pick up new requests and prepare the next FilterPrepPartitions partitions of the inactive bank. Called once per block
+ *
+ * @param upols Convolver to update
+ */
+static void stepFilterSwap(upols_t *upols)
+{
+	filterSwap_t *filterSwap = &upols->filterSwap;
+
+	// Requests are picked up between swaps, so a source that moves every block still lands on its latest direction
+	if (filterSwap->requestPending && (filterSwap->state == SwapIdle))
+	{
+		filterSwap->requestPending = false; // Cleared before reading so a request racing with this one isn't lost
+		for (size_t j = 0; j < BlendDirections; j++)
+		{
+			filterSwap->blend.irIndex[j] = filterSwap->requestedBlend.irIndex[j];
+			filterSwap->blend.weight[j] = filterSwap->requestedBlend.weight[j];
+#ifdef UPOLS_STEREO_MATRIX
+			filterSwap->blend.rightIrIndex[j] = filterSwap->requestedBlend.rightIrIndex[j];
+			filterSwap->blend.rightWeight[j] = filterSwap->requestedBlend.rightWeight[j];
+#endif
+		}
+		filterSwap->cursor = 0;
+		filterSwap->state = SwapPreparing;
+		filterSwap->bank[!filterSwap->active] = inactiveRamBank(upols);
+	}
+
+	if (filterSwap->state == SwapPreparing)
+	{
+#ifdef UPOLS_SPECTRAL_BANK
+		const int8_t sole = soleDirection(&filterSwap->blend);
+		if (sole >= 0)
+		{
+			// Spectra are already in flash, nothing to prepare
+			filterSwap->bank[!filterSwap->active] = &spectralBank[spectralBankIndex(filterSwap->blend.irIndex[sole])];
+			filterSwap->cursor = 2 * PreparedPartitions;
+		}
+#endif
+		filters_t *bank = inactiveRamBank(upols);
+		for (size_t i = 0; (i < FilterPrepPartitions) && (filterSwap->cursor < 2 * PreparedPartitions); i++)
+		{
+			preparePartition(bank, &filterSwap->blend, filterSwap->cursor / PreparedPartitions, filterSwap->cursor % PreparedPartitions);
+			filterSwap->cursor++;
+		}
+
+		if (filterSwap->cursor == 2 * PreparedPartitions)
+		{
+			// Flash banks were analyzed when they were generated
+			if (filterSwap->bank[!filterSwap->active] == bank)
+			{
+				analyzeFilters(bank);
+			}
+			filterSwap->fadeBlock = 0;
+			filterSwap->state = SwapCrossfading;
+		}
+	}
+}
+
+/**
+ * @brief Linear crossfade from the old filter output to the new one
+ *
+ * @param channelOutput Output from the active filters, replaced with the mix
+ * @param incomingOutput Output from the incoming filters
+ * @param fadeBlock Crossfade block number
+ */
+static void crossfade(float32_t *channelOutput, const float32_t *incomingOutput, const uint16_t fadeBlock)
+{
+	const float32_t step = 1.0f / (CrossfadeBlocks * PartitionSize);
+	float32_t gain = step * (fadeBlock * PartitionSize + 1);
+
+	for (size_t i = 0; i < PartitionSize; i++)
+	{
+		channelOutput[i] += gain * (incomingOutput[i] - channelOutput[i]);
+		gain += step;
+	}
+}
+
+#ifdef UPOLS_BAND_PRUNING
+/**
+ * @brief Multiply-accumulate the bands of both ears' filters for one partition. Bins both ears need share a pass
+ *
+ * @param input Delay line partition
+ * @param left Left ear filter partition
+ * @param right Right ear filter partition
+ * @param leftBins Band of the left ear, 0 to skip it
+ * @param rightBins Band of the right ear, 0 to skip it
+ * @param leftAccum Left ear accumulator
+ * @param rightAccum Right ear accumulator
+ */
+static inline void accumulateBands(const float32_t *input, const float32_t *left, const float32_t *right, const size_t leftBins,
+								   const size_t rightBins, float32_t *leftAccum, float32_t *rightAccum)
+{
+#ifdef UPOLS_HALF_SPECTRUM
+	// Left channel half spectrum, followed by the right
+	cmacBins512(input, left, leftAccum, leftBins);
+	cmacBins512(&input[FilterSpectrumFloats], right, rightAccum, rightBins);
+#else
+	const bool leftWider = leftBins > rightBins;
+	const size_t shared = leftWider ? rightBins : leftBins;
+	const size_t wider = leftWider ? leftBins : rightBins;
+	const float32_t *widerFilter = leftWider ? left : right;
+	float32_t *widerAccum = leftWider ? leftAccum : rightAccum;
+
+	// Bins 0 to n - 1
+	cmacDualBins512(input, left, right, leftAccum, rightAccum, shared);
+	cmacBins512(&input[2 * shared], &widerFilter[2 * shared], &widerAccum[2 * shared], wider - shared);
+
+	// Mirror images of bins 1 to n - 1, bin 128 is its own
+	const size_t sharedMirror = shared ? ((shared < HalfSpectrumBins) ? shared - 1 : shared - 2) : 0;
+	const size_t widerMirror = wider ? ((wider < HalfSpectrumBins) ? wider - 1 : wider - 2) : 0;
+	const size_t sharedStart = 2 * (256 - sharedMirror);
+	const size_t widerStart = 2 * (256 - widerMirror);
+	cmacDualBins512(&input[sharedStart], &left[sharedStart], &right[sharedStart], &leftAccum[sharedStart], &rightAccum[sharedStart], sharedMirror);
+	cmacBins512(&input[widerStart], &widerFilter[widerStart], &widerAccum[widerStart], widerMirror - sharedMirror);
+#endif
+}
+#endif
+
+/**
+ * @brief Multiply-accumulate one filter partition against the delay line spectrum it pairs with
+ *
+ * @param upols upols_t instance
+ * @param bank Filter bank to convolve with
+ * @param partition Filter partition
+ * @param ears LeftEar, RightEar or BothEars. Both ears share one pass so the delay line partition is only read once
+ * @param leftAccum Left ear accumulator
+ * @param rightAccum Right ear accumulator
+ */
+static inline void accumulatePartition(const upols_t *upols, const filters_t *bank, const size_t partition, const uint8_t ears,
+									   float32_t *leftAccum, float32_t *rightAccum)
 {
-	int16_t currentIndex;					   // Current partition index
-	float32_t slidingWindow[512];			   // Time-domain sliding window
-	float32_t delayLine[512 * PartitionCount]; // Frequency-domain delay line
-} upols_t;
+	// Partition 0 lines up with currentIndex
+	const size_t slot = (upols->currentIndex + PartitionCount - partition) % PartitionCount;
+	const spectrum_t *input = &upols->delayLine[DelaySpectrumFloats * slot];
+	const spectrum_t *left = &bank->left[FilterSpectrumFloats * partition];
+	const spectrum_t *right = &bank->right[FilterSpectrumFloats * partition];
 
-filters_t filters;
+#if defined(UPOLS_COMPACT_STORAGE)
+	const float32_t leftScale = upols->delayScale[slot] * bank->scale[LeftFilter][partition];
+	const float32_t rightScale = upols->delayScale[slot] * bank->scale[RightFilter][partition];
+	switch (ears)
+	{
+	case BothEars:
+		cmacBfpDual512(input, left, right, leftScale, rightScale, leftAccum, rightAccum);
+		break;
+	case LeftEar:
+		cmacBfp512(input, left, leftScale, leftAccum);
+		break;
+	case RightEar:
+		cmacBfp512(input, right, rightScale, rightAccum);
+		break;
+	}
+#elif defined(UPOLS_BAND_PRUNING)
+	const size_t leftBins = (ears & LeftEar) ? bank->bandBins[LeftFilter][partition] : 0;
+	const size_t rightBins = (ears & RightEar) ? bank->bandBins[RightFilter][partition] : 0;
+	accumulateBands(input, left, right, leftBins, rightBins, leftAccum, rightAccum);
+#elif defined(UPOLS_HALF_SPECTRUM)
+	// Left channel half spectrum, followed by the right
+	switch (ears)
+	{
+	case BothEars:
+		cmacHalfDual512(input, &input[FilterSpectrumFloats], left, right, leftAccum, rightAccum);
+		break;
+	case LeftEar:
+		cmacHalf512(input, left, leftAccum);
+		break;
+	case RightEar:
+		cmacHalf512(&input[FilterSpectrumFloats], right, rightAccum);
+		break;
+	}
+#else
+	switch (ears)
+	{
+	case BothEars:
+		cmacDual512(input, left, right, leftAccum, rightAccum);
+		break;
+	case LeftEar:
+		cmac512(input, left, leftAccum);
+		break;
+	case RightEar:
+		cmac512(input, right, rightAccum);
+		break;
+	}
+#endif
+}
 
-void processFilters(const uint16_t irIndex)
+/**
+ * @brief Quantise a sample to 24 bits, saturating and truncating like dspFloatToQ15()
+ *
+ * @param sample Sample in [-1, 1)
+ * @return 24-bit sample, sign-extended
+ */
+static inline int32_t floatToWord(const float32_t sample)
 {
-	// Start by clearing any contents that may be in memory
-	memset(&filters, 0, sizeof(filters));
+	const float32_t scaled = sample * 8388608.0f;
+	return (int32_t)((scaled > 8388607.0f) ? 8388607.0f : ((scaled < -8388608.0f) ? -8388608.0f : scaled));
+}
 
-	// Loop twice, left channel when i == 0, right channel when i == 1
-	for (size_t i = 0; i < 2; i++)
+/**
+ * @brief Quantise both ears to 24 bits and interleave them left first, the way S/PDIF and I2S transmitters take them
+ *
+ * @param leftAudioData Left ear
+ * @param rightAudioData Right ear
+ * @param stride Distance between samples of one ear, 2 to read straight out of an IFFT buffer
+ * @param interleaved 2 * PartitionSize words
+ */
+static void interleaveWords(const float32_t *leftAudioData, const float32_t *rightAudioData, const size_t stride, int32_t *interleaved)
+{
+#pragma GCC unroll 8
+	for (size_t i = 0; i < PartitionSize; i++)
 	{
-		float32_t subfilterSpectra[512]; // DFT spectra of an indiviual filter partition
-		float32_t *filter = i ? filters.right : filters.left;
-
-		for (size_t j = 0; j < PartitionCount; j++)
-		{
-			// Zero out impulsePartitionBuffer at the start of a new partition
-			clear512(subfilterSpectra);
-
-			for (size_t k = 0; k < PartitionSize; k++)
-			{
-				// impulsePartitionBuffer[2 * k + 256] = irTable[2 * ImpulseSamples * irIndex + ImpulseSamples * i + 128 * j + k];
-
-				// Zero-padded on the left side
-				subfilterSpectra[2 * k + 256] = irTable[ImpulseSamples * i + 128 * j + k];
-			}
-
-			// Compute the DFT of the partition and copy to hrtf
-			arm_cfft_f32(&arm_cfft_sR_f32_len256, subfilterSpectra, ForwardFFT, 1);
-			cp512(subfilterSpectra, &filter[512 * j]);
-		}
+		interleaved[2 * i] = floatToWord(leftAudioData[stride * i]);
+		interleaved[2 * i + 1] = floatToWord(rightAudioData[stride * i]);
 	}
 }
 
 /**
- * @brief Perform frequency-domain convolution by point-wise multiplication of DFT spectra
+ * @brief Perform frequency-domain convolution by point-wise multiplication of DFT spectra. With UPOLS_HALF_SPECTRUM both
+ * ears are accumulated over bins 0 to 128 and merged into one spectrum, so a single IFFT returns the left ear in the real part
+ * and the right ear in the imaginary part
  *
- * @param channelOutput Pointer to the time-domain output buffer
- * @param filterID ID of the channel being operated on [left -> 0] [right -> 1]
+ * @param upols upols_t instance
+ * @param bank Filter bank to convolve with
+ * @param leftOutput Pointer to the left ear time-domain output buffer
+ * @param rightOutput Pointer to the right ear time-domain output buffer
+ * @param interleaved When not NULL, the output goes here as interleaved 24-bit words instead of to leftOutput and rightOutput
+ * @param firstPartition First filter partition to accumulate, partitions before it are skipped
  */
-void _convolve(upols_t *upols, float32_t *channelOutput, const uint8_t filterID)
+static void _convolve(const upols_t *upols, const filters_t *bank, float32_t *leftOutput, float32_t *rightOutput, int32_t *interleaved,
+					  const size_t firstPartition)
 {
-	// Frequency-domain accumulation buffer
-	float32_t cmplxAccum[512] = {0};
-	float32_t *filter = filterID ? filters.right : filters.left;
+	// Frequency-domain accumulation buffers
+	float32_t leftAccum[FilterSpectrumFloats];
+	float32_t rightAccum[FilterSpectrumFloats];
+	memset(leftAccum, 0, sizeof(leftAccum));
+	memset(rightAccum, 0, sizeof(rightAccum));
 
-	int16_t shiftIndex = upols->currentIndex; // New starting point
-	
-	for (size_t i = 0; i < PartitionCount; i++)
+#if defined(UPOLS_BIN_MAJOR)
+	cmacBinMajor512(upols->delayLine, bank->left, bank->right, PartitionCount, upols->currentIndex, firstPartition, leftAccum, rightAccum);
+#elif defined(UPOLS_PARTITION_PRUNING)
+	// Only the partitions that carry energy for at least one ear
+	const partitionPruning_t *pruning = &bank->pruning;
+	for (size_t i = 0; i < pruning->activeCount; i++)
 	{
-		// Fast multiply-accumulate for complex numbers
-		cmac512(&upols->delayLine[512 * shiftIndex], &filter[512 * i], cmplxAccum);
-
-		// Decrement with wraparound
-		shiftIndex = (shiftIndex + (PartitionCount - 1)) % PartitionCount;
+		const uint16_t partition = pruning->activeList[i];
+		if (partition >= firstPartition)
+		{
+			accumulatePartition(upols, bank, partition, pruning->activeEars[partition], leftAccum, rightAccum);
+		}
+	}
+#else
+	for (size_t i = firstPartition; i < PartitionCount; i++)
+	{
+		accumulatePartition(upols, bank, i, BothEars, leftAccum, rightAccum);
 	}
+#endif
+
+#ifdef UPOLS_HALF_SPECTRUM
+	float32_t cmplxAccum[512];
+	mergeHalf512(leftAccum, rightAccum, cmplxAccum);
+	dspCfft(cmplxAccum, 256, InverseFFT);
+	const float32_t *leftResult = cmplxAccum;
+	const float32_t *rightResult = cmplxAccum;
+#else
+	dspCfft(leftAccum, 256, InverseFFT);
+	dspCfft(rightAccum, 256, InverseFFT);
+	const float32_t *leftResult = leftAccum;
+	const float32_t *rightResult = rightAccum;
+#endif
 
-	arm_cfft_f32(&arm_cfft_sR_f32_len256, cmplxAccum, InverseFFT, 1);
+	if (interleaved)
+	{
+		// Time-aliased portion is skipped here too
+		interleaveWords(leftResult, &rightResult[1], 2, interleaved);
+		return;
+	}
 
 #pragma GCC unroll 8
 	for (size_t i = 0; i < PartitionSize; i++)
 	{
-		channelOutput[i] = cmplxAccum[2 * i + filterID]; // Time-aliased portion isn't copied
+		// Time-aliased portion isn't copied
+		leftOutput[i] = leftResult[2 * i];
+		rightOutput[i] = rightResult[2 * i + 1];
 	}
 }
 
@@ -104,13 +1328,12 @@ void _convolve(upols_t *upols, float32_t *channelOutput, const uint8_t filterID)
  * @param leftAudioData Pointer to left channel audio
  * @param rightAudioData Pointer to right channel audio
  */
-void overlapSamples(upols_t *upols, const float32_t *leftAudioData, const float32_t *rightAudioData)
+static void overlapSamples(upols_t *upols, const float32_t *leftAudioData, const float32_t *rightAudioData)
 {
+	float32_t *previousAudioData = upols->previousAudio;
+
 	for (size_t i = 0; i < PartitionSize; i++)
 	{
-		// Previous left channel samples in the even indexes, right channel samples in the odd indexes
-		static float32_t previousAudioData[256];
-
 		// Fill the first half with the previous sample
 		upols->slidingWindow[2 * i] = previousAudioData[2 * i];			// [0] [2] [4] ... [254]
 		upols->slidingWindow[2 * i + 1] = previousAudioData[2 * i + 1]; // [1] [3] [5] ... [255]
@@ -126,34 +1349,591 @@ void overlapSamples(upols_t *upols, const float32_t *leftAudioData, const float3
 }
 
 /**
- * @brief 
+ * @brief Move the transformed sliding window into the FDL slot for the current block
  *
- * @param leftAudioData
- * @param rightAudioData
+ * @param upols upols_t instance
  */
-void convolve(int16_t *leftAudio, int16_t *rightAudio)
+static void storeInput(upols_t *upols)
 {
-	static upols_t upols;
+#if defined(UPOLS_COMPACT_STORAGE)
+	upols->delayScale[upols->currentIndex] = packBfp512(upols->slidingWindow, &upols->delayLine[upols->currentIndex * 512]);
+#elif defined(UPOLS_BIN_MAJOR)
+	storeBinMajor(upols->slidingWindow, upols->delayLine, upols->currentIndex);
+#elif defined(UPOLS_HALF_SPECTRUM)
+	float32_t *input = &upols->delayLine[upols->currentIndex * DelaySpectrumFloats];
+	splitHalf512(upols->slidingWindow, input, &input[FilterSpectrumFloats]);
+#else
+	cp512(upols->slidingWindow, &upols->delayLine[upols->currentIndex * 512]);
+#endif
+}
 
-	float32_t leftAudioData[128];
-	float32_t rightAudioData[128];
+#ifdef UPOLS_SILENCE_BYPASS
+/**
+ * @brief Check that every sample of a stereo block is within UPOLS_SILENCE_LEVEL of zero
+ *
+ * @param leftAudio Left channel
+ * @param rightAudio Right channel
+ */
+static bool silentBlock(const int16_t *leftAudio, const int16_t *rightAudio)
+{
+	for (size_t i = 0; i < PartitionSize; i++)
+	{
+		if ((abs(leftAudio[i]) > UPOLS_SILENCE_LEVEL) || (abs(rightAudio[i]) > UPOLS_SILENCE_LEVEL))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief Check that every sample of a float output block truncates to zero at 24 bits
+ *
+ * @param leftAudioData Left ear
+ * @param rightAudioData Right ear
+ */
+static bool silentOutput(const float32_t *leftAudioData, const float32_t *rightAudioData)
+{
+	const float32_t lsb = 1.0f / 8388608.0f;
+	for (size_t i = 0; i < PartitionSize; i++)
+	{
+		if ((fabsf(leftAudioData[i]) >= lsb) || (fabsf(rightAudioData[i]) >= lsb))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief Check that every word of an interleaved output block is zero
+ *
+ * @param interleaved 2 * PartitionSize words
+ */
+static bool silentWords(const int32_t *interleaved)
+{
+	for (size_t i = 0; i < 2 * PartitionSize; i++)
+	{
+		if (interleaved[i])
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief Partitions of a bank up to the last one the CMAC loop multiplies for either ear
+ *
+ * @param bank Filter bank
+ */
+static size_t tailPartitions(const filters_t *bank)
+{
+	size_t count = PartitionCount;
+#ifdef UPOLS_PARTITION_PRUNING
+	const partitionPruning_t *pruning = &bank->pruning;
+	count = pruning->activeCount ? pruning->activeList[pruning->activeCount - 1] + 1u : 0;
+#endif
+#ifdef UPOLS_BAND_PRUNING
+	while (count && !bank->bandBins[LeftFilter][count - 1] && !bank->bandBins[RightFilter][count - 1])
+	{
+		count--;
+	}
+#endif
+	(void)bank;
+	return count;
+}
+
+/**
+ * @brief Blocks of silent input after which nothing still held by the convolver can reach the output
+ *
+ * @param upols Convolver
+ */
+static size_t silenceHorizon(const upols_t *upols)
+{
+	// Either bank may be in use while a crossfade runs
+	const filterSwap_t *filterSwap = &upols->filterSwap;
+	const size_t first = tailPartitions(filterSwap->bank[0]);
+	const size_t second = tailPartitions(filterSwap->bank[1]);
+	// The overlap of the last partition multiplied still carries a block into the output after it leaves the delay line
+	size_t blocks = ((first > second) ? first : second) + 1;
+
+#ifdef UPOLS_SUBBAND
+	blocks = PartitionCount + SubbandPartitions + 2; // Low-rate partitions, their overlap and the interpolator
+#endif
+#ifdef UPOLS_MINIMUM_PHASE
+	blocks++; // Interaural delay line
+#endif
+#ifdef UPOLS_ROOM
+	// Reflections and the reverb input come from the room's own history, the reverb's decay is left to outputSilent
+	if (blocks < RoomEarlySamples / RoomBlockSize)
+	{
+		blocks = RoomEarlySamples / RoomBlockSize;
+	}
+#endif
+	return blocks;
+}
+
+/**
+ * @brief Count silent input blocks and skip the convolution once the tail has run out. The history is cleared on the way
+ * in, so the convolver starts again from silence when the input comes back
+ *
+ * @param upols Convolver
+ * @param leftAudio Left channel
+ * @param rightAudio Right channel
+ * @return true if the block was bypassed, and its output is silence
+ */
+static bool bypassSilence(upols_t *upols, const int16_t *leftAudio, const int16_t *rightAudio)
+{
+	silence_t *silence = &upols->silence;
+	filterSwap_t *filterSwap = &upols->filterSwap;
+
+	if (!silentBlock(leftAudio, rightAudio))
+	{
+		silence->silentBlocks = 0;
+		silence->bypassing = false;
+		return false;
+	}
+
+	if (silence->silentBlocks < UINT16_MAX)
+	{
+		silence->silentBlocks++;
+	}
+
+	if (!silence->bypassing)
+	{
+		if ((silence->silentBlocks < silenceHorizon(upols)) || !silence->outputSilent)
+		{
+			return false;
+		}
+		clearHistory(upols);
+		silence->bypassing = true;
+	}
+
+	// Swaps still go ahead, but there is nothing to crossfade
+	stepFilterSwap(upols);
+	if (filterSwap->state == SwapCrossfading)
+	{
+		filterSwap->active = !filterSwap->active;
+		filterSwap->state = SwapIdle;
+		clearHistory(upols);
+	}
+	return true;
+}
+#endif
+
+#ifdef UPOLS_ROOM
+/**
+ * @brief Check whether the room may move its source this block. It waits for the HRIR crossfade so both change together,
+ * and only moves straight away when no swap is on its way
+ *
+ * @param upols Convolver, before this block's crossfade step
+ * @return true when the room should pick up a queued direction
+ */
+static bool roomMoveDue(const upols_t *upols)
+{
+	const filterSwap_t *filterSwap = &upols->filterSwap;
+	return ((filterSwap->state == SwapCrossfading) && (filterSwap->fadeBlock == 0)) || !upolsFiltersPending(upols);
+}
+#endif
+
+/**
+ * @brief Convolve a block of stereo audio, output in float and optionally as interleaved 24-bit words as well
+ *
+ * @param upols Convolver
+ * @param leftAudio Left channel
+ * @param rightAudio Right channel
+ * @param leftAudioData Left ear output, PartitionSize samples in [-1, 1). Not valid when written straight to interleaved
+ * @param rightAudioData Right ear output, PartitionSize samples in [-1, 1). Not valid when written straight to interleaved
+ * @param interleaved NULL, or 2 * PartitionSize words for the output quantised to 24 bits
+ */
+static void processBlock(upols_t *upols, const int16_t *leftAudio, const int16_t *rightAudio, float32_t *leftAudioData,
+						 float32_t *rightAudioData, int32_t *interleaved)
+{
+	filterSwap_t *filterSwap = &upols->filterSwap;
+
+#ifdef UPOLS_SILENCE_BYPASS
+	if (bypassSilence(upols, leftAudio, rightAudio))
+	{
+		memset(leftAudioData, 0, sizeof(float32_t) * PartitionSize);
+		memset(rightAudioData, 0, sizeof(float32_t) * PartitionSize);
+		if (interleaved)
+		{
+			memset(interleaved, 0, sizeof(int32_t) * 2 * PartitionSize);
+		}
+		return;
+	}
+#endif
 
-	arm_q15_to_float(leftAudio, leftAudioData, 128);
-	arm_q15_to_float(rightAudio, rightAudioData, 128);
+	stepFilterSwap(upols);
+#ifdef UPOLS_ROOM
+	const bool moveRoom = roomMoveDue(upols);
+#endif
 
-	overlapSamples(&upols, leftAudioData, rightAudioData);
+	dspQ15ToFloat(leftAudio, leftAudioData, 128);
+	dspQ15ToFloat(rightAudio, rightAudioData, 128);
+
+	overlapSamples(upols, leftAudioData, rightAudioData);
+#ifdef UPOLS_SUBBAND
+	subbandAnalyze(&upols->subband, leftAudioData, rightAudioData);
+#endif
 
 	// Take FFT of time-domain input buffer and copy to the FDL
-	arm_cfft_f32(&arm_cfft_sR_f32_len256, upols.slidingWindow, ForwardFFT, 1);
-	cp512(upols.slidingWindow, &upols.delayLine[upols.currentIndex * 512]);
+	dspCfft(upols->slidingWindow, 256, ForwardFFT);
+	storeInput(upols);
+
+	// With nothing left to do in float after the IFFT, the active bank's output goes straight to interleaved
+	int32_t *direct = (filterSwap->state == SwapCrossfading) ? NULL : interleaved;
+#if defined(UPOLS_SUBBAND) || defined(UPOLS_MINIMUM_PHASE) || defined(UPOLS_ROOM)
+	direct = NULL;
+#endif
+
+	const filters_t *bank = filterSwap->bank[filterSwap->active];
+	_convolve(upols, bank, leftAudioData, rightAudioData, direct, 0);
+#ifdef UPOLS_SUBBAND
+	float32_t tail[2][SubbandBlockSize];
+	subbandConvolve(&upols->subband, bank, 0, tail[LeftFilter], tail[RightFilter]);
+#endif
+#ifdef UPOLS_MINIMUM_PHASE
+	float32_t itdTarget[2] = {bank->delay[LeftFilter], bank->delay[RightFilter]};
+#endif
+
+	if (filterSwap->state == SwapCrossfading)
+	{
+		// Both banks share the delay line, so the incoming filters only cost another CMAC pass and IFFT per ear
+		float32_t incomingLeft[128];
+		float32_t incomingRight[128];
+		const filters_t *incoming = filterSwap->bank[!filterSwap->active];
+
+		_convolve(upols, incoming, incomingLeft, incomingRight, NULL, 0);
+		crossfade(leftAudioData, incomingLeft, filterSwap->fadeBlock);
+		crossfade(rightAudioData, incomingRight, filterSwap->fadeBlock);
+#ifdef UPOLS_SUBBAND
+		float32_t incomingTail[2][SubbandBlockSize];
+		subbandConvolve(&upols->subband, incoming, 0, incomingTail[LeftFilter], incomingTail[RightFilter]);
+		subbandCrossfade(tail[LeftFilter], incomingTail[LeftFilter], filterSwap->fadeBlock);
+		subbandCrossfade(tail[RightFilter], incomingTail[RightFilter], filterSwap->fadeBlock);
+#endif
+#ifdef UPOLS_MINIMUM_PHASE
+		// The delay moves to the incoming filters' delay over the course of the crossfade
+		const float32_t progress = (float32_t)(filterSwap->fadeBlock + 1) / CrossfadeBlocks;
+		for (size_t ear = 0; ear < 2; ear++)
+		{
+			const float32_t outgoing = clampDelay(itdTarget[ear]);
+			itdTarget[ear] = outgoing + progress * (clampDelay(incoming->delay[ear]) - outgoing);
+		}
+#endif
 
-	_convolve(&upols, leftAudioData, LeftFilter);
-	_convolve(&upols, rightAudioData, RightFilter);
+		if (++filterSwap->fadeBlock == CrossfadeBlocks)
+		{
+			filterSwap->active = !filterSwap->active;
+			filterSwap->state = SwapIdle;
+		}
+	}
 
 	// Increment with wraparound
-	upols.currentIndex = (upols.currentIndex + 1) % PartitionCount;
+	upols->currentIndex = (upols->currentIndex + 1) % PartitionCount;
+
+#ifdef UPOLS_SUBBAND
+	subbandSynthesize(&upols->subband, tail[LeftFilter], tail[RightFilter], leftAudioData, rightAudioData);
+#endif
+
+#ifdef UPOLS_MINIMUM_PHASE
+	applyItd(upols, leftAudioData, rightAudioData, itdTarget);
+#endif
+
+#ifdef UPOLS_ROOM
+	roomProcess(&upols->room, upols->previousAudio, leftAudioData, rightAudioData, moveRoom);
+#endif
+
+	if (interleaved && !direct)
+	{
+		interleaveWords(leftAudioData, rightAudioData, 1, interleaved);
+	}
+
+#ifdef UPOLS_SILENCE_BYPASS
+	upols->silence.outputSilent = interleaved ? silentWords(interleaved) : silentOutput(leftAudioData, rightAudioData);
+#endif
+}
+
+/**
+ * @brief Convolve a block of stereo audio, leaving the output in float so it can be quantised once at the DAC's resolution
+ *
+ * @param upols Convolver
+ * @param leftAudio Left channel
+ * @param rightAudio Right channel
+ * @param leftAudioData Left ear output, PartitionSize samples in [-1, 1)
+ * @param rightAudioData Right ear output, PartitionSize samples in [-1, 1)
+ */
+void upolsProcessFloat(upols_t *upols, const int16_t *leftAudio, const int16_t *rightAudio, float32_t *leftAudioData,
+					   float32_t *rightAudioData)
+{
+	processBlock(upols, leftAudio, rightAudio, leftAudioData, rightAudioData, NULL);
+}
+
+/**
+ * @brief Convolve a block of stereo audio into interleaved 24-bit words, such as a half of a DMA transmit ring. Unless a
+ * crossfade or a float stage after the IFFT is in the way, the words are written straight from the IFFT buffers
+ *
+ * @param upols Convolver
+ * @param leftAudio Left channel
+ * @param rightAudio Right channel
+ * @param interleaved 2 * PartitionSize words, left ear first, sign-extended from 24 bits
+ */
+void upolsProcessInterleaved(upols_t *upols, const int16_t *leftAudio, const int16_t *rightAudio, int32_t *interleaved)
+{
+	float32_t leftAudioData[128];
+	float32_t rightAudioData[128];
+	processBlock(upols, leftAudio, rightAudio, leftAudioData, rightAudioData, interleaved);
+}
+
+/**
+ * @brief Convolve a block of stereo audio in place
+ *
+ * @param upols Convolver
+ * @param leftAudio Left channel, replaced with the left ear output
+ * @param rightAudio Right channel, replaced with the right ear output
+ */
+void upolsProcess(upols_t *upols, int16_t *leftAudio, int16_t *rightAudio)
+{
+	float32_t leftAudioData[128];
+	float32_t rightAudioData[128];
+
+	upolsProcessFloat(upols, leftAudio, rightAudio, leftAudioData, rightAudioData);
 
 	// Convert back to input type
-	arm_float_to_q15(leftAudioData, leftAudio, 128);
-	arm_float_to_q15(rightAudioData, rightAudio, 128);
+	dspFloatToQ15(leftAudioData, leftAudio, 128);
+	dspFloatToQ15(rightAudioData, rightAudio, 128);
+#ifdef UPOLS_SILENCE_BYPASS
+	upols->silence.outputSilent = silentBlock(leftAudio, rightAudio);
+#endif
+}
+
+/**
+ * @brief Hybrid mode: FIR the current block with the HRIR heads and add the tail computed by the previous upolsProcessTail(),
+ * leaving the output in float
+ *
+ * @param upols Convolver
+ * @param leftAudio Left channel
+ * @param rightAudio Right channel
+ * @param leftAudioData Left ear output, PartitionSize samples in [-1, 1)
+ * @param rightAudioData Right ear output, PartitionSize samples in [-1, 1)
+ */
+void upolsProcessHeadFloat(upols_t *upols, const int16_t *leftAudio, const int16_t *rightAudio, float32_t *leftAudioData,
+						   float32_t *rightAudioData)
+{
+	headFilters_t *headFilters = &upols->headFilters;
+
+#ifdef UPOLS_SILENCE_BYPASS
+	if (bypassSilence(upols, leftAudio, rightAudio))
+	{
+		memset(leftAudioData, 0, sizeof(float32_t) * PartitionSize);
+		memset(rightAudioData, 0, sizeof(float32_t) * PartitionSize);
+		return;
+	}
+#endif
+
+	filterSwap_t *filterSwap = &upols->filterSwap;
+	if (!headFilters->initialized)
+	{
+		attachHeadFilters(headFilters, filterSwap->bank[filterSwap->active]);
+	}
+#ifdef UPOLS_ROOM
+	const bool moveRoom = roomMoveDue(upols);
+#endif
+
+	dspQ15ToFloat(leftAudio, leftAudioData, 128);
+	dspQ15ToFloat(rightAudio, rightAudioData, 128);
+
+	// Sliding window is transformed later by upolsProcessTail()
+	overlapSamples(upols, leftAudioData, rightAudioData);
+
+	// The incoming heads go first, the active ones filter in place
+	const bool crossfading = (filterSwap->state == SwapCrossfading);
+	float32_t incomingLeft[128];
+	float32_t incomingRight[128];
+	if (crossfading)
+	{
+		dspFir(&headFilters->incomingFir[LeftFilter], leftAudioData, incomingLeft, 128);
+		dspFir(&headFilters->incomingFir[RightFilter], rightAudioData, incomingRight, 128);
+	}
+
+	dspFir(&headFilters->fir[LeftFilter], leftAudioData, leftAudioData, 128);
+	dspFir(&headFilters->fir[RightFilter], rightAudioData, rightAudioData, 128);
+
+	for (size_t i = 0; i < PartitionSize; i++)
+	{
+		leftAudioData[i] += headFilters->tailOutput[LeftFilter][i];
+		rightAudioData[i] += headFilters->tailOutput[RightFilter][i];
+	}
+
+#ifdef UPOLS_MINIMUM_PHASE
+	const filters_t *bank = filterSwap->bank[filterSwap->active];
+	float32_t itdTarget[2] = {bank->delay[LeftFilter], bank->delay[RightFilter]};
+#endif
+
+	if (crossfading)
+	{
+		for (size_t i = 0; i < PartitionSize; i++)
+		{
+			incomingLeft[i] += headFilters->incomingTail[LeftFilter][i];
+			incomingRight[i] += headFilters->incomingTail[RightFilter][i];
+		}
+		crossfade(leftAudioData, incomingLeft, filterSwap->fadeBlock);
+		crossfade(rightAudioData, incomingRight, filterSwap->fadeBlock);
+
+#ifdef UPOLS_MINIMUM_PHASE
+		// The delay moves to the incoming filters' delay over the course of the crossfade
+		const filters_t *incoming = filterSwap->bank[!filterSwap->active];
+		const float32_t progress = (float32_t)(filterSwap->fadeBlock + 1) / CrossfadeBlocks;
+		for (size_t ear = 0; ear < 2; ear++)
+		{
+			const float32_t outgoing = clampDelay(itdTarget[ear]);
+			itdTarget[ear] = outgoing + progress * (clampDelay(incoming->delay[ear]) - outgoing);
+		}
+#endif
+
+		if (++filterSwap->fadeBlock == CrossfadeBlocks)
+		{
+			// The incoming heads carry on with their own history
+			filterSwap->active = !filterSwap->active;
+			filterSwap->state = SwapIdle;
+			attachHeadFilters(headFilters, filterSwap->bank[filterSwap->active]);
+			memcpy(headFilters->state, headFilters->incomingState, sizeof(headFilters->state));
+		}
+	}
+
+#ifdef UPOLS_MINIMUM_PHASE
+	applyItd(upols, leftAudioData, rightAudioData, itdTarget);
+#endif
+
+#ifdef UPOLS_ROOM
+	roomProcess(&upols->room, upols->previousAudio, leftAudioData, rightAudioData, moveRoom);
+#endif
+
+#ifdef UPOLS_SILENCE_BYPASS
+	upols->silence.outputSilent = silentOutput(leftAudioData, rightAudioData);
+#endif
+}
+
+/**
+ * @brief Hybrid mode: FIR the current block with the HRIR heads and add the tail computed by the previous upolsProcessTail()
+ *
+ * @param upols Convolver
+ * @param leftAudio Left channel, replaced with the left ear output
+ * @param rightAudio Right channel, replaced with the right ear output
+ */
+void upolsProcessHead(upols_t *upols, int16_t *leftAudio, int16_t *rightAudio)
+{
+	float32_t leftAudioData[128];
+	float32_t rightAudioData[128];
+
+	upolsProcessHeadFloat(upols, leftAudio, rightAudio, leftAudioData, rightAudioData);
+
+	dspFloatToQ15(leftAudioData, leftAudio, 128);
+	dspFloatToQ15(rightAudioData, rightAudio, 128);
+#ifdef UPOLS_SILENCE_BYPASS
+	upols->silence.outputSilent = silentBlock(leftAudio, rightAudio);
+#endif
+}
+
+/**
+ * @brief Hybrid mode: upolsProcessHead() into interleaved 24-bit words
+ *
+ * @param upols Convolver
+ * @param leftAudio Left channel
+ * @param rightAudio Right channel
+ * @param interleaved 2 * PartitionSize words, left ear first, sign-extended from 24 bits
+ */
+void upolsProcessHeadInterleaved(upols_t *upols, const int16_t *leftAudio, const int16_t *rightAudio, int32_t *interleaved)
+{
+	float32_t leftAudioData[128];
+	float32_t rightAudioData[128];
+
+	upolsProcessHeadFloat(upols, leftAudio, rightAudio, leftAudioData, rightAudioData);
+	interleaveWords(leftAudioData, rightAudioData, 1, interleaved);
+}
+
+/**
+ * @brief Hybrid mode: push the block windowed by upolsProcessHead() into the FDL and compute the tail partitions' contribution to the next block.
+ * While a swap crossfades the tail is convolved with both banks, and upolsProcessHead() fades between the two
+ *
+ * @param upols Convolver
+ */
+void upolsProcessTail(upols_t *upols)
+{
+	filterSwap_t *filterSwap = &upols->filterSwap;
+	headFilters_t *headFilters = &upols->headFilters;
+
+#ifdef UPOLS_SILENCE_BYPASS
+	// upolsProcessHead() has already moved any swap along
+	if (upols->silence.bypassing)
+	{
+		return;
+	}
+#endif
+
+	const bool wasCrossfading = (filterSwap->state == SwapCrossfading);
+	stepFilterSwap(upols);
+	const bool crossfading = (filterSwap->state == SwapCrossfading);
+	if (crossfading && !wasCrossfading)
+	{
+		// The FIR history after this block's head is where the incoming heads start from
+		forkHeadFilters(headFilters, filterSwap->bank[!filterSwap->active]);
+	}
+
+	dspCfft(upols->slidingWindow, 256, ForwardFFT);
+	storeInput(upols);
+
+	// Partition 0 now refers to the block that hasn't arrived yet, which the head FIR covers
+	upols->currentIndex = (upols->currentIndex + 1) % PartitionCount;
+
+	const filters_t *bank = filterSwap->bank[filterSwap->active];
+	const filters_t *incoming = filterSwap->bank[!filterSwap->active];
+	_convolve(upols, bank, headFilters->tailOutput[LeftFilter], headFilters->tailOutput[RightFilter], NULL, HybridHeadPartitions);
+	if (crossfading)
+	{
+		_convolve(upols, incoming, headFilters->incomingTail[LeftFilter], headFilters->incomingTail[RightFilter], NULL, HybridHeadPartitions);
+	}
+
+#ifdef UPOLS_SUBBAND
+	// The block windowed by upolsProcessHead() is still in previousAudio, and the low-rate tail is one block ahead as well
+	float32_t leftAudioData[128];
+	float32_t rightAudioData[128];
+	for (size_t i = 0; i < PartitionSize; i++)
+	{
+		leftAudioData[i] = upols->previousAudio[2 * i];
+		rightAudioData[i] = upols->previousAudio[2 * i + 1];
+	}
+	subbandAnalyze(&upols->subband, leftAudioData, rightAudioData);
+
+	float32_t tail[2][SubbandBlockSize];
+	subbandConvolve(&upols->subband, bank, 1, tail[LeftFilter], tail[RightFilter]);
+	if (!crossfading)
+	{
+		subbandSynthesize(&upols->subband, tail[LeftFilter], tail[RightFilter], headFilters->tailOutput[LeftFilter],
+						  headFilters->tailOutput[RightFilter]);
+		return;
+	}
+
+	// The low-rate tail is faded at its own rate, and the interpolator only runs once, so the result goes to both sides of
+	// the full-rate crossfade
+	float32_t incomingTail[2][SubbandBlockSize];
+	subbandConvolve(&upols->subband, incoming, 1, incomingTail[LeftFilter], incomingTail[RightFilter]);
+	subbandCrossfade(tail[LeftFilter], incomingTail[LeftFilter], filterSwap->fadeBlock);
+	subbandCrossfade(tail[RightFilter], incomingTail[RightFilter], filterSwap->fadeBlock);
+
+	memset(leftAudioData, 0, sizeof(leftAudioData));
+	memset(rightAudioData, 0, sizeof(rightAudioData));
+	subbandSynthesize(&upols->subband, tail[LeftFilter], tail[RightFilter], leftAudioData, rightAudioData);
+	for (size_t i = 0; i < PartitionSize; i++)
+	{
+		headFilters->tailOutput[LeftFilter][i] += leftAudioData[i];
+		headFilters->tailOutput[RightFilter][i] += rightAudioData[i];
+		headFilters->incomingTail[LeftFilter][i] += leftAudioData[i];
+		headFilters->incomingTail[RightFilter][i] += rightAudioData[i];
+	}
+#else
+	(void)incoming;
+#endif
 }
@@ -13,39 +13,376 @@
 
 #include <stdlib.h>
 #include <string.h>
-#include <usb_serial.h>
 #include <stdio.h>
 #include <stdbool.h>
-#include <arm_math.h>
-#include <arm_const_structs.h>
-#include <imxrt.h>
+#include "dspBackend.h"
 #include "math512.h"
+#ifdef UPOLS_ROOM
+#include "room.h"
+#endif
+
+// Number of 128-tap partitions convolved at the full rate, which is the whole filter unless UPOLS_SUBBAND takes the tail.
+// Minimum-phase HRIRs keep their energy in the first few milliseconds, so they default to 1024 taps
+#ifndef UPOLS_PARTITION_COUNT
+#if defined(UPOLS_MINIMUM_PHASE) || defined(UPOLS_SUBBAND)
+#define UPOLS_PARTITION_COUNT 8
+#else
+#define UPOLS_PARTITION_COUNT 64
+#endif
+#endif
+
+// Multirate tail: 128-tap partitions past the first PartitionCount, convolved at 1 / UPOLS_SUBBAND_DECIMATION of the rate
+#ifndef UPOLS_SUBBAND_PARTITIONS
+#define UPOLS_SUBBAND_PARTITIONS 56
+#endif
+
+#ifndef UPOLS_SUBBAND_DECIMATION
+#define UPOLS_SUBBAND_DECIMATION 4
+#endif
+
+#if defined(UPOLS_SUBBAND) && (UPOLS_SUBBAND_DECIMATION != 2) && (UPOLS_SUBBAND_DECIMATION != 4)
+#error "UPOLS_SUBBAND_DECIMATION must be 2 or 4"
+#endif
+
+// Hybrid mode computes the tail a block ahead, so the low-rate lead-in partition can't be the newest block
+#if defined(UPOLS_SUBBAND) && defined(UPOLS_HYBRID) && (UPOLS_PARTITION_COUNT < 2)
+#error "UPOLS_SUBBAND with UPOLS_HYBRID needs UPOLS_PARTITION_COUNT of at least 2"
+#endif
 
 enum Lengths
 {
-	PartitionSize = 128, // Number of audio samples per partition
-	PartitionCount = 64, // Number of partitions making up the filter
-	ImpulseSamples = PartitionSize * PartitionCount,
+	PartitionSize = 128,					// Number of audio samples per partition
+	PartitionCount = UPOLS_PARTITION_COUNT, // Number of partitions convolved at the full rate
+#ifdef UPOLS_SUBBAND
+	SubbandPartitions = UPOLS_SUBBAND_PARTITIONS, // Number of partitions in the low-rate tail
+#else
+	SubbandPartitions = 0,
+#endif
+	ImpulseSamples = PartitionSize * (PartitionCount + SubbandPartitions), // Taps per ear in irTable
+};
+
+enum SubbandLengths
+{
+	SubbandFactor = UPOLS_SUBBAND_DECIMATION,
+	SubbandBlockSize = PartitionSize / SubbandFactor, // Low-rate samples per block, and taps per low-rate partition
+	SubbandFftLength = 2 * SubbandBlockSize,
+	SubbandSpectrumFloats = 2 * SubbandFftLength,
+	SubbandFirTaps = 16 * SubbandFactor - 1, // Anti-aliasing and interpolation lowpass, linear phase
+	SubbandFirDelay = (SubbandFirTaps - 1) / 2,
+	SubbandFilterPartitions = SubbandPartitions + 1,					   // From low-rate partition PartitionCount - 1, which holds the lead-in of the lowpassed tail
+	SubbandSlots = PartitionCount + SubbandPartitions,					   // Low-rate delay line depth
+	SubbandHistory = (SubbandFirTaps + SubbandFactor - 2) / SubbandFactor // Low-rate outputs the interpolator reaches back to
 };
 
-enum FFT_Flags
+// Minimum-phase HRIRs: the interaural time delay removed from the taps is put back by a fractional delay line on each ear
+enum InterauralDelay
+{
+	ItdMaxSamples = 96,		// Longest delay in irDelay, hrirc clamps to this
+	ItdInterpolatorTaps = 4, // Cubic Lagrange
+	ItdLatency = 2,			// Added to both ears so the interpolator never reads ahead of the input
+	ItdRingSamples = 256	// Power of two holding ItdMaxSamples + ItdLatency + ItdInterpolatorTaps
+};
+
+// Number of 128-tap partitions applied with the time-domain FIR in hybrid mode
+#ifndef UPOLS_HYBRID_HEAD_PARTITIONS
+#define UPOLS_HYBRID_HEAD_PARTITIONS 1
+#endif
+
+enum HybridLengths
+{
+	HybridHeadPartitions = UPOLS_HYBRID_HEAD_PARTITIONS,
+	HybridHeadTaps = PartitionSize * HybridHeadPartitions
+};
+
+// Filter swaps: partition spectra prepared per audio block, and the length of the crossfade that follows
+#ifndef UPOLS_PREP_PARTITIONS
+#define UPOLS_PREP_PARTITIONS 8
+#endif
+
+#ifndef UPOLS_CROSSFADE_BLOCKS
+#define UPOLS_CROSSFADE_BLOCKS 2
+#endif
+
+enum FilterSwap
 {
-	ForwardFFT,
-	InverseFFT
+	FilterPrepPartitions = UPOLS_PREP_PARTITIONS,
+	CrossfadeBlocks = UPOLS_CROSSFADE_BLOCKS
 };
 
+// Partition pruning: partitions holding less than this share of an ear's energy are skipped by the CMAC loop
+#ifndef UPOLS_PRUNE_THRESHOLD_DB
+#define UPOLS_PRUNE_THRESHOLD_DB -90
+#endif
+
+#if defined(UPOLS_PARTITION_PRUNING) && defined(UPOLS_BIN_MAJOR)
+#error "UPOLS_PARTITION_PRUNING needs partition-major spectra, not UPOLS_BIN_MAJOR"
+#endif
+
+// Band pruning: the upper bins of a partition holding less than this share of the ear's energy are skipped, as is
+// everything above UPOLS_BAND_LIMIT_HZ (at 44.1 kHz)
+#ifndef UPOLS_BAND_THRESHOLD_DB
+#define UPOLS_BAND_THRESHOLD_DB -90
+#endif
+
+#ifndef UPOLS_BAND_LIMIT_HZ
+#define UPOLS_BAND_LIMIT_HZ 22050
+#endif
+
+#if defined(UPOLS_BAND_PRUNING) && (defined(UPOLS_COMPACT_STORAGE) || defined(UPOLS_BIN_MAJOR))
+#error "UPOLS_BAND_PRUNING needs partition-major float spectra, not UPOLS_COMPACT_STORAGE or UPOLS_BIN_MAJOR"
+#endif
+
+// Silence bypass: input samples within this many LSBs of zero count as silent
+#ifndef UPOLS_SILENCE_LEVEL
+#define UPOLS_SILENCE_LEVEL 0
+#endif
+
 enum FilterID
 {
 	LeftFilter,
 	RightFilter
 };
 
+// Ears a filter partition is applied to
+enum PartitionEars
+{
+	LeftEar = 1 << LeftFilter,
+	RightEar = 1 << RightFilter,
+	BothEars = LeftEar | RightEar
+};
+
+enum Interpolation
+{
+	BlendDirections = 3 // Corners of a triangle in the measurement grid
+};
+
+// Stereo matrix: the input channels are two virtual speakers this many degrees apart
+#ifndef UPOLS_STEREO_WIDTH
+#define UPOLS_STEREO_WIDTH 60
+#endif
+
+// Every path of the matrix goes into complex full-rate filters computed from the taps, and each ear has one head FIR and one delay
+#if defined(UPOLS_STEREO_MATRIX) && (defined(UPOLS_HALF_SPECTRUM) || defined(UPOLS_SPECTRAL_BANK))
+#error "UPOLS_STEREO_MATRIX needs full complex spectra computed at run time, not UPOLS_HALF_SPECTRUM or UPOLS_SPECTRAL_BANK"
+#endif
+#if defined(UPOLS_STEREO_MATRIX) && (defined(UPOLS_HYBRID) || defined(UPOLS_MINIMUM_PHASE))
+#error "UPOLS_STEREO_MATRIX can't be combined with UPOLS_HYBRID or UPOLS_MINIMUM_PHASE"
+#endif
+
+// Weighted mix of HRIR pairs. Weights sum to 1, unused corners have a weight of 0
+typedef struct hrirBlend_t
+{
+	uint16_t irIndex[BlendDirections]; // Left input channel's speaker with UPOLS_STEREO_MATRIX
+	float32_t weight[BlendDirections];
+#ifdef UPOLS_STEREO_MATRIX
+	uint16_t rightIrIndex[BlendDirections]; // Right input channel's speaker
+	float32_t rightWeight[BlendDirections];
+#endif
+} hrirBlend_t;
+
+// Filter and delay line spectra are either float or block floating point (q15 mantissas, one power-of-two scale per partition)
+#ifdef UPOLS_COMPACT_STORAGE
+#ifdef UPOLS_SPECTRAL_BANK
+#error "UPOLS_COMPACT_STORAGE and UPOLS_SPECTRAL_BANK are mutually exclusive"
+#endif
+typedef q15_t spectrum_t;
+#else
+typedef float32_t spectrum_t;
+#endif
+
+// Bin-major spectra: the same bin of every partition is contiguous, so a cache line holds one bin of four partitions
+#ifdef UPOLS_BIN_MAJOR
+#if defined(UPOLS_COMPACT_STORAGE) || defined(UPOLS_SPECTRAL_BANK)
+#error "UPOLS_BIN_MAJOR can't be combined with UPOLS_COMPACT_STORAGE or UPOLS_SPECTRAL_BANK"
+#endif
+#endif
+
+// Half spectra: the taps and each input channel are real, so bins 129 to 255 mirror bins 127 to 1 and aren't stored
+#ifdef UPOLS_HALF_SPECTRUM
+#if defined(UPOLS_COMPACT_STORAGE) || defined(UPOLS_BIN_MAJOR)
+#error "UPOLS_HALF_SPECTRUM can't be combined with UPOLS_COMPACT_STORAGE or UPOLS_BIN_MAJOR"
+#endif
+#endif
+
+enum SpectrumLengths
+{
+	HalfSpectrumBins = 129, // Bins 0 to 128 of a 256-point FFT
+#ifdef UPOLS_HALF_SPECTRUM
+	FilterSpectrumFloats = 2 * HalfSpectrumBins, // One ear, bins 0 to 128
+	DelaySpectrumFloats = 4 * HalfSpectrumBins	 // Left channel bins 0 to 128, then right channel bins 0 to 128
+#else
+	FilterSpectrumFloats = 512, // One ear, every bin
+	DelaySpectrumFloats = 512	// Left channel in the real part, right in the imaginary
+#endif
+};
+
+// Bins multiplied for a band of n: 0 to n - 1, and with full spectra their mirror images 256 - n + 1 to 255
+enum BandLimits
+{
+	BandLimitBins = ((UPOLS_BAND_LIMIT_HZ * 256 / 44100 + 2) < HalfSpectrumBins) ? (UPOLS_BAND_LIMIT_HZ * 256 / 44100 + 2) : HalfSpectrumBins
+};
+
+// Partitions of a filter pair worth multiplying, built once every partition's energy is known
+typedef struct partitionPruning_t
+{
+	float32_t energy[2][PartitionCount]; // Energy of each partition's taps
+	uint8_t activeEars[PartitionCount];	 // LeftEar and/or RightEar when that ear's partition is above the threshold
+	uint16_t activeList[PartitionCount]; // Partitions with at least one active ear, ascending
+	uint16_t activeCount;				 // Length of activeList
+} partitionPruning_t;
+
+// Partition spectra of an HRIR pair, one filter for each ear. With UPOLS_BIN_MAJOR, bin b of partition p is at [2 * (PartitionCount * b + PartitionCount - 1 - p)]
+typedef struct filters_t
+{
+	spectrum_t left[FilterSpectrumFloats * PartitionCount];
+	spectrum_t right[FilterSpectrumFloats * PartitionCount];
+#ifdef UPOLS_COMPACT_STORAGE
+	float32_t scale[2][PartitionCount]; // Block scale of each partition spectrum
+#endif
+	float32_t head[2][HybridHeadTaps]; // Time-reversed HRIR heads for hybrid mode, as expected by dspFir()
+#ifdef UPOLS_MINIMUM_PHASE
+	float32_t delay[2]; // Interaural delay of each ear in samples, blended like the spectra
+#endif
+#ifdef UPOLS_PARTITION_PRUNING
+	partitionPruning_t pruning;
+#endif
+#ifdef UPOLS_BAND_PRUNING
+	uint8_t bandBins[2][PartitionCount]; // Band of each partition worth multiplying, 0 to HalfSpectrumBins
+#endif
+#ifdef UPOLS_SUBBAND
+	float32_t subband[2][SubbandSpectrumFloats * SubbandFilterPartitions]; // Low-rate spectra of the lowpassed tail of each ear
+#endif
+} filters_t;
+
+// Time-domain head of each HRIR for hybrid mode
+typedef struct headFilters_t
+{
+	bool initialized;
+	float32_t state[2][HybridHeadTaps + PartitionSize - 1]; // FIR history
+	dspFir_t fir[2];
+	float32_t tailOutput[2][PartitionSize]; // Tail contribution to the next block
+	// Incoming filters of a crossfading swap, started from a copy of the FIR history
+	float32_t incomingState[2][HybridHeadTaps + PartitionSize - 1];
+	dspFir_t incomingFir[2];
+	float32_t incomingTail[2][PartitionSize];
+} headFilters_t;
+
+typedef enum swapState_t
+{
+	SwapIdle,
+	SwapPreparing,
+	SwapCrossfading
+} swapState_t;
+
+// Double-buffered filters: the inactive bank is filled a few partitions per block, then faded in
+typedef struct filterSwap_t
+{
+	const filters_t *bank[2];
+	uint8_t active;						 // Bank currently used for convolution
+	swapState_t state;					 // Progress of the swap into the inactive bank
+	hrirBlend_t blend;					 // HRIR mix being prepared
+	uint16_t cursor;					 // Partitions prepared so far, left ear then right ear
+	uint16_t fadeBlock;					 // Crossfade blocks completed
+	volatile bool requestPending;		 // Set by upolsRequestBlend(), consumed by the audio path
+	volatile hrirBlend_t requestedBlend; // HRIR mix asked for by upolsRequestBlend()
+} filterSwap_t;
+
+// Fractional delay of each ear, gliding across a block whenever the filters' delay changes
+typedef struct itdDelay_t
+{
+	float32_t ring[2][ItdRingSamples]; // Convolver output history
+	uint16_t writeIndex;
+	float32_t current[2]; // Delay reached at the end of the last block, in samples
+} itdDelay_t;
+
+// Silent input tracking for UPOLS_SILENCE_BYPASS
+typedef struct silence_t
+{
+	uint16_t silentBlocks; // Consecutive blocks of silent input, saturating
+	bool outputSilent;	   // Output of the last convolved block rounded to silence at the resolution it was handed out in
+	bool bypassing;		   // Convolution is skipped until the input comes back
+} silence_t;
+
+// Low-rate convolver for the tail: decimated input, its delay line and the interpolator history
+typedef struct subband_t
+{
+	float32_t inputHistory[2][SubbandFirTaps - 1 + PartitionSize]; // Full-rate input of the anti-aliasing filter
+	float32_t previousInput[2 * SubbandBlockSize];					// Last low-rate block, left samples in the even indexes, right in the odd
+	float32_t delayLine[SubbandSpectrumFloats * SubbandSlots];
+	int16_t currentIndex;
+	float32_t outputHistory[2][SubbandHistory + SubbandBlockSize]; // Low-rate output of the interpolator
+} subband_t;
+
+// Convolver state. Independent instances only share the read-only HRIR tables
+typedef struct upols_t
+{
+	int16_t currentIndex;										// Current partition index
+	float32_t previousAudio[2 * PartitionSize];					// Last block, left samples in the even indexes, right in the odd
+	float32_t slidingWindow[512];								// Time-domain sliding window
+	spectrum_t delayLine[DelaySpectrumFloats * PartitionCount]; // Frequency-domain delay line, bin-major with UPOLS_BIN_MAJOR
+#ifdef UPOLS_COMPACT_STORAGE
+	float32_t delayScale[PartitionCount]; // Block scale of each delay line spectrum
+#endif
+	filters_t *ramBank[2]; // Filters are prepared into whichever of these isn't active
+	bool ownsBanks;		   // Banks were allocated by upolsCreate()
+	filterSwap_t filterSwap;
+	headFilters_t headFilters;
+#ifdef UPOLS_MINIMUM_PHASE
+	itdDelay_t itd;
+#endif
+#ifdef UPOLS_SUBBAND
+	subband_t subband;
+#endif
+#ifdef UPOLS_ROOM
+	room_t room; // Early reflections and late reverb around the direct path
+#endif
+#ifdef UPOLS_SILENCE_BYPASS
+	silence_t silence;
+#endif
+} upols_t;
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif
-	void processFilters(const uint16_t irIndex);
-	void convolve(int16_t *leftAudio, int16_t *rightAudio);
+	const float32_t *hrirPair(const uint16_t irIndex);
+	hrirBlend_t hrirBlendSingle(const uint16_t irIndex);
+	uint16_t hrirCount(void);
+#ifdef UPOLS_MINIMUM_PHASE
+	float32_t hrirDelay(const uint16_t irIndex, const size_t ear);
+#endif
+	void computeFilters(filters_t *bank, const uint16_t irIndex);
+
+	upols_t *upolsCreate(void);
+	void upolsInit(upols_t *upols, filters_t *primaryBank, filters_t *secondaryBank);
+	void upolsReset(upols_t *upols);
+	void upolsDestroy(upols_t *upols);
+
+	void upolsSetFilters(upols_t *upols, const uint16_t irIndex);
+	void upolsRequestFilters(upols_t *upols, const uint16_t irIndex);
+	void upolsRequestBlend(upols_t *upols, const hrirBlend_t *blend);
+	bool upolsFiltersPending(const upols_t *upols);
+	uint16_t upolsActivePartitions(const upols_t *upols, const size_t ear);
+	uint32_t upolsActiveBins(const upols_t *upols, const size_t ear);
+	bool upolsBypassing(const upols_t *upols);
+	uint16_t activePartitions(const filters_t *bank, const size_t ear);
+	uint32_t activeBins(const filters_t *bank, const size_t ear);
+#ifdef UPOLS_PARTITION_PRUNING
+	void pruneFilters(filters_t *bank);
+#endif
+#ifdef UPOLS_BAND_PRUNING
+	void limitFilterBands(filters_t *bank);
+#endif
+
+	void upolsProcess(upols_t *upols, int16_t *leftAudio, int16_t *rightAudio);
+	void upolsProcessFloat(upols_t *upols, const int16_t *leftAudio, const int16_t *rightAudio, float32_t *leftAudioData,
+						   float32_t *rightAudioData);
+	void upolsProcessInterleaved(upols_t *upols, const int16_t *leftAudio, const int16_t *rightAudio, int32_t *interleaved);
+	void upolsProcessHead(upols_t *upols, int16_t *leftAudio, int16_t *rightAudio);
+	void upolsProcessHeadFloat(upols_t *upols, const int16_t *leftAudio, const int16_t *rightAudio, float32_t *leftAudioData,
+							   float32_t *rightAudioData);
+	void upolsProcessHeadInterleaved(upols_t *upols, const int16_t *leftAudio, const int16_t *rightAudio, int32_t *interleaved);
+	void upolsProcessTail(upols_t *upols);
 #ifdef __cplusplus
 }
 #endif
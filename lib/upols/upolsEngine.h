@@ -0,0 +1,175 @@
+/**
+ * @file upolsEngine.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Uniformly-partitioned overlap-save convolution for any partition size and count
+ * @version 0.1
+ * @date 2021-12-15
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ * @details
+ * Same scheme as upols.c (stereo packed into one complex FFT, filter partitions zero-padded on the
+ * left, time-aliased half of the IFFT discarded) with the partition size and count as template
+ * parameters. Every buffer is sized at compile time and the spectrum kernels come from Kernels<>,
+ * so 64, 128 and 256 sample variants are just different instantiations:
+ *
+ *   UpolsEngine<64, 128>   64 samples of latency, twice the blocks per second
+ *   UpolsEngine<128, 64>   Same layout as upols.c
+ *   UpolsEngine<256, 32>   Half the FFTs and CMAC passes per sample, 256 samples of latency
+ *
+ */
+
+#pragma once
+
+#include "upols.h"
+#include "kernels.h"
+
+template <size_t PartitionSamples, size_t Partitions>
+class UpolsEngine
+{
+public:
+	static constexpr size_t FFTLength = 2 * PartitionSamples; // Complex points per transform
+	static constexpr size_t SpectrumFloats = 2 * FFTLength;	  // Interleaved floats per partition spectrum
+	static constexpr size_t FilterTaps = PartitionSamples * Partitions;
+
+	static_assert(FFTLength >= MinFFTLength && FFTLength <= MaxFFTLength, "No FFT for this partition size");
+	static_assert(FilterTaps <= ImpulseSamples, "Filter is longer than the HRIRs in irTable");
+
+	// Partition spectra of an HRIR pair, one filter for each ear
+	struct Filters
+	{
+		float32_t spectra[2][SpectrumFloats * Partitions];
+	};
+
+	/**
+	 * @brief Clear the input history and delay line. Required before first use when placed in uninitialised memory
+	 *
+	 */
+	void reset(void)
+	{
+		currentIndex = 0;
+		memset(previousAudio, 0, sizeof(previousAudio));
+		memset(delayLine, 0, sizeof(delayLine));
+	}
+
+	/**
+	 * @brief Convolve with a different set of filters from the next block on
+	 *
+	 * @param newFilters Filters computed by computeFilters()
+	 */
+	void attachFilters(const Filters *newFilters)
+	{
+		filters = newFilters;
+	}
+
+	/**
+	 * @brief Compute every partition spectrum from a weighted mix of HRIR pairs
+	 *
+	 * @param filters Filters to write to
+	 * @param blend HRIR pairs and weights
+	 */
+	static void computeFilters(Filters *filters, const hrirBlend_t *blend)
+	{
+		float32_t subfilterSpectra[SpectrumFloats];
+
+		for (size_t ear = 0; ear < 2; ear++)
+		{
+			for (size_t partition = 0; partition < Partitions; partition++)
+			{
+				Spectrum::clear(subfilterSpectra);
+
+				for (size_t j = 0; j < BlendDirections; j++)
+				{
+					if (blend->weight[j] == 0)
+					{
+						continue;
+					}
+
+					const float32_t *hrir = &hrirPair(blend->irIndex[j])[ImpulseSamples * ear + PartitionSamples * partition];
+					for (size_t k = 0; k < PartitionSamples; k++)
+					{
+						// Zero-padded on the left side
+						subfilterSpectra[2 * (k + PartitionSamples)] += blend->weight[j] * hrir[k];
+					}
+				}
+
+				dspCfft(subfilterSpectra, FFTLength, ForwardFFT);
+				Spectrum::copy(subfilterSpectra, &filters->spectra[ear][SpectrumFloats * partition]);
+			}
+		}
+	}
+
+	/**
+	 * @brief Convolve PartitionSamples of stereo audio in place
+	 *
+	 * @param leftAudio Left channel, replaced with the left ear output
+	 * @param rightAudio Right channel, replaced with the right ear output
+	 */
+	void convolve(int16_t *leftAudio, int16_t *rightAudio)
+	{
+		float32_t leftAudioData[PartitionSamples];
+		float32_t rightAudioData[PartitionSamples];
+
+		dspQ15ToFloat(leftAudio, leftAudioData, PartitionSamples);
+		dspQ15ToFloat(rightAudio, rightAudioData, PartitionSamples);
+
+		// Previous block in the first half, current block in the second half
+		for (size_t i = 0; i < PartitionSamples; i++)
+		{
+			slidingWindow[2 * i] = previousAudio[2 * i];
+			slidingWindow[2 * i + 1] = previousAudio[2 * i + 1];
+			slidingWindow[2 * (i + PartitionSamples)] = previousAudio[2 * i] = leftAudioData[i];
+			slidingWindow[2 * (i + PartitionSamples) + 1] = previousAudio[2 * i + 1] = rightAudioData[i];
+		}
+
+		dspCfft(slidingWindow, FFTLength, ForwardFFT);
+		Spectrum::copy(slidingWindow, &delayLine[SpectrumFloats * currentIndex]);
+
+		convolveEar(leftAudioData, LeftFilter);
+		convolveEar(rightAudioData, RightFilter);
+
+		currentIndex = (currentIndex + 1) % Partitions;
+
+		dspFloatToQ15(leftAudioData, leftAudio, PartitionSamples);
+		dspFloatToQ15(rightAudioData, rightAudio, PartitionSamples);
+	}
+
+private:
+	typedef Kernels<SpectrumFloats> Spectrum;
+
+	size_t currentIndex;
+	const Filters *filters;
+	float32_t previousAudio[2 * PartitionSamples];	  // Last block, stereo interleaved
+	float32_t slidingWindow[SpectrumFloats];		  // Time-domain sliding window
+	float32_t delayLine[SpectrumFloats * Partitions]; // Frequency-domain delay line
+
+	/**
+	 * @brief Accumulate every partition against the delay line and transform back
+	 *
+	 * @param channelOutput Time-domain output
+	 * @param filterID LeftFilter or RightFilter
+	 */
+	void convolveEar(float32_t *channelOutput, const uint8_t filterID)
+	{
+		float32_t cmplxAccum[SpectrumFloats];
+		Spectrum::clear(cmplxAccum);
+
+		const float32_t *filter = filters->spectra[filterID];
+		size_t shiftIndex = currentIndex;
+
+		for (size_t i = 0; i < Partitions; i++)
+		{
+			Spectrum::cmac(&delayLine[SpectrumFloats * shiftIndex], &filter[SpectrumFloats * i], cmplxAccum);
+
+			// Decrement with wraparound
+			shiftIndex = (shiftIndex + (Partitions - 1)) % Partitions;
+		}
+
+		dspCfft(cmplxAccum, FFTLength, InverseFFT);
+
+		for (size_t i = 0; i < PartitionSamples; i++)
+		{
+			channelOutput[i] = cmplxAccum[2 * i + filterID]; // Time-aliased portion isn't copied
+		}
+	}
+};
@@ -0,0 +1,334 @@
+/**
+ * @file virtualizer.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Surround-to-binaural virtualization with shared input spectra
+ * @version 0.1
+ * @date 2021-12-16
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ * @details
+ * Every channel of a 2.0 / 5.1 / 7.1 bed is played through a virtual speaker, the HRIR pair for
+ * its position. The outputs of all the speakers are summed per ear in the frequency domain.
+ *
+ * The stereo packing of upols.c is turned around. Both ears of a speaker's HRIR pair go into one
+ * complex filter (left ear real, right ear imaginary), so a real input spectrum times that filter
+ * holds both ears at once. Each channel therefore has a single delay line shared by both ears,
+ * the per-ear sums collapse into one accumulator, and one inverse FFT per block returns the left
+ * ear in the real part and the right ear in the imaginary part, whatever the channel count.
+ *
+ * Input channels are transformed two at a time, packed into the real and imaginary parts of one
+ * FFT, and separated using the conjugate symmetry of real spectra.
+ *
+ * Work per block with S speakers (the LFE is mixed into the centre speaker before the FFT):
+ *   ceil(S / 2) forward FFTs + S * VirtualPartitions CMAC passes + 1 inverse FFT
+ *
+ */
+
+#include "virtualizer.h"
+
+_Static_assert((size_t)VirtualSpeakerTaps <= (size_t)ImpulseSamples, "Virtual speakers can't use more taps than irTable holds");
+
+enum BedChannel
+{
+	BedCentre = 2, // Same position in every layout with a centre
+	NoLfe = -1
+};
+
+typedef struct bedLayoutInfo_t
+{
+	uint8_t channelCount;
+	int8_t lfeChannel;				   // Mixed into the centre speaker, NoLfe if there isn't one
+	float32_t azimuth[MaxBedChannels]; // Degrees, counter-clockwise from the front like the HRIR tables
+} bedLayoutInfo_t;
+
+// Channel order follows WAVE_FORMAT_EXTENSIBLE, positions follow ITU-R BS.775 and BS.2051
+static const bedLayoutInfo_t bedLayouts[BedLayoutCount] = {
+	[BedStereo] = {2, NoLfe, {30.0f, -30.0f}},
+	[Bed51] = {6, 3, {30.0f, -30.0f, 0.0f, 0.0f, 110.0f, -110.0f}},
+	[Bed71] = {8, 3, {30.0f, -30.0f, 0.0f, 0.0f, 150.0f, -150.0f, 90.0f, -90.0f}},
+};
+
+/**
+ * @brief Number of input channels in a bed layout
+ *
+ */
+uint8_t bedChannelCount(const bedLayout_t layout)
+{
+	return bedLayouts[layout].channelCount;
+}
+
+/**
+ * @brief Set up a virtualizer in storage provided by the caller and place its speakers facing forward
+ *
+ * @param virtualizer Virtualizer to initialize
+ * @param layout Channel layout of the bed
+ */
+void virtualizerInit(virtualizer_t *virtualizer, const bedLayout_t layout)
+{
+	memset(virtualizer, 0, sizeof(*virtualizer));
+	virtualizerSetLayout(virtualizer, layout, 0.0f, 0.0f);
+}
+
+/**
+ * @brief Allocate a virtualizer
+ *
+ * @param layout Channel layout of the bed
+ * @return New virtualizer, or NULL if there isn't enough memory
+ */
+virtualizer_t *virtualizerCreate(const bedLayout_t layout)
+{
+	virtualizer_t *virtualizer = malloc(sizeof(virtualizer_t));
+	if (virtualizer)
+	{
+		virtualizerInit(virtualizer, layout);
+	}
+	return virtualizer;
+}
+
+/**
+ * @brief Clear the input history and delay lines, keeping the speaker filters
+ *
+ * @param virtualizer Virtualizer to reset
+ */
+void virtualizerReset(virtualizer_t *virtualizer)
+{
+	virtualizer->currentIndex = 0;
+	memset(virtualizer->previousAudio, 0, sizeof(virtualizer->previousAudio));
+	memset(virtualizer->delayLine, 0, sizeof(virtualizer->delayLine));
+}
+
+/**
+ * @brief Free a virtualizer from virtualizerCreate()
+ *
+ * @param virtualizer Virtualizer to free, may be NULL
+ */
+void virtualizerDestroy(virtualizer_t *virtualizer)
+{
+	free(virtualizer);
+}
+
+/**
+ * @brief Rotate a speaker direction so that the front of the bed faces (azimuth, elevation)
+ *
+ * @param speakerAzimuth Speaker azimuth in the bed, replaced with the rotated azimuth
+ * @param elevation Elevation of the front of the bed, replaced with the rotated speaker elevation
+ * @param azimuth Azimuth of the front of the bed
+ */
+static void rotateSpeaker(float32_t *speakerAzimuth, float32_t *elevation, const float32_t azimuth)
+{
+	const float32_t degToRad = (float32_t)M_PI / 180.0f;
+	const float32_t pitch = *elevation * degToRad;
+	const float32_t yaw = azimuth * degToRad;
+
+	// Speakers sit on the horizontal plane of the bed: tilt the front up by pitch, then turn by yaw
+	const float32_t x = cosf(*speakerAzimuth * degToRad) * cosf(pitch);
+	const float32_t y = sinf(*speakerAzimuth * degToRad);
+	const float32_t z = cosf(*speakerAzimuth * degToRad) * sinf(pitch);
+
+	*speakerAzimuth = atan2f(x * sinf(yaw) + y * cosf(yaw), x * cosf(yaw) - y * sinf(yaw)) / degToRad;
+	*elevation = asinf((z > 1.0f) ? 1.0f : ((z < -1.0f) ? -1.0f : z)) / degToRad;
+}
+
+/**
+ * @brief Switch bed layout and compute every speaker filter, with the front of the bed facing (azimuth, elevation).
+ * Blocks for VirtualPartitions FFTs per speaker, only use while the audio path is idle
+ *
+ * @param virtualizer Virtualizer to update
+ * @param layout Channel layout of the bed
+ * @param azimuth Degrees, direction of the centre speaker
+ * @param elevation Degrees, tilt of the bed
+ */
+void virtualizerSetLayout(virtualizer_t *virtualizer, const bedLayout_t layout, float32_t azimuth, float32_t elevation)
+{
+	const bedLayoutInfo_t *info = &bedLayouts[layout];
+
+	virtualizer->layout = layout;
+	virtualizer->channelCount = info->channelCount;
+	virtualizer->speakerCount = 0;
+
+	for (size_t channel = 0; channel < info->channelCount; channel++)
+	{
+		if ((int8_t)channel != info->lfeChannel)
+		{
+			virtualizer->speakerOf[channel] = virtualizer->speakerCount++;
+		}
+	}
+
+	if (info->lfeChannel != NoLfe)
+	{
+		virtualizer->speakerOf[info->lfeChannel] = virtualizer->speakerOf[BedCentre];
+	}
+
+	// Uncorrelated channels add in power, keep the sum around the level of a single speaker
+	virtualizer->speakerGain = 1.0f / sqrtf((float32_t)virtualizer->speakerCount);
+
+	for (size_t channel = 0; channel < info->channelCount; channel++)
+	{
+		if ((int8_t)channel == info->lfeChannel)
+		{
+			continue;
+		}
+
+		float32_t speakerAzimuth = info->azimuth[channel];
+		float32_t speakerElevation = elevation;
+		rotateSpeaker(&speakerAzimuth, &speakerElevation, azimuth);
+
+		hrirBlend_t blend;
+		hrirLookup(speakerAzimuth, speakerElevation, &blend);
+		virtualizerSetSpeaker(virtualizer, virtualizer->speakerOf[channel], &blend);
+	}
+
+	virtualizerReset(virtualizer);
+}
+
+/**
+ * @brief Compute the packed filter of one speaker from a weighted mix of HRIR pairs
+ *
+ * @param virtualizer Virtualizer to update
+ * @param speaker Speaker index
+ * @param blend HRIR pairs and weights
+ */
+void virtualizerSetSpeaker(virtualizer_t *virtualizer, const uint8_t speaker, const hrirBlend_t *blend)
+{
+	float32_t subfilterSpectra[512];
+
+	for (size_t partition = 0; partition < VirtualPartitions; partition++)
+	{
+		clear512(subfilterSpectra);
+
+		for (size_t j = 0; j < BlendDirections; j++)
+		{
+			const float32_t weight = blend->weight[j] * virtualizer->speakerGain;
+			if (weight == 0)
+			{
+				continue;
+			}
+
+			const float32_t *hrir = &hrirPair(blend->irIndex[j])[PartitionSize * partition];
+			for (size_t k = 0; k < PartitionSize; k++)
+			{
+				// Zero-padded on the left side, left ear real and right ear imaginary
+				subfilterSpectra[2 * k + 256] += weight * hrir[k];
+				subfilterSpectra[2 * k + 257] += weight * hrir[ImpulseSamples + k];
+			}
+		}
+
+		dspCfft(subfilterSpectra, 256, ForwardFFT);
+		cp512(subfilterSpectra, &virtualizer->filters[speaker][512 * partition]);
+	}
+}
+
+/**
+ * @brief Separate the spectra of two real signals transformed together as the real and imaginary parts of one FFT
+ *
+ * @param packed Spectrum of a + jb
+ * @param spectrumA Spectrum of a
+ * @param spectrumB Spectrum of b
+ */
+static void splitSpectra(const float32_t *packed, float32_t *spectrumA, float32_t *spectrumB)
+{
+	for (size_t k = 0; k < 256; k++)
+	{
+		const size_t mirror = (256 - k) & 255;
+		const float32_t re = packed[2 * k];
+		const float32_t im = packed[2 * k + 1];
+		const float32_t mirrorRe = packed[2 * mirror];
+		const float32_t mirrorIm = packed[2 * mirror + 1];
+
+		// A = (Z[k] + conj(Z[-k])) / 2, B = (Z[k] - conj(Z[-k])) / 2j
+		spectrumA[2 * k] = 0.5f * (re + mirrorRe);
+		spectrumA[2 * k + 1] = 0.5f * (im - mirrorIm);
+		spectrumB[2 * k] = 0.5f * (im + mirrorIm);
+		spectrumB[2 * k + 1] = 0.5f * (mirrorRe - re);
+	}
+}
+
+/**
+ * @brief Render a block of the bed to both ears
+ *
+ * @param virtualizer Virtualizer
+ * @param bedAudio One block per input channel, in layout order. NULL channels are silent
+ * @param leftAudio Left ear output
+ * @param rightAudio Right ear output
+ */
+void virtualizerProcess(virtualizer_t *virtualizer, const int16_t *const *bedAudio, int16_t *leftAudio, int16_t *rightAudio)
+{
+	float32_t speakerAudio[MaxVirtualSpeakers][PartitionSize];
+	float32_t channelAudio[PartitionSize];
+	const size_t speakerCount = virtualizer->speakerCount;
+
+	memset(speakerAudio, 0, sizeof(speakerAudio[0]) * speakerCount);
+	for (size_t channel = 0; channel < virtualizer->channelCount; channel++)
+	{
+		if (bedAudio[channel])
+		{
+			dspQ15ToFloat(bedAudio[channel], channelAudio, PartitionSize);
+			float32_t *speaker = speakerAudio[virtualizer->speakerOf[channel]];
+			for (size_t i = 0; i < PartitionSize; i++)
+			{
+				speaker[i] += channelAudio[i];
+			}
+		}
+	}
+
+	// Two speakers per forward FFT, the last one alone when there's an odd number
+	for (size_t speaker = 0; speaker < speakerCount; speaker += 2)
+	{
+		float32_t slidingWindow[512];
+		const bool paired = (speaker + 1) < speakerCount;
+		float32_t *previousA = virtualizer->previousAudio[speaker];
+		float32_t *previousB = virtualizer->previousAudio[speaker + paired];
+
+		for (size_t i = 0; i < PartitionSize; i++)
+		{
+			slidingWindow[2 * i] = previousA[i];
+			slidingWindow[2 * i + 1] = paired ? previousB[i] : 0.0f;
+			slidingWindow[2 * i + 256] = previousA[i] = speakerAudio[speaker][i];
+			slidingWindow[2 * i + 257] = paired ? (previousB[i] = speakerAudio[speaker + 1][i]) : 0.0f;
+		}
+
+		dspCfft(slidingWindow, 256, ForwardFFT);
+
+		float32_t *spectrumA = &virtualizer->delayLine[speaker][512 * virtualizer->currentIndex];
+		if (paired)
+		{
+			splitSpectra(slidingWindow, spectrumA, &virtualizer->delayLine[speaker + 1][512 * virtualizer->currentIndex]);
+		}
+		else
+		{
+			cp512(slidingWindow, spectrumA);
+		}
+	}
+
+	// Both ears of every speaker accumulate into one spectrum
+	float32_t cmplxAccum[512];
+	clear512(cmplxAccum);
+
+	for (size_t speaker = 0; speaker < speakerCount; speaker++)
+	{
+		int16_t shiftIndex = virtualizer->currentIndex;
+		for (size_t i = 0; i < VirtualPartitions; i++)
+		{
+			cmac512(&virtualizer->delayLine[speaker][512 * shiftIndex], &virtualizer->filters[speaker][512 * i], cmplxAccum);
+
+			// Decrement with wraparound
+			shiftIndex = (shiftIndex + (VirtualPartitions - 1)) % VirtualPartitions;
+		}
+	}
+
+	dspCfft(cmplxAccum, 256, InverseFFT);
+
+	float32_t leftAudioData[PartitionSize];
+	float32_t rightAudioData[PartitionSize];
+	for (size_t i = 0; i < PartitionSize; i++)
+	{
+		leftAudioData[i] = cmplxAccum[2 * i]; // Time-aliased portion isn't copied
+		rightAudioData[i] = cmplxAccum[2 * i + 1];
+	}
+
+	virtualizer->currentIndex = (virtualizer->currentIndex + 1) % VirtualPartitions;
+
+	dspFloatToQ15(leftAudioData, leftAudio, PartitionSize);
+	dspFloatToQ15(rightAudioData, rightAudio, PartitionSize);
+}
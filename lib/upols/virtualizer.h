@@ -0,0 +1,69 @@
+/**
+ * @file virtualizer.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Surround-to-binaural virtualization with shared input spectra
+ * @version 0.1
+ * @date 2021-12-16
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ */
+
+#pragma once
+
+#include "upols.h"
+#include "interpolation.h"
+
+// 128-sample partitions of each virtual speaker's HRIR pair. Memory grows with speakers * partitions
+#ifndef UPOLS_VIRTUAL_PARTITIONS
+#if UPOLS_PARTITION_COUNT < 8
+#define UPOLS_VIRTUAL_PARTITIONS UPOLS_PARTITION_COUNT
+#else
+#define UPOLS_VIRTUAL_PARTITIONS 8
+#endif
+#endif
+
+enum VirtualizerLengths
+{
+	VirtualPartitions = UPOLS_VIRTUAL_PARTITIONS,
+	VirtualSpeakerTaps = PartitionSize * VirtualPartitions,
+	MaxBedChannels = 8,						 // 7.1
+	MaxVirtualSpeakers = MaxBedChannels - 1 // LFE is rendered through the centre speaker
+};
+
+typedef enum bedLayout_t
+{
+	BedStereo, // L, R
+	Bed51,	   // L, R, C, LFE, Ls, Rs
+	Bed71,	   // L, R, C, LFE, Lb, Rb, Ls, Rs
+	BedLayoutCount
+} bedLayout_t;
+
+typedef struct virtualizer_t
+{
+	bedLayout_t layout;
+	uint8_t channelCount;						  // Input channels in the bed
+	uint8_t speakerCount;						  // Input channels with their own HRIR pair
+	uint8_t speakerOf[MaxBedChannels];			  // Speaker each input channel is mixed into
+	float32_t speakerGain;						  // Headroom for summing the speakers, folded into the filters
+	int16_t currentIndex;						  // Current partition index
+	float32_t previousAudio[MaxVirtualSpeakers][PartitionSize];
+	float32_t delayLine[MaxVirtualSpeakers][512 * VirtualPartitions]; // Input spectra, shared by both ears
+	float32_t filters[MaxVirtualSpeakers][512 * VirtualPartitions];	  // Left ear HRIR in the real part, right ear in the imaginary part
+} virtualizer_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+	uint8_t bedChannelCount(const bedLayout_t layout);
+	virtualizer_t *virtualizerCreate(const bedLayout_t layout);
+	void virtualizerInit(virtualizer_t *virtualizer, const bedLayout_t layout);
+	void virtualizerReset(virtualizer_t *virtualizer);
+	void virtualizerDestroy(virtualizer_t *virtualizer);
+	void virtualizerSetLayout(virtualizer_t *virtualizer, const bedLayout_t layout, float32_t azimuth, float32_t elevation);
+	void virtualizerSetSpeaker(virtualizer_t *virtualizer, const uint8_t speaker, const hrirBlend_t *blend);
+	void virtualizerProcess(virtualizer_t *virtualizer, const int16_t *const *bedAudio, int16_t *leftAudio, int16_t *rightAudio);
+#ifdef __cplusplus
+}
+#endif
@@ -48,7 +48,21 @@ void Ash::init(void)
 
 	newCmd("pttoggle", "Toggle audio passthrough", audioPassthrough);
 	newCmd("status", "Get status of the D3", currentStatus);
-	newCmd("sangle", "Set HRIR angle", setAngle);
+#if defined(UPOLS_NONUNIFORM) || defined(UPOLS_TEMPLATE_ENGINE)
+	newCmd("sangle", "Set HRIR angle, muting while the filters are recomputed: sangle <azimuth> [elevation]", setAngle);
+#else
+	newCmd("sangle", "Set HRIR angle: sangle <azimuth> [elevation]", setAngle);
+#endif
+#if defined(UPOLS_VIRTUALIZER)
+	newCmd("layout", "Set virtual speaker layout: layout <2.0|5.1|7.1>", setLayout);
+#endif
+#if defined(CONVOLVIR_UPOLS) && (defined(UPOLS_PARTITION_PRUNING) || defined(UPOLS_BAND_PRUNING))
+	newCmd("pruning", "Show filter partitions and bins skipped at the current angle", pruning);
+#endif
+#if defined(UPOLS_DEFERRED_DSP)
+	newCmd("sched", "Show worst-case interrupt latencies and deadline misses of the DSP task", scheduler);
+#endif
+	newCmd("txring", "Show or tune the S/PDIF block queue: txring [depth <blocks>|reset]", transmitRing);
 	newCmd("audiomemory", "View current and maximum audio memory", audioMemory);
 	newCmd("reboot", "Reboot Auricle", reboot);
 	newCmd("clear", "Clear screen", clear);
@@ -102,9 +116,10 @@ void Ash::setAngle(void *)
 	char *cmdArg = NULL;
 	if (getArg(&cmdArg))
 	{
-		uint16_t angle = (uint16_t)(atoi(cmdArg));
-		printf("Setting angle: %d degrees\n", angle);
-		convolvIR.convertIR((uint16_t)__builtin_round((float32_t)(angle) / 3.6));
+		float32_t azimuth = strtof(cmdArg, NULL);
+		float32_t elevation = getArg(&cmdArg) ? strtof(cmdArg, NULL) : 0.0f; // Elevation is optional
+		printf("Setting angle: %.1f degrees azimuth, %.1f degrees elevation\n", azimuth, elevation);
+		convolvIR.setDirection(azimuth, elevation);
 		printf("Done\n");
 	}
 	else
@@ -113,9 +128,126 @@ void Ash::setAngle(void *)
 	}
 }
 
+#if defined(UPOLS_VIRTUALIZER)
+void Ash::setLayout(void *)
+{
+	const char *layouts[BedLayoutCount] = {"2.0", "5.1", "7.1"};
+
+	char *cmdArg = NULL;
+	if (getArg(&cmdArg))
+	{
+		for (size_t i = 0; i < BedLayoutCount; i++)
+		{
+			if (strncmp(cmdArg, layouts[i], 4) == 0)
+			{
+				printf("Setting layout: %s\n", layouts[i]);
+				convolvIR.setLayout((bedLayout_t)i);
+				printf("Done\n");
+				return;
+			}
+		}
+		printf("Unknown layout: %s\n", cmdArg);
+	}
+	else
+	{
+		printf("Error: incorrect syntax\n");
+	}
+}
+#endif
+
+#if defined(CONVOLVIR_UPOLS) && (defined(UPOLS_PARTITION_PRUNING) || defined(UPOLS_BAND_PRUNING))
+void Ash::pruning(void *)
+{
+	const uint32_t fullBins = PartitionCount * HalfSpectrumBins;
+	const char *ears[2] = {"Left", "Right"};
+	uint32_t bins = 0;
+	for (size_t ear = 0; ear < 2; ear++)
+	{
+		const uint16_t partitions = convolvIR.partitionsInUse(ear);
+		const uint32_t earBins = convolvIR.binsInUse(ear);
+		printf("%s: %u of %u partitions active, %u skipped, %lu of %lu bins multiplied\n", ears[ear], partitions, PartitionCount,
+			   PartitionCount - partitions, earBins, fullBins);
+		bins += earBins;
+	}
+	printf("CMAC work saved: %.1f%%\n", 100.0f * (1.0f - (float32_t)bins / (2 * fullBins)));
+}
+#endif
+
+#if defined(UPOLS_DEFERRED_DSP)
+void Ash::scheduler(void *)
+{
+	const dspSched_t *sched = convolvIR.scheduler();
+	const float32_t cyclesPerMicrosecond = F_CPU_ACTUAL / 1000000.0f;
+	const float32_t period = sched->period / cyclesPerMicrosecond;
+	const float32_t completion = sched->completion / cyclesPerMicrosecond;
+
+	printf("Block period: %.1f us\n", period);
+	printf("Worst DMA interrupt entry latency: %.1f us, in whole frames of 22.7 us\n", sched->eventLatency / cyclesPerMicrosecond);
+	printf("Worst audio update latency: %.2f us\n", sched->updateLatency / cyclesPerMicrosecond);
+	printf("Worst DSP task start: %.1f us\n", sched->dspLatency / cyclesPerMicrosecond);
+	printf("Worst DSP task completion: %.1f us, %.0f%% of the period\n", completion, 100.0f * completion / period);
+	printf("Deadline misses: %lu of %lu blocks\n", sched->deadlineMisses, sched->events);
+	printf("Blocks dropped with the DSP task behind: %lu\n", sched->overruns);
+	printf("Blocks queued: %lu\n", dspQueueCount(&sched->pending));
+}
+#endif
+
+void Ash::transmitRing(void *)
+{
+	char *cmdArg = NULL;
+	if (getArg(&cmdArg))
+	{
+		if (strncmp(cmdArg, "depth", 8) == 0)
+		{
+			if (getArg(&cmdArg))
+			{
+				char *end = NULL;
+				const unsigned long depth = strtoul(cmdArg, &end, 10);
+				if ((end == cmdArg) || (*end != '\0') || (depth < 1) || (depth > BlockRingSlots))
+				{
+					printf("Error: depth must be a number of blocks from 1 to %u\n", BlockRingSlots);
+				}
+				else
+				{
+					SpdifTx::setRingDepth(depth);
+					printf("Depth set to %lu stereo blocks\n", SpdifTx::ring()->depth);
+				}
+			}
+			else
+			{
+				printf("Error: incorrect syntax\n");
+			}
+		}
+		else if (strncmp(cmdArg, "reset", 8) == 0)
+		{
+			SpdifTx::clearRingStats();
+			printf("Counters cleared\n");
+		}
+		else
+		{
+			printf("Unknown option: %s\n", cmdArg);
+		}
+		return;
+	}
+
+	const blockRing_t *ring = SpdifTx::ring();
+	printf("Depth: %lu of %u stereo blocks\n", ring->depth, BlockRingSlots);
+	printf("Queue: %lu queued, high-water %lu, %lu overruns\n", blockRingCount(ring), ring->highWater, ring->overruns);
+	printf("Underruns: %lu silent periods in %lu dropouts\n", ring->underruns, ring->dropouts);
+	printf("Dropped without a pair: left %lu, right %lu\n", SpdifTx::unpairedBlocks(leftChannel),
+		   SpdifTx::unpairedBlocks(rightChannel));
+#if defined(UPOLS_DIRECT_OUTPUT)
+	const txRing_t *direct = SpdifTx::directRing();
+	printf("Direct output: %lu underruns, %lu late, %lu overruns\n", direct->underruns, direct->lateHalves, direct->overruns);
+#endif
+}
+
 void Ash::currentStatus(void *)
 {
 	d3currentStatus();
+#if defined(CONVOLVIR_UPOLS) && defined(UPOLS_SILENCE_BYPASS)
+	printf("Convolver: %s\n", convolvIR.bypassing() ? "bypassed, input is silent" : "running");
+#endif
 }
 
 void Ash::lscmds(void *)
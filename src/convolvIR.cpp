@@ -9,38 +9,434 @@
  * 
  */
 
+#include <assert.h>
 #include "convolvIR.h"
+#if defined(UPOLS_FLOAT_OUTPUT) || defined(UPOLS_DIRECT_OUTPUT) || defined(UPOLS_DEFERRED_DSP)
+#include "spdifTx.h"
+#endif
 
 // #pragma GCC optimize ("O1")
 
+#if defined(UPOLS_DEFERRED_DSP)
+ConvolvIR *ConvolvIR::firstDeferred = nullptr;
+#endif
+
+#if defined(CONVOLVIR_UPOLS)
+// Filter banks of the default instance
+static filters_t primaryFilters;
+_section_ocram static filters_t secondaryFilters; // Both banks don't fit in DTCM
+#elif defined(UPOLS_NONUNIFORM)
+// Memory pools of the one non-uniform instance
+static float32_t nupolsFastMemory[NupolsFastFloats];
+_section_ocram static float32_t nupolsSlowMemory[NupolsSlowFloats];
+#elif defined(UPOLS_TEMPLATE_ENGINE)
+// Filters of the one template engine instance
+static TemplateEngine::Filters templateFilters;
+#endif
+
+#if defined(CONVOLVIR_UPOLS) || defined(UPOLS_NONUNIFORM) || defined(UPOLS_TEMPLATE_ENGINE)
+// Instances using the storage above. A second one would silently convolve with the first one's filters
+static uint8_t defaultStorageUsers = 0;
+#endif
+
+/**
+ * @brief Construct a new ConvolvIR::ConvolvIR object using the default filter banks
+ * 
+ */
+ConvolvIR::ConvolvIR(void)
+#if defined(CONVOLVIR_UPOLS)
+	: ConvolvIR(&primaryFilters, &secondaryFilters)
+#else
+	: ConvolvIR(nullptr, nullptr)
+#endif
+{
+}
+
 /**
- * @brief Construct a new ConvolvIR::ConvolvIR object
+ * @brief Construct a new ConvolvIR::ConvolvIR object with its own filter banks, so several can run in one audio graph
  * 
+ * @param primaryBank Filter bank for the UPOLS engine, 257 KB
+ * @param secondaryBank Filter bank that HRIR swaps are prepared into, 257 KB
  */
-ConvolvIR::ConvolvIR(void) : AudioStream(2, inputQueueArray)
+ConvolvIR::ConvolvIR(filters_t *primaryBank, filters_t *secondaryBank) : AudioStream(ConvolvIRInputCount, inputQueueArray)
 {
-	_section_dma static audio_block_t allocatedAudioMemory[16];
-	initialize_memory(allocatedAudioMemory, 16);
+	_section_dma static audio_block_t allocatedAudioMemory[ConvolvIRAudioBlocks];
+	static bool memoryInitialized = false;
+	if (!memoryInitialized)
+	{
+		initialize_memory(allocatedAudioMemory, ConvolvIRAudioBlocks);
+		memoryInitialized = true;
+	}
 	audioPassthrough = true;
 	pinMode(33, 1);
+
+#if defined(CONVOLVIR_UPOLS)
+	if ((primaryBank == &primaryFilters) || (secondaryBank == &secondaryFilters))
+	{
+		defaultStorageUsers++;
+		assert((defaultStorageUsers == 1) && "Only one ConvolvIR can use the default filter banks, pass each other instance its own");
+	}
+	upolsInit(&upols, primaryBank, secondaryBank);
+#else
+	// Only the UPOLS engine takes its filter banks from the caller
+	(void)primaryBank;
+	(void)secondaryBank;
+#if defined(UPOLS_NONUNIFORM) || defined(UPOLS_TEMPLATE_ENGINE)
+	defaultStorageUsers++;
+	assert((defaultStorageUsers == 1) && "The non-uniform and template engines support a single ConvolvIR instance");
+#endif
+#endif
+
+#if defined(UPOLS_DEFERRED_DSP)
+	dspSchedInit(&sched, SpdifTx::periodCycles());
+
+	// Appended, so the DSP task serves instances in the order their updates run
+	nextDeferred = nullptr;
+	ConvolvIR **link = &firstDeferred;
+	while (*link)
+	{
+		link = &(*link)->nextDeferred;
+	}
+	*link = this;
+
+	static bool dspTaskAttached = false;
+	if (!dspTaskAttached)
+	{
+		attachInterruptVector(CONVOLVIR_DSP_IRQ, dspTask);
+		NVIC_SET_PRIORITY(CONVOLVIR_DSP_IRQ, CONVOLVIR_DSP_PRIORITY);
+		NVIC_ENABLE_IRQ(CONVOLVIR_DSP_IRQ);
+		dspTaskAttached = true;
+	}
+#endif
+
+#if defined(UPOLS_NONUNIFORM)
+	nupolsInit(&nupols, nupolsFastMemory, nupolsSlowMemory);
+#elif defined(UPOLS_TEMPLATE_ENGINE)
+	templateEngine.reset();
+	templateEngine.attachFilters(&templateFilters);
+#elif defined(UPOLS_VIRTUALIZER)
+	bedAzimuth = 0;
+	bedElevation = 0;
+	virtualizerInit(&virtualizer, UPOLS_VIRTUAL_LAYOUT);
+#endif
 }
 
-void ConvolvIR::convertIR(uint16_t irIndex)
+#if defined(UPOLS_VIRTUALIZER)
+/**
+ * @brief Switch the bed layout of the virtual speakers. Mutes while the speaker filters are recomputed
+ * 
+ * @param layout BedStereo, Bed51 or Bed71
+ */
+void ConvolvIR::setLayout(bedLayout_t layout)
 {
 	audioMute = true;
 	digitalWriteFast(33, 1);
-	processFilters(irIndex);
+	virtualizerSetLayout(&virtualizer, layout, bedAzimuth, bedElevation);
 	digitalWriteFast(33, 0);
 	audioMute = false;
 	audioPassthrough = false;
 }
 
+/**
+ * @brief Turn the virtual speakers so the front of the bed faces a direction
+ * 
+ * @param azimuth Degrees
+ * @param elevation Degrees
+ */
+void ConvolvIR::setDirection(float32_t azimuth, float32_t elevation)
+{
+	bedAzimuth = azimuth;
+	bedElevation = elevation;
+	setLayout(virtualizer.layout);
+}
+#else
+
+/**
+ * @brief Switch to a new mix of HRIR pairs. The uniform engine, hybrid or not, prepares it in the background and crossfades. The
+ * non-uniform and template engines keep a single set of filters, so they mute while they recompute
+ * 
+ * @param blend HRIR pairs and weights
+ */
+void ConvolvIR::applyBlend(const hrirBlend_t *blend)
+{
+#if defined(UPOLS_NONUNIFORM) || defined(UPOLS_TEMPLATE_ENGINE)
+	audioMute = true;
+	digitalWriteFast(33, 1);
+#if defined(UPOLS_NONUNIFORM)
+	nupolsProcessBlend(&nupols, blend);
+#else
+	TemplateEngine::computeFilters(&templateFilters, blend);
+#endif
+	digitalWriteFast(33, 0);
+	audioMute = false;
+#else
+	upolsRequestBlend(&upols, blend);
+#endif
+	audioPassthrough = false;
+}
+
+/**
+ * @brief Switch to a new HRIR pair
+ * 
+ * @param irIndex Index of the HRIR pair
+ */
+void ConvolvIR::convertIR(uint16_t irIndex)
+{
+	const hrirBlend_t blend = hrirBlendSingle(irIndex);
+	applyBlend(&blend);
+}
+
+/**
+ * @brief Move the source to any direction, interpolating between the surrounding HRIR pairs. The uniform engine can take a new direction every block
+ * 
+ * @param azimuth Degrees
+ * @param elevation Degrees
+ */
+void ConvolvIR::setDirection(float32_t azimuth, float32_t elevation)
+{
+	hrirBlend_t blend;
+#if defined(UPOLS_STEREO_MATRIX)
+	stereoLookup(azimuth, elevation, &blend);
+#else
+	hrirLookup(azimuth, elevation, &blend);
+#endif
+	applyBlend(&blend);
+#if defined(UPOLS_ROOM)
+	// Queued after the HRIR request, so the room waits for the crossfade to this direction rather than the one before it
+	roomSetSource(&upols.room, azimuth, elevation);
+#endif
+}
+#endif
+
+#if defined(CONVOLVIR_UPOLS)
+/**
+ * @brief Number of filter partitions the convolver multiplies for one ear, fewer than PartitionCount when pruned
+ * 
+ * @param ear LeftFilter or RightFilter
+ */
+uint16_t ConvolvIR::partitionsInUse(size_t ear)
+{
+	return upolsActivePartitions(&upols, ear);
+}
+
+/**
+ * @brief Number of filter bins the convolver multiplies for one ear per block, out of PartitionCount * HalfSpectrumBins
+ * 
+ * @param ear LeftFilter or RightFilter
+ */
+uint32_t ConvolvIR::binsInUse(size_t ear)
+{
+	return upolsActiveBins(&upols, ear);
+}
+
+/**
+ * @brief Whether the convolver is skipping its work because the input and the tail are silent
+ * 
+ */
+bool ConvolvIR::bypassing(void)
+{
+	return upolsBypassing(&upols);
+}
+#endif
+
+#if defined(UPOLS_DEFERRED_DSP)
+/**
+ * @brief Worst latencies, deadline misses and overruns of the DSP task, in CPU cycles
+ * 
+ */
+const dspSched_t *ConvolvIR::scheduler(void)
+{
+	return &sched;
+}
+#endif
+
 bool ConvolvIR::togglePassthrough(void)
 {
 	audioPassthrough = !audioPassthrough;
 	return audioPassthrough;
 }
 
+#if !defined(UPOLS_VIRTUALIZER)
+/**
+ * @brief Send a block on untouched
+ * 
+ * @param leftAudio 
+ * @param rightAudio 
+ */
+void ConvolvIR::transmitPassthrough(audio_block_t *leftAudio, audio_block_t *rightAudio)
+{
+#if defined(UPOLS_FLOAT_OUTPUT)
+	audio_block_f32_t *output = SpdifTx::allocateFloat();
+	dspQ15ToFloat(leftAudio->data, output->data[LeftChannel], AUDIO_BLOCK_SAMPLES);
+	dspQ15ToFloat(rightAudio->data, output->data[RightChannel], AUDIO_BLOCK_SAMPLES);
+	SpdifTx::transmitFloat(output);
+#elif defined(UPOLS_DIRECT_OUTPUT)
+	SpdifTx::transmitDirect(leftAudio->data, rightAudio->data);
+#else
+	transmit(leftAudio, LeftChannel);
+	transmit(rightAudio, RightChannel);
+#endif
+}
+#endif
+
+#if defined(UPOLS_DEFERRED_DSP)
+/**
+ * @brief Updates every 128 samples / 2.9 ms. Only moves blocks: the previous block's output is transmitted and this block is
+ * queued for dspTask(), so q15 output leaves one block later than it would without UPOLS_DEFERRED_DSP
+ * 
+ */
+void ConvolvIR::update(void)
+{
+	dspSchedEvent(&sched, SpdifTx::eventTimestamp(), SpdifTx::eventLatency());
+
+#if !defined(UPOLS_FLOAT_OUTPUT) && !defined(UPOLS_DIRECT_OUTPUT)
+	// A late job leaves two blocks finished. Only the newest is sent, so the output doesn't stay a block further behind
+	dspJob_t finished;
+	dspJob_t newest = {nullptr, nullptr, 0, 0};
+	while (dspQueuePop(&sched.finished, &finished))
+	{
+		if (newest.left)
+		{
+			release((audio_block_t *)newest.left);
+			release((audio_block_t *)newest.right);
+		}
+		newest = finished;
+	}
+	if (newest.left)
+	{
+		transmit((audio_block_t *)newest.left, LeftChannel);
+		transmit((audio_block_t *)newest.right, RightChannel);
+		release((audio_block_t *)newest.left);
+		release((audio_block_t *)newest.right);
+	}
+#endif
+
+	audio_block_t *leftAudio = receiveWritable(LeftChannel);
+	audio_block_t *rightAudio = receiveWritable(RightChannel);
+
+	if (leftAudio && rightAudio)
+	{
+		// Passthrough blocks are queued as well: sent from here, they could preempt the DSP task while it holds output from
+		// SpdifTx and be handed the same block
+		dspJob_t job = {leftAudio, rightAudio, 0, audioPassthrough ? PassthroughJob : 0u};
+		if (dspSchedSubmit(&sched, &job, ARM_DWT_CYCCNT))
+		{
+			NVIC_SET_PENDING(CONVOLVIR_DSP_IRQ);
+			return;
+		}
+		// The DSP task is DspQueueSlots blocks behind, this one is dropped
+		release(leftAudio);
+		release(rightAudio);
+	}
+}
+
+/**
+ * @brief Works through the blocks queued by every instance's update(). Runs at CONVOLVIR_DSP_PRIORITY with interrupts enabled,
+ * so USB, the DMA and the audio updates all preempt it
+ * 
+ */
+void ConvolvIR::dspTask(void)
+{
+	for (ConvolvIR *instance = firstDeferred; instance; instance = instance->nextDeferred)
+	{
+		dspJob_t job;
+		while (dspQueuePop(&instance->sched.pending, &job))
+		{
+			instance->processJob(&job);
+		}
+	}
+}
+
+/**
+ * @brief Convolve or pass on one queued block. Float and direct output go straight to SpdifTx, q15 output is handed back to
+ * update()
+ * 
+ * @param job Blocks from update()
+ */
+void ConvolvIR::processJob(const dspJob_t *job)
+{
+	audio_block_t *leftAudio = (audio_block_t *)job->left;
+	audio_block_t *rightAudio = (audio_block_t *)job->right;
+	const bool passthrough = job->flags & PassthroughJob;
+
+	dspSchedStart(&sched, job, ARM_DWT_CYCCNT);
+
+	if (passthrough)
+	{
+#if defined(UPOLS_FLOAT_OUTPUT) || defined(UPOLS_DIRECT_OUTPUT)
+		// Only this task takes output from SpdifTx, so it can't be handed a block that is still being filled
+		transmitPassthrough(leftAudio, rightAudio);
+#endif
+	}
+	else
+	{
+		convolveJob(leftAudio, rightAudio);
+	}
+	dspSchedFinish(&sched, job, ARM_DWT_CYCCNT);
+
+#if defined(UPOLS_FLOAT_OUTPUT) || defined(UPOLS_DIRECT_OUTPUT)
+	release(leftAudio);
+	release(rightAudio);
+#else
+	// Output is in the input blocks, the next update() transmits them
+	if (!dspQueuePush(&sched.finished, job))
+	{
+		release(leftAudio);
+		release(rightAudio);
+	}
+#endif
+
+#if defined(UPOLS_HYBRID)
+	// Output is already on its way, get the tail ready for the next block
+	if (!passthrough)
+	{
+		upolsProcessTail(&upols);
+	}
+#endif
+}
+
+/**
+ * @brief Convolve a block for processJob() and send float and direct output on to SpdifTx
+ * 
+ * @param leftAudio Left channel, replaced with the left ear output for q15 output
+ * @param rightAudio Right channel, replaced with the right ear output for q15 output
+ */
+void ConvolvIR::convolveJob(audio_block_t *leftAudio, audio_block_t *rightAudio)
+{
+#if defined(UPOLS_FLOAT_OUTPUT)
+	audio_block_f32_t *output = SpdifTx::allocateFloat();
+#elif defined(UPOLS_DIRECT_OUTPUT)
+	// Like update() without UPOLS_DEFERRED_DSP, a block with no free half is still convolved
+	_section_dma_aligned static int32_t droppedOutput[TxRingHalfWords];
+	int32_t *output = SpdifTx::acquireHalf();
+#endif
+
+	digitalWriteFast(33, 1);
+#if defined(UPOLS_FLOAT_OUTPUT) && defined(UPOLS_HYBRID)
+	upolsProcessHeadFloat(&upols, leftAudio->data, rightAudio->data, output->data[LeftChannel], output->data[RightChannel]);
+#elif defined(UPOLS_FLOAT_OUTPUT)
+	upolsProcessFloat(&upols, leftAudio->data, rightAudio->data, output->data[LeftChannel], output->data[RightChannel]);
+#elif defined(UPOLS_DIRECT_OUTPUT) && defined(UPOLS_HYBRID)
+	upolsProcessHeadInterleaved(&upols, leftAudio->data, rightAudio->data, output ? output : droppedOutput);
+#elif defined(UPOLS_DIRECT_OUTPUT)
+	upolsProcessInterleaved(&upols, leftAudio->data, rightAudio->data, output ? output : droppedOutput);
+#elif defined(UPOLS_HYBRID)
+	upolsProcessHead(&upols, leftAudio->data, rightAudio->data);
+#else
+	upolsProcess(&upols, leftAudio->data, rightAudio->data);
+#endif
+	digitalWriteFast(33, 0);
+
+#if defined(UPOLS_FLOAT_OUTPUT)
+	SpdifTx::transmitFloat(output);
+#elif defined(UPOLS_DIRECT_OUTPUT)
+	if (output)
+	{
+		SpdifTx::commitHalf(output);
+	}
+#endif
+}
+#elif !defined(UPOLS_VIRTUALIZER)
 /**
  * @brief Updates every 128 samples / 2.9 ms
  * 
@@ -59,29 +455,148 @@ void ConvolvIR::update(void)
 	{
 		if (audioPassthrough) // Not messing with the data, just sending it through the pipe
 		{
-			transmit(leftAudio, LeftChannel);
-			transmit(rightAudio, RightChannel);
+			transmitPassthrough(leftAudio, rightAudio);
 			release(leftAudio);
 			release(rightAudio);
 			return;
 		}
 		else
 		{
+#if defined(UPOLS_FLOAT_OUTPUT)
+			// Output stays in float until SpdifTx quantises it to 24 bits
+			audio_block_f32_t *output = SpdifTx::allocateFloat();
+#endif
+
 			__disable_irq();
 
 			digitalWriteFast(33, 1);
-			convolve(leftAudio->data, rightAudio->data);
+#if defined(UPOLS_NONUNIFORM)
+			nupolsConvolve(&nupols, leftAudio->data, rightAudio->data);
+#elif defined(UPOLS_TEMPLATE_ENGINE)
+			for (size_t i = 0; i < AUDIO_BLOCK_SAMPLES; i += UPOLS_TEMPLATE_PARTITION_SIZE)
+			{
+				templateEngine.convolve(&leftAudio->data[i], &rightAudio->data[i]);
+			}
+#elif defined(UPOLS_FLOAT_OUTPUT)
+#if defined(UPOLS_HYBRID)
+			upolsProcessHeadFloat(&upols, leftAudio->data, rightAudio->data, output->data[LeftChannel], output->data[RightChannel]);
+#else
+			upolsProcessFloat(&upols, leftAudio->data, rightAudio->data, output->data[LeftChannel], output->data[RightChannel]);
+#endif
+#elif defined(UPOLS_DIRECT_OUTPUT)
+			// Output is written straight into the S/PDIF transmit ring. Without a free half the block is still convolved, so
+			// the convolver's history stays continuous, but it goes nowhere
+			_section_dma_aligned static int32_t droppedOutput[TxRingHalfWords];
+			int32_t *output = SpdifTx::acquireHalf();
+#if defined(UPOLS_HYBRID)
+			upolsProcessHeadInterleaved(&upols, leftAudio->data, rightAudio->data, output ? output : droppedOutput);
+#else
+			upolsProcessInterleaved(&upols, leftAudio->data, rightAudio->data, output ? output : droppedOutput);
+#endif
+#elif defined(UPOLS_HYBRID)
+			upolsProcessHead(&upols, leftAudio->data, rightAudio->data);
+#else
+			upolsProcess(&upols, leftAudio->data, rightAudio->data);
+#endif
 			digitalWriteFast(33, 0);
 
 			// Transmit left and right audio to the output
+#if defined(UPOLS_FLOAT_OUTPUT)
+			SpdifTx::transmitFloat(output);
+#elif defined(UPOLS_DIRECT_OUTPUT)
+			if (output)
+			{
+				SpdifTx::commitHalf(output);
+			}
+#else
 			transmit(leftAudio, LeftChannel);
 			transmit(rightAudio, RightChannel);
+#endif
 
 			release(leftAudio);
 			release(rightAudio);
 
+#if defined(UPOLS_HYBRID)
+			// Output is already on its way, get the tail ready for the next block
+			upolsProcessTail(&upols);
+#endif
+
 			// Re-enable interrupts
 			__enable_irq();
 		}
 	}
 }
+#else
+/**
+ * @brief Updates every 128 samples / 2.9 ms, rendering the bed through the virtual speakers. Missing channels are treated as silence
+ * 
+ */
+void ConvolvIR::update(void)
+{
+	if (audioMute)
+	{
+		return;
+	}
+
+	audio_block_t *bed[MaxBedChannels];
+	const int16_t *bedAudio[MaxBedChannels];
+	const uint8_t channelCount = bedChannelCount(virtualizer.layout);
+	bool bedActive = false;
+
+	for (size_t i = 0; i < channelCount; i++)
+	{
+		bed[i] = receiveReadOnly(i);
+		bedAudio[i] = bed[i] ? bed[i]->data : nullptr;
+		bedActive |= (bed[i] != nullptr);
+	}
+
+	if (bedActive)
+	{
+		if (audioPassthrough) // Front left and right only
+		{
+			if (bed[LeftChannel])
+			{
+				transmit(bed[LeftChannel], LeftChannel);
+			}
+			if (bed[RightChannel])
+			{
+				transmit(bed[RightChannel], RightChannel);
+			}
+		}
+		else
+		{
+			audio_block_t *leftAudio = allocate();
+			audio_block_t *rightAudio = allocate();
+
+			if (leftAudio && rightAudio)
+			{
+				__disable_irq();
+				digitalWriteFast(33, 1);
+				virtualizerProcess(&virtualizer, bedAudio, leftAudio->data, rightAudio->data);
+				digitalWriteFast(33, 0);
+
+				transmit(leftAudio, LeftChannel);
+				transmit(rightAudio, RightChannel);
+				__enable_irq();
+			}
+
+			if (leftAudio)
+			{
+				release(leftAudio);
+			}
+			if (rightAudio)
+			{
+				release(rightAudio);
+			}
+		}
+	}
+
+	for (size_t i = 0; i < channelCount; i++)
+	{
+		if (bed[i])
+		{
+			release(bed[i]);
+		}
+	}
+}
+#endif
@@ -14,14 +14,35 @@
 #include "spdifTx.h"
 #include "ash.h"
 
-AudioInputUSB usbAudioIn;
+#if defined(UPOLS_VIRTUALIZER)
+#include <input_tdm.h>
+#endif
+
 SpdifTx spdifOut;
 ConvolvIR convolvIR;
 
+#if defined(UPOLS_VIRTUALIZER)
+// Bed from an 8-channel TDM codec such as the CS42448. Its slots are 32 bits, so bed channel n is TDM channel 2n
+AudioInputTDM tdmAudioIn;
+
+AudioConnection bedInConv0(tdmAudioIn, 0, convolvIR, 0);
+AudioConnection bedInConv1(tdmAudioIn, 2, convolvIR, 1);
+AudioConnection bedInConv2(tdmAudioIn, 4, convolvIR, 2);
+AudioConnection bedInConv3(tdmAudioIn, 6, convolvIR, 3);
+AudioConnection bedInConv4(tdmAudioIn, 8, convolvIR, 4);
+AudioConnection bedInConv5(tdmAudioIn, 10, convolvIR, 5);
+AudioConnection bedInConv6(tdmAudioIn, 12, convolvIR, 6);
+AudioConnection bedInConv7(tdmAudioIn, 14, convolvIR, 7);
+#else
+AudioInputUSB usbAudioIn;
+
 AudioConnection leftInConv(usbAudioIn, leftChannel, convolvIR, leftChannel);
 AudioConnection rightInConv(usbAudioIn, rightChannel, convolvIR, rightChannel);
+#endif
+#if !defined(UPOLS_FLOAT_OUTPUT) && !defined(UPOLS_DIRECT_OUTPUT) // Output goes to SpdifTx outside the audio graph instead
 AudioConnection leftOutConv(convolvIR, leftChannel, spdifOut, leftChannel);
 AudioConnection rightOutConv(convolvIR, rightChannel, spdifOut, rightChannel);
+#endif
 
 Ash ash;
 
@@ -15,11 +15,31 @@
 _section_dma_aligned static int32_t fifoTx[512];
 _section_dma_aligned static audio_block_t silentAudio;
 
-audio_block_t *SpdifTx::leftAudioBuffer[];
-audio_block_t *SpdifTx::rightAudioBuffer[];
+blockRing_t SpdifTx::audioRing;
+volatile uint32_t SpdifTx::unpaired[];
+
+#if defined(UPOLS_FLOAT_OUTPUT)
+enum FloatPool
+{
+	FloatBlocks = BlockRingSlots + 1 // The deepest ring and the one being filled
+};
+
+static audio_block_f32_t floatAudio[FloatBlocks];
+static volatile bool floatTaken[FloatBlocks]; // Handed out by allocateFloat() and not yet sent or refused
+blockRing_t SpdifTx::floatRing;
+#endif
 
 DMAChannel SpdifTx::eDMA(false);
 
+#if defined(UPOLS_DIRECT_OUTPUT)
+txRing_t SpdifTx::txRing;
+#endif
+
+#if defined(UPOLS_DEFERRED_DSP)
+volatile uint32_t SpdifTx::dmaEventCycles;
+volatile uint32_t SpdifTx::dmaEventLatency;
+#endif
+
 /**
  * @brief Construct a new SpdifTx::SpdifTx object
  *
@@ -36,6 +56,11 @@ SpdifTx::SpdifTx(void) : AudioStream(2, inputQueueArray)
 _section_flash
 void SpdifTx::init(void) 
 {
+	blockRingInit(&audioRing, SPDIFTX_RING_DEPTH);
+	memset((void *)unpaired, 0, sizeof(unpaired));
+#if defined(UPOLS_DIRECT_OUTPUT)
+	txRingInit(&txRing, fifoTx);
+#endif
 	dmaChannel = configureDMA();
 	configureSpdifRegisters();
 
@@ -54,11 +79,13 @@ void SpdifTx::init(void)
 	memset(&silentAudio, 0, sizeof(silentAudio));
 	memset(inputQueueArray, 0, sizeof(inputQueueArray));
 
-	for (size_t i = 0; i < 2; i++)
+#if defined(UPOLS_FLOAT_OUTPUT)
+	blockRingInit(&floatRing, SPDIFTX_RING_DEPTH);
+	for (size_t i = 0; i < FloatBlocks; i++)
 	{
-		leftAudioBuffer[i] = nullptr;
-		rightAudioBuffer[i] = nullptr;
+		floatTaken[i] = false;
 	}
+#endif
 }
 
 /**
@@ -68,6 +95,15 @@ void SpdifTx::init(void)
  */
 void SpdifTx::dmaISR(void)
 {
+#if defined(UPOLS_DEFERRED_DSP)
+	dmaEventCycles = ARM_DWT_CYCCNT;
+
+	// The DMA keeps sending while the interrupt waits to run, one frame per minor loop. The frames it has sent since the half
+	// boundary give the entry latency to within a frame, as long as it's under half a major loop
+	const uint32_t majorLoop = eDMA.TCD->BITER_ELINKNO;
+	const uint32_t framesLate = (majorLoop - eDMA.TCD->CITER_ELINKNO) % (majorLoop / 2);
+	dmaEventLatency = (uint32_t)((uint64_t)F_CPU_ACTUAL * framesLate / SPDIF_SAMPLE_RATE);
+#endif
 	int32_t txOffset = getTxOffset((uint32_t)&fifoTx[0], 1024);
 
 	// Clear Interrupt Request Register (pg 138)
@@ -75,28 +111,58 @@ void SpdifTx::dmaISR(void)
 
 	int32_t *txBaseAddress = &fifoTx[0] + txOffset;
 
-	audio_block_t *leftAudio = (leftAudioBuffer[0]) ?: &silentAudio;
-	audio_block_t *rightAudio = (rightAudioBuffer[0]) ?: &silentAudio;
+#if defined(UPOLS_DIRECT_OUTPUT)
+	// Blocks are already in fifoTx, the half the DMA just left goes back to the producer
+	int32_t *playingHalf = &fifoTx[txOffset ? 0 : TxRingHalfWords];
+	if (txRingDmaEvent(&txRing, txOffset ? 0 : 1))
+	{
+		arm_dcache_flush_delete(playingHalf, 1024);
+	}
 
-	spdifInterleave(txBaseAddress, (const int16_t *)(leftAudio->data), (const int16_t *)(rightAudio->data));
+	update_all();
+	return;
+#endif
+
+#if defined(UPOLS_FLOAT_OUTPUT)
+	// Float builds only queue float blocks. With nothing queued both channels play silence, and the float ring counts the
+	// underrun
+	blockPair_t next;
+	if (blockRingPop(&floatRing, &next))
+	{
+		audio_block_f32_t *block = (audio_block_f32_t *)next.left;
+		spdifInterleave(txBaseAddress, block->data[leftChannel], block->data[rightChannel]);
+		releaseFloat(block);
+	}
+	else
+	{
+		spdifInterleave(txBaseAddress, (const int16_t *)silentAudio.data, (const int16_t *)silentAudio.data);
+	}
 	arm_dcache_flush_delete(txBaseAddress, 1024);
 
-	if (leftAudio != &silentAudio && rightAudio != &silentAudio)
-	{
-		release(leftAudio);
-		release(rightAudio);
+	update_all();
+	return;
+#endif
+
+	// With nothing queued both channels play silence, and the ring counts the underrun
+	blockPair_t audio = {&silentAudio, &silentAudio};
+	const bool queued = blockRingPop(&audioRing, &audio);
+
+	spdifInterleave(txBaseAddress, (const int16_t *)((audio_block_t *)audio.left)->data,
+					(const int16_t *)((audio_block_t *)audio.right)->data);
+	arm_dcache_flush_delete(txBaseAddress, 1024);
 
-		leftAudioBuffer[0] = leftAudioBuffer[1];
-		leftAudioBuffer[1] = nullptr;
-		rightAudioBuffer[0] = rightAudioBuffer[1];
-		rightAudioBuffer[1] = nullptr;
+	if (queued)
+	{
+		release((audio_block_t *)audio.left);
+		release((audio_block_t *)audio.right);
 	}
 
 	update_all();
 }
 
 /**
- * @brief
+ * @brief Queue both channels' blocks for the DMA together. A pair the ring has no room for is released and counted as an
+ * overrun, and a block without the other channel's is released and counted as unpaired
  *
  */
 void SpdifTx::update(void)
@@ -104,59 +170,220 @@ void SpdifTx::update(void)
 	audio_block_t *leftAudio = receiveReadOnly(leftChannel);
 	audio_block_t *rightAudio = receiveReadOnly(rightChannel);
 
-	__disable_irq()
-
 	if (leftAudio && rightAudio)
 	{
-		// Doing buffer packing in a loop is too slow, has to be done like this
-		// Left channel switcheroo
-		if (leftAudioBuffer[0] == nullptr)
-		{
-			leftAudioBuffer[0] = leftAudio;
-			leftAudio = nullptr;
-		}
-		else if (leftAudioBuffer[1] == nullptr)
+		const blockPair_t audio = {leftAudio, rightAudio};
+		if (!blockRingPush(&audioRing, &audio))
 		{
-			leftAudioBuffer[1] = leftAudio;
-			leftAudio = nullptr;
-		}
-		else
-		{
-			audio_block_t *shiftTemp = leftAudioBuffer[0];
-			leftAudioBuffer[0] = leftAudioBuffer[1];
-			leftAudioBuffer[1] = leftAudio;
-			leftAudio = shiftTemp;
+			release(leftAudio);
+			release(rightAudio);
 		}
+		return;
+	}
 
-		// Right channel switcheroo
-		if (rightAudioBuffer[0] == nullptr)
-		{
-			rightAudioBuffer[0] = rightAudio;
-			rightAudio = nullptr;
-		}
-		else if (rightAudioBuffer[1] == nullptr)
-		{
-			rightAudioBuffer[1] = rightAudio;
-			rightAudio = nullptr;
-		}
-		else
+	// Queued on its own, a block would leave one channel a period behind the other for good
+	if (leftAudio)
+	{
+		unpaired[leftChannel]++;
+		release(leftAudio);
+	}
+	if (rightAudio)
+	{
+		unpaired[rightChannel]++;
+		release(rightAudio);
+	}
+}
+
+/**
+ * @brief Queue between update(), or transmitFloat() with UPOLS_FLOAT_OUTPUT, and the DMA, for its depth, fill and counters
+ *
+ */
+const blockRing_t *SpdifTx::ring(void)
+{
+#if defined(UPOLS_FLOAT_OUTPUT)
+	return &floatRing;
+#else
+	return &audioRing;
+#endif
+}
+
+/**
+ * @brief Blocks of one channel dropped because the other channel had none that period
+ *
+ * @param channel leftChannel or rightChannel
+ */
+uint32_t SpdifTx::unpairedBlocks(size_t channel)
+{
+	return unpaired[channel];
+}
+
+/**
+ * @brief Set how many stereo blocks are queued before overrunning. More depth rides out longer stalls of the audio update at
+ * the cost of a block (2.9 ms) of latency each
+ *
+ * @param depth 1 to BlockRingSlots
+ */
+void SpdifTx::setRingDepth(uint32_t depth)
+{
+	blockRingSetDepth(&audioRing, depth);
+#if defined(UPOLS_FLOAT_OUTPUT)
+	blockRingSetDepth(&floatRing, depth);
+#endif
+}
+
+/**
+ * @brief Clear the counters and high-water mark of the queue, and the unpaired block counts
+ *
+ */
+void SpdifTx::clearRingStats(void)
+{
+	blockRingClearStats(&audioRing);
+#if defined(UPOLS_FLOAT_OUTPUT)
+	blockRingClearStats(&floatRing);
+#endif
+	for (size_t channel = 0; channel < 2; channel++)
+	{
+		unpaired[channel] = 0;
+	}
+}
+
+#if defined(UPOLS_FLOAT_OUTPUT)
+/**
+ * @brief Get a float block to fill for transmitFloat(). Never fails as long as every block is handed to transmitFloat(): at
+ * most BlockRingSlots are queued and dmaISR() frees a block before it returns, so one of the pool is always free
+ *
+ * @return Block that is neither queued nor being sent
+ */
+audio_block_f32_t *SpdifTx::allocateFloat(void)
+{
+	for (size_t i = 0; i < FloatBlocks; i++)
+	{
+		// Only the producer marks a block taken, so a free one can't be taken from under it
+		if (!__atomic_load_n(&floatTaken[i], __ATOMIC_ACQUIRE))
 		{
-			audio_block_t *shiftTemp = rightAudioBuffer[0];
-			rightAudioBuffer[0] = rightAudioBuffer[1];
-			rightAudioBuffer[1] = rightAudio;
-			rightAudio = shiftTemp;
+			floatTaken[i] = true;
+			return &floatAudio[i];
 		}
 	}
+	return nullptr;
+}
 
-	__enable_irq()
+/**
+ * @brief Hand a float block back to the pool
+ *
+ * @param block Block from allocateFloat()
+ */
+inline void SpdifTx::releaseFloat(audio_block_f32_t *block)
+{
+	__atomic_store_n(&floatTaken[block - floatAudio], false, __ATOMIC_RELEASE);
+}
 
-	if (leftAudio && rightAudio)
+/**
+ * @brief Queue a float block for the DMA. A block the ring has no room for is released and counted as an overrun, like a q15
+ * pair in update()
+ *
+ * @param block Block from allocateFloat()
+ */
+void SpdifTx::transmitFloat(audio_block_f32_t *block)
+{
+	const blockPair_t audio = {block, block};
+	if (!blockRingPush(&floatRing, &audio))
 	{
-		release(leftAudio);
-		release(rightAudio);
+		releaseFloat(block);
+	}
+}
+#endif
+
+#if defined(UPOLS_DIRECT_OUTPUT)
+/**
+ * @brief Transmit ring the convolver writes into, for its underrun and overrun counters
+ *
+ */
+const txRing_t *SpdifTx::directRing(void)
+{
+	return &txRing;
+}
+
+/**
+ * @brief Claim the half of fifoTx the DMA plays next, to write a block of interleaved 24-bit words into
+ *
+ * @return TxRingHalfWords words, or nullptr when no half has been freed since the last block
+ */
+int32_t *SpdifTx::acquireHalf(void)
+{
+	return txRingAcquire(&txRing);
+}
+
+/**
+ * @brief Flush a filled half out of the data cache and hand it to the DMA, or drop it if the DMA got there first
+ *
+ * @param half Half from acquireHalf()
+ * @return false if the DMA reached the half before it was handed over and is sending silence instead
+ */
+bool SpdifTx::commitHalf(int32_t *half)
+{
+	if (!txRingPublish(&txRing, half))
+	{
+		// dmaISR() has zeroed and flushed the half, whatever was written since is only in the cache and has to stay out of it
+		arm_dcache_delete(half, 1024);
+		return false;
 	}
+
+	// If dmaISR() takes the half during the flush, it zeroes and flushes all of it first, leaving nothing dirty to write back
+	arm_dcache_flush_delete(half, 1024);
+	return txRingCommit(&txRing, half);
 }
 
+/**
+ * @brief Write a block of 16-bit audio straight into the next half of fifoTx, dropped if there isn't one
+ *
+ * @param leftAudioData
+ * @param rightAudioData
+ */
+void SpdifTx::transmitDirect(const int16_t *leftAudioData, const int16_t *rightAudioData)
+{
+	int32_t *half = acquireHalf();
+	if (half)
+	{
+		spdifInterleave(half, leftAudioData, rightAudioData);
+		commitHalf(half);
+	}
+}
+#endif
+
+#if defined(UPOLS_DEFERRED_DSP)
+/**
+ * @brief Cycle count on entry to the latest DMA interrupt, the start of the current block period
+ *
+ * @return ARM_DWT_CYCCNT
+ */
+uint32_t SpdifTx::eventTimestamp(void)
+{
+	return dmaEventCycles;
+}
+
+/**
+ * @brief How long the latest DMA interrupt ran after the DMA crossed into the other half of fifoTx. Counted in whole frames
+ * (22.7 us), so a latency under one frame reads 0
+ *
+ * @return Cycles
+ */
+uint32_t SpdifTx::eventLatency(void)
+{
+	return dmaEventLatency;
+}
+
+/**
+ * @brief CPU cycles between DMA interrupts, one block of AUDIO_BLOCK_SAMPLES frames
+ *
+ * @return Cycles
+ */
+uint32_t SpdifTx::periodCycles(void)
+{
+	return (uint32_t)((uint64_t)F_CPU_ACTUAL * AUDIO_BLOCK_SAMPLES / SPDIF_SAMPLE_RATE);
+}
+#endif
+
 /**
  * @brief Set an offset when SADDR is in the second half of the major loop
  *
@@ -200,6 +427,47 @@ inline void SpdifTx::spdifInterleave(int32_t *pTx, const int16_t *leftAudioData,
 	}
 }
 
+#if defined(UPOLS_FLOAT_OUTPUT)
+/**
+ * @brief Quantise a float sample to the 24 bits S/PDIF carries, saturating and truncating like arm_float_to_q15
+ *
+ * @param sample Sample in [-1, 1)
+ * @return 24-bit sample, sign-extended
+ */
+inline int32_t SpdifTx::floatToSample(float sample)
+{
+	const float scaled = sample * 8388608.0f;
+	return (int32_t)((scaled > 8388607.0f) ? 8388607.0f : ((scaled < -8388608.0f) ? -8388608.0f : scaled));
+}
+
+/**
+ * @brief Quantise and interleave float leftAudioData and rightAudioData into the SPDIF transmit buffer in a single pass
+ *
+ * @param[in] pTx - DMA Source SADDR
+ * @param[in] leftAudioData
+ * @param[in] rightAudioData
+ *
+ */
+inline void SpdifTx::spdifInterleave(int32_t *pTx, const float *leftAudioData, const float *rightAudioData)
+{
+	// All 24 bits of the word are audio, the 8 most-significant-bits are still ignored (pg 1966)
+	for (size_t i = 0; i < 128; i += 4)
+	{
+		pTx[2 * i] = floatToSample(leftAudioData[i]);
+		pTx[2 * i + 1] = floatToSample(rightAudioData[i]);
+
+		pTx[2 * i + 2] = floatToSample(leftAudioData[i + 1]);
+		pTx[2 * i + 3] = floatToSample(rightAudioData[i + 1]);
+
+		pTx[2 * i + 4] = floatToSample(leftAudioData[i + 2]);
+		pTx[2 * i + 5] = floatToSample(rightAudioData[i + 2]);
+
+		pTx[2 * i + 6] = floatToSample(leftAudioData[i + 3]);
+		pTx[2 * i + 7] = floatToSample(rightAudioData[i + 3]);
+	}
+}
+#endif
+
 /**
  * @brief Initialize eDMA and configure the Transfer Control Descriptor (TCD)
  *
@@ -0,0 +1,1486 @@
+/**
+ * @file hrirc.cpp
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief HRIR dataset compiler: SOFA / WAV measurements to include/tablIR.h
+ * @version 0.1
+ * @date 2021-12-13
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ * @details
+ * Each measurement is resampled to 44.1 kHz with a Kaiser-windowed sinc, fitted to ImpulseSamples
+ * taps (zero-padded, or truncated with a short fade-out) and scaled by a single gain shared by the
+ * whole set so the loudest frequency bin of any HRIR sits at 0 dBFS. Directions are processed in
+ * parallel, including formatting their share of the output.
+ *
+ * Inputs:
+ *   .sofa  SimpleFreeFieldHRIR files (needs HRIRC_SOFA and libhdf5)
+ *   .wav   Stereo files with the direction in the name: "..._az30_el-10.wav" or MIT KEMAR style "H-10e030a.wav"
+ *
+ * Built with UPOLS_MINIMUM_PHASE (and the same UPOLS_PARTITION_COUNT as the firmware), every ear is
+ * replaced by its minimum-phase counterpart before it is fitted, and the delay between the two (the
+ * cross-correlation peak) is written to irDelay relative to the earlier ear of the pair. The delay
+ * line in upols.c puts it back at run time.
+ *
+ * With UPOLS_SUBBAND, ImpulseSamples also covers the low-rate tail, so build with the same
+ * UPOLS_SUBBAND_PARTITIONS as the firmware.
+ *
+ * The directions are triangulated (convex hull on the unit sphere, or azimuth segments for a
+ * horizontal-only set) for hrirLookup(), and written to include/triangulation.h.
+ *
+ * Usage: hrirc [-o tablIR.h] [-t triangulation.h] [-b spectralBank.h] [-a azimuthStep] [-n spectral|none] [-j threads] [-p] input...
+ *
+ *   -a  Keep only the horizontal plane, resampled onto a grid of azimuthStep degrees
+ *   -b  Also write the partitioned spectra for UPOLS_SPECTRAL_BANK
+ *   -p  Print the partitions and bins each direction keeps with UPOLS_PARTITION_PRUNING or UPOLS_BAND_PRUNING,
+ *       and the CMAC work it saves
+ *
+ */
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <complex>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <regex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "upols.h"
+#include "interpolation.h"
+
+#ifdef HRIRC_SOFA
+#include <hdf5.h>
+#endif
+
+enum CompilerDefaults
+{
+	TargetSampleRate = 44100,
+	ZeroCrossings = 32,		// Resampler kernel half-width, in zero crossings
+	KernelOversample = 512, // Resampler kernel table points per input sample
+	FadeSamples = 220,		// ~5 ms fade-out when an HRIR is truncated
+	CepstrumPadding = 4,	// Minimum-phase FFT length relative to the HRIR, keeps cepstral aliasing down
+	SpectrumLength = 2 * ImpulseSamples,
+	FloatsPerLine = 8
+};
+
+// Single HRIR measurement, taps for each ear at sampleRate
+typedef struct measurement_t
+{
+	float azimuth;	 // Degrees, counter-clockwise from the front
+	float elevation; // Degrees, positive above the horizontal plane
+	double sampleRate;
+	std::vector<float> ir[2];
+	float delay[2]; // Split off each ear with UPOLS_MINIMUM_PHASE, in samples at TargetSampleRate
+} measurement_t;
+
+// Spectral floor for the log magnitude of minimum-phase HRIRs, relative to the peak bin (-120 dB)
+static const double MinimumPhaseFloor = 1e-6;
+
+// Global time-domain table used by computeFilters() when writing the spectral bank
+extern "C" float32_t irTable[2 * ImpulseSamples];
+extern "C" const uint16_t irCount = 1;
+float32_t irTable[2 * ImpulseSamples];
+#ifdef UPOLS_MINIMUM_PHASE
+extern "C"
+{
+	float32_t irDelay[1][2];
+}
+#endif
+
+static void fatal(const char *format, const char *detail)
+{
+	fprintf(stderr, "hrirc: ");
+	fprintf(stderr, format, detail);
+	fprintf(stderr, "\n");
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Run fn(i) for i in [0, count) across a pool of threads
+ *
+ */
+template <typename Function>
+static void parallelFor(size_t count, unsigned threadCount, Function fn)
+{
+	std::atomic<size_t> next(0);
+	std::vector<std::thread> pool;
+
+	for (unsigned t = 0; t < threadCount; t++)
+	{
+		pool.emplace_back([&]() {
+			for (size_t i = next++; i < count; i = next++)
+			{
+				fn(i);
+			}
+		});
+	}
+
+	for (auto &thread : pool)
+	{
+		thread.join();
+	}
+}
+
+static uint32_t readLE(const uint8_t *bytes, size_t count)
+{
+	uint32_t value = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		value |= (uint32_t)bytes[i] << (8 * i);
+	}
+	return value;
+}
+
+/**
+ * @brief Pull the direction out of a WAV file name
+ *
+ * @return false if the name doesn't contain a recognised direction
+ */
+static bool parseDirection(const std::string &path, float *azimuth, float *elevation)
+{
+	const std::string name = path.substr(path.find_last_of('/') + 1);
+	const std::regex azimuthPattern("az(-?[0-9]+(\\.[0-9]+)?)", std::regex::icase);
+	const std::regex elevationPattern("el(-?[0-9]+(\\.[0-9]+)?)", std::regex::icase);
+	const std::regex kemarPattern("^H(-?[0-9]+)e([0-9]+)a", std::regex::icase);
+
+	std::smatch match;
+	if (std::regex_search(name, match, kemarPattern))
+	{
+		*elevation = std::stof(match[1]);
+		*azimuth = std::stof(match[2]);
+		return true;
+	}
+
+	if (std::regex_search(name, match, azimuthPattern))
+	{
+		*azimuth = std::stof(match[1]);
+		*elevation = std::regex_search(name, match, elevationPattern) ? std::stof(match[1]) : 0.0f;
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * @brief Load a stereo 16/24/32-bit PCM or 32-bit float WAV file
+ *
+ */
+static measurement_t loadWav(const std::string &path)
+{
+	std::ifstream file(path, std::ios::binary);
+	std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	if (bytes.size() < 12 || memcmp(bytes.data(), "RIFF", 4) || memcmp(&bytes[8], "WAVE", 4))
+	{
+		fatal("%s is not a WAV file", path.c_str());
+	}
+
+	measurement_t measurement = {};
+	if (!parseDirection(path, &measurement.azimuth, &measurement.elevation))
+	{
+		fatal("No direction in file name %s", path.c_str());
+	}
+
+	uint16_t format = 0, channels = 0, bitsPerSample = 0;
+	for (size_t offset = 12; offset + 8 <= bytes.size();)
+	{
+		const uint8_t *chunk = &bytes[offset];
+		const size_t chunkSize = readLE(&chunk[4], 4);
+		const uint8_t *body = &chunk[8];
+
+		if (offset + 8 + chunkSize > bytes.size())
+		{
+			fatal("Truncated chunk in %s", path.c_str());
+		}
+
+		if (!memcmp(chunk, "fmt ", 4))
+		{
+			format = readLE(&body[0], 2);
+			channels = readLE(&body[2], 2);
+			measurement.sampleRate = readLE(&body[4], 4);
+			bitsPerSample = readLE(&body[14], 2);
+			if (format == 0xFFFE && chunkSize >= 26) // WAVE_FORMAT_EXTENSIBLE, sub-format in the GUID
+			{
+				format = readLE(&body[24], 2);
+			}
+		}
+		else if (!memcmp(chunk, "data", 4))
+		{
+			if (channels != 2)
+			{
+				fatal("%s must have exactly two channels", path.c_str());
+			}
+
+			const size_t bytesPerSample = bitsPerSample / 8;
+			const size_t frames = chunkSize / (2 * bytesPerSample);
+			for (size_t ear = 0; ear < 2; ear++)
+			{
+				measurement.ir[ear].resize(frames);
+			}
+
+			for (size_t i = 0; i < frames; i++)
+			{
+				for (size_t ear = 0; ear < 2; ear++)
+				{
+					const uint8_t *sample = &body[(2 * i + ear) * bytesPerSample];
+					float value;
+					if (format == 3 && bitsPerSample == 32)
+					{
+						memcpy(&value, sample, sizeof(value));
+					}
+					else if (format == 1 && (bitsPerSample == 16 || bitsPerSample == 24 || bitsPerSample == 32))
+					{
+						// Left-justify then sign-extend through int32_t
+						const int32_t pcm = (int32_t)(readLE(sample, bytesPerSample) << (32 - bitsPerSample));
+						value = (float)pcm / 2147483648.0f;
+					}
+					else
+					{
+						fatal("Unsupported sample format in %s", path.c_str());
+					}
+					measurement.ir[ear][i] = value;
+				}
+			}
+			return measurement;
+		}
+
+		offset += 8 + chunkSize + (chunkSize & 1);
+	}
+
+	fatal("No audio data in %s", path.c_str());
+	return measurement;
+}
+
+#ifdef HRIRC_SOFA
+/**
+ * @brief Read a whole numeric dataset as doubles
+ *
+ */
+static std::vector<double> readDataset(hid_t file, const char *name, std::vector<hsize_t> *dims)
+{
+	const hid_t dataset = H5Dopen2(file, name, H5P_DEFAULT);
+	if (dataset < 0)
+	{
+		fatal("SOFA file has no %s", name);
+	}
+
+	const hid_t space = H5Dget_space(dataset);
+	dims->resize(H5Sget_simple_extent_ndims(space));
+	H5Sget_simple_extent_dims(space, dims->data(), NULL);
+
+	std::vector<double> values(H5Sget_simple_extent_npoints(space));
+	H5Dread(dataset, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, values.data());
+
+	H5Sclose(space);
+	H5Dclose(dataset);
+	return values;
+}
+
+/**
+ * @brief Read the "Type" attribute of SourcePosition, "spherical" or "cartesian"
+ *
+ */
+static std::string positionType(hid_t file)
+{
+	std::string type = "spherical";
+	const hid_t dataset = H5Dopen2(file, "SourcePosition", H5P_DEFAULT);
+	if (dataset >= 0 && H5Aexists(dataset, "Type") > 0)
+	{
+		const hid_t attribute = H5Aopen(dataset, "Type", H5P_DEFAULT);
+		const hid_t stringType = H5Aget_type(attribute);
+
+		if (H5Tis_variable_str(stringType) > 0)
+		{
+			char *value = NULL;
+			const hid_t memoryType = H5Tget_native_type(stringType, H5T_DIR_ASCEND);
+			H5Aread(attribute, memoryType, &value);
+			type = value ? value : type;
+			H5free_memory(value);
+			H5Tclose(memoryType);
+		}
+		else
+		{
+			std::vector<char> value(H5Tget_size(stringType) + 1, '\0');
+			H5Aread(attribute, stringType, value.data());
+			type = value.data();
+		}
+
+		H5Tclose(stringType);
+		H5Aclose(attribute);
+	}
+	if (dataset >= 0)
+	{
+		H5Dclose(dataset);
+	}
+	return type;
+}
+
+/**
+ * @brief Load every measurement from a SimpleFreeFieldHRIR SOFA file
+ *
+ */
+static void loadSofa(const std::string &path, std::vector<measurement_t> &measurements)
+{
+	const hid_t file = H5Fopen(path.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+	if (file < 0)
+	{
+		fatal("Unable to open %s", path.c_str());
+	}
+
+	std::vector<hsize_t> irDims, rateDims, positionDims;
+	const std::vector<double> ir = readDataset(file, "Data.IR", &irDims);
+	const std::vector<double> rate = readDataset(file, "Data.SamplingRate", &rateDims);
+	const std::vector<double> positions = readDataset(file, "SourcePosition", &positionDims);
+	const bool cartesian = (positionType(file) == "cartesian");
+	H5Fclose(file);
+
+	if (irDims.size() != 3 || irDims[1] != 2)
+	{
+		fatal("%s: Data.IR must be M x 2 x N", path.c_str());
+	}
+
+	const size_t count = irDims[0];
+	const size_t taps = irDims[2];
+	const bool perMeasurementPosition = (positionDims.size() == 2 && positionDims[0] == count);
+
+	for (size_t m = 0; m < count; m++)
+	{
+		measurement_t measurement = {};
+		const double *position = &positions[perMeasurementPosition ? 3 * m : 0];
+
+		if (cartesian)
+		{
+			measurement.azimuth = (float)(atan2(position[1], position[0]) * 180.0 / M_PI);
+			measurement.elevation = (float)(atan2(position[2], hypot(position[0], position[1])) * 180.0 / M_PI);
+		}
+		else
+		{
+			measurement.azimuth = (float)position[0];
+			measurement.elevation = (float)position[1];
+		}
+		measurement.azimuth = fmodf(measurement.azimuth + 360.0f, 360.0f);
+		measurement.sampleRate = rate[(rate.size() == count) ? m : 0];
+
+		for (size_t ear = 0; ear < 2; ear++)
+		{
+			const double *taps0 = &ir[(2 * m + ear) * taps];
+			measurement.ir[ear].assign(taps0, taps0 + taps);
+		}
+		measurements.push_back(std::move(measurement));
+	}
+}
+#endif
+
+static double besselI0(double x)
+{
+	double sum = 1.0, term = 1.0;
+	for (int k = 1; k < 64 && term > 1e-12 * sum; k++)
+	{
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+	}
+	return sum;
+}
+
+// Kaiser-windowed sinc low-pass for one source sample rate, tabulated so every direction can share it
+typedef struct resampler_t
+{
+	double sourceRate;
+	double ratio;			   // Output samples per input sample
+	double halfWidth;		   // Kernel half-width in input samples
+	std::vector<float> kernel; // KernelOversample points per input sample over [0, halfWidth]
+} resampler_t;
+
+static resampler_t makeResampler(double sourceRate)
+{
+	const double beta = 8.6;
+	resampler_t resampler = {};
+	resampler.sourceRate = sourceRate;
+	resampler.ratio = TargetSampleRate / sourceRate;
+
+	const double cutoff = 0.96 * std::min(1.0, resampler.ratio); // Relative to the source Nyquist frequency
+	resampler.halfWidth = ZeroCrossings / cutoff;
+	resampler.kernel.resize((size_t)ceil(resampler.halfWidth * KernelOversample) + 2);
+
+	for (size_t i = 0; i < resampler.kernel.size(); i++)
+	{
+		const double x = (double)i / KernelOversample;
+		const double r = std::min(1.0, x / resampler.halfWidth);
+		const double window = besselI0(beta * sqrt(1.0 - r * r)) / besselI0(beta);
+		const double sinc = (x == 0) ? 1.0 : sin(M_PI * cutoff * x) / (M_PI * cutoff * x);
+		resampler.kernel[i] = (float)(cutoff * sinc * window);
+	}
+	return resampler;
+}
+
+/**
+ * @brief Band-limited resampling to TargetSampleRate
+ *
+ */
+static std::vector<float> resample(const std::vector<float> &input, const resampler_t &resampler)
+{
+	if (resampler.sourceRate == TargetSampleRate)
+	{
+		return input;
+	}
+
+	std::vector<float> output((size_t)ceil(input.size() * resampler.ratio));
+	for (size_t n = 0; n < output.size(); n++)
+	{
+		const double t = n / resampler.ratio;
+		const long first = std::max(0L, (long)ceil(t - resampler.halfWidth));
+		const long last = std::min((long)input.size() - 1, (long)floor(t + resampler.halfWidth));
+
+		double sum = 0;
+		for (long k = first; k <= last; k++)
+		{
+			// Linear interpolation between kernel table points
+			const double position = fabs(t - k) * KernelOversample;
+			const size_t index = (size_t)position;
+			const double fraction = position - index;
+			const double tap = resampler.kernel[index] + fraction * (resampler.kernel[index + 1] - resampler.kernel[index]);
+			sum += input[k] * tap;
+		}
+		output[n] = (float)sum;
+	}
+	return output;
+}
+
+/**
+ * @brief Zero-pad or truncate to ImpulseSamples, fading out truncated responses
+ *
+ */
+static void fitLength(std::vector<float> &ir)
+{
+	const bool truncated = ir.size() > ImpulseSamples;
+	ir.resize(ImpulseSamples, 0.0f);
+
+	if (truncated)
+	{
+		for (size_t i = 0; i < FadeSamples; i++)
+		{
+			ir[ImpulseSamples - FadeSamples + i] *= 0.5f * (1.0f + cosf((float)M_PI * (i + 1) / FadeSamples));
+		}
+	}
+}
+
+/**
+ * @brief In-place radix-2 FFT. The inverse is scaled by 1 / N
+ *
+ * @param bins Power of two number of bins
+ * @param inverse Inverse transform when true
+ */
+static void fft(std::vector<std::complex<double>> &bins, bool inverse)
+{
+	const size_t length = bins.size();
+	for (size_t i = 1, j = 0; i < length; i++)
+	{
+		size_t bit = length >> 1;
+		for (; j & bit; bit >>= 1)
+		{
+			j ^= bit;
+		}
+		j ^= bit;
+		if (i < j)
+		{
+			std::swap(bins[i], bins[j]);
+		}
+	}
+
+	std::vector<std::complex<double>> twiddles(length / 2);
+	for (size_t k = 0; k < length / 2; k++)
+	{
+		twiddles[k] = std::polar(1.0, (inverse ? 2.0 : -2.0) * M_PI * k / length);
+	}
+
+	for (size_t span = 1; span < length; span <<= 1)
+	{
+		const size_t stride = length / (2 * span);
+		for (size_t start = 0; start < length; start += 2 * span)
+		{
+			for (size_t k = 0; k < span; k++)
+			{
+				const std::complex<double> t = twiddles[k * stride] * bins[start + k + span];
+				bins[start + k + span] = bins[start + k] - t;
+				bins[start + k] += t;
+			}
+		}
+	}
+
+	if (inverse)
+	{
+		for (auto &bin : bins)
+		{
+			bin /= (double)length;
+		}
+	}
+}
+
+#ifdef UPOLS_MINIMUM_PHASE
+/**
+ * @brief Replace an HRIR with the minimum-phase response of the same magnitude (folded real cepstrum)
+ *
+ * @param ir Taps, replaced in place
+ * @return Delay of the measured response relative to the minimum-phase one in samples, from the peak of their cross-correlation
+ */
+static float minimumPhase(std::vector<float> &ir)
+{
+	size_t length = 1;
+	while (length < CepstrumPadding * ir.size())
+	{
+		length <<= 1;
+	}
+
+	std::vector<std::complex<double>> spectrum(length);
+	std::copy(ir.begin(), ir.end(), spectrum.begin());
+	fft(spectrum, false);
+
+	double peak = 0;
+	for (const auto &bin : spectrum)
+	{
+		peak = std::max(peak, std::abs(bin));
+	}
+
+	// Real cepstrum, with nulls raised to the floor so the log stays finite
+	std::vector<std::complex<double>> cepstrum(length);
+	for (size_t k = 0; k < length; k++)
+	{
+		cepstrum[k] = log(std::max(std::abs(spectrum[k]), peak * MinimumPhaseFloor));
+	}
+	fft(cepstrum, true);
+
+	// Fold the anti-causal half onto the causal half
+	for (size_t n = 1; n < length; n++)
+	{
+		cepstrum[n] = (n < length / 2) ? 2.0 * cepstrum[n].real() : ((n == length / 2) ? cepstrum[n].real() : 0.0);
+	}
+	cepstrum[0] = cepstrum[0].real();
+	fft(cepstrum, false);
+
+	std::vector<std::complex<double>> minimum(length);
+	std::vector<std::complex<double>> correlation(length);
+	for (size_t k = 0; k < length; k++)
+	{
+		minimum[k] = std::exp(cepstrum[k]);
+		correlation[k] = spectrum[k] * std::conj(minimum[k]);
+	}
+	fft(minimum, true);
+	fft(correlation, true);
+
+	// Positive lags only, the measured response can't lead its minimum-phase version
+	size_t lag = 0;
+	for (size_t n = 1; n < length / 2; n++)
+	{
+		if (correlation[n].real() > correlation[lag].real())
+		{
+			lag = n;
+		}
+	}
+
+	// Parabolic fit through the peak and its neighbours for the fractional part
+	double fraction = 0;
+	if (lag > 0)
+	{
+		const double before = correlation[lag - 1].real();
+		const double at = correlation[lag].real();
+		const double after = correlation[lag + 1].real();
+		const double curvature = before - 2.0 * at + after;
+		if (curvature < 0)
+		{
+			fraction = 0.5 * (before - after) / curvature;
+		}
+	}
+
+	for (size_t i = 0; i < ir.size(); i++)
+	{
+		ir[i] = (float)minimum[i].real();
+	}
+	return (float)(lag + fraction);
+}
+#endif
+
+/**
+ * @brief Largest bin magnitude across both ears' zero-padded spectra
+ *
+ * @details Both ears share one complex FFT (left in the real part, right in the imaginary part)
+ * and are separated afterwards using the conjugate symmetry of real-valued inputs.
+ */
+static double spectralPeak(const std::vector<float> &left, const std::vector<float> &right)
+{
+	std::vector<std::complex<double>> bins(SpectrumLength);
+	for (size_t i = 0; i < ImpulseSamples; i++)
+	{
+		bins[i] = std::complex<double>(left[i], right[i]);
+	}
+	fft(bins, false);
+
+	double peak = 0;
+	for (size_t k = 0; k <= SpectrumLength / 2; k++)
+	{
+		const std::complex<double> z = bins[k];
+		const std::complex<double> mirror = std::conj(bins[(SpectrumLength - k) % SpectrumLength]);
+		peak = std::max(peak, std::abs(z + mirror) / 2); // Left
+		peak = std::max(peak, std::abs(z - mirror) / 2); // Right (magnitude only, so the -j factor is dropped)
+	}
+	return peak;
+}
+
+/**
+ * @brief Pick the measurement nearest to each point on a horizontal azimuth grid
+ *
+ */
+static std::vector<measurement_t> horizontalGrid(const std::vector<measurement_t> &measurements, double azimuthStep)
+{
+	std::vector<measurement_t> grid;
+	const size_t points = (size_t)lround(360.0 / azimuthStep);
+
+	for (size_t i = 0; i < points; i++)
+	{
+		const double azimuth = i * azimuthStep * M_PI / 180.0;
+		size_t nearest = 0;
+		double nearestAngle = INFINITY;
+
+		for (size_t m = 0; m < measurements.size(); m++)
+		{
+			const double az = measurements[m].azimuth * M_PI / 180.0;
+			const double el = measurements[m].elevation * M_PI / 180.0;
+			const double angle = acos(std::min(1.0, cos(el) * cos(az - azimuth))); // Great-circle distance to (azimuth, 0)
+			if (angle < nearestAngle)
+			{
+				nearestAngle = angle;
+				nearest = m;
+			}
+		}
+
+		measurement_t point = measurements[nearest];
+		point.azimuth = (float)(i * azimuthStep);
+		point.elevation = 0.0f;
+		grid.push_back(point);
+	}
+	return grid;
+}
+
+/**
+ * @brief Format a float literal that round-trips exactly
+ *
+ */
+static void appendFloat(std::string &text, float value)
+{
+	if (value == 0.0f)
+	{
+		text += "0.0f,"; // Most of a zero-padded table
+		return;
+	}
+
+	char literal[32];
+	snprintf(literal, sizeof(literal), "%.9g", value);
+	text += literal;
+	text += strpbrk(literal, ".e") ? "f," : ".0f,";
+}
+
+static void appendFloats(std::string &text, const float *values, size_t count, const char *indent)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		text += (i % FloatsPerLine) ? " " : indent;
+		appendFloat(text, values[i]);
+		text += ((i + 1) % FloatsPerLine && (i + 1) < count) ? "" : "\n";
+	}
+}
+
+static void writeText(const char *path, const std::vector<std::string> &parts)
+{
+	FILE *out = fopen(path, "w");
+	if (!out)
+	{
+		fatal("Unable to write %s", path);
+	}
+	for (const auto &part : parts)
+	{
+		fwrite(part.data(), 1, part.size(), out);
+	}
+	fclose(out);
+}
+
+/**
+ * @brief Run computeFilters() on a single measurement through the one-pair irTable
+ *
+ */
+static void prepareFilters(filters_t *bank, const measurement_t &measurement)
+{
+	std::copy(measurement.ir[LeftFilter].begin(), measurement.ir[LeftFilter].end(), &irTable[0]);
+	std::copy(measurement.ir[RightFilter].begin(), measurement.ir[RightFilter].end(), &irTable[ImpulseSamples]);
+#ifdef UPOLS_MINIMUM_PHASE
+	irDelay[0][LeftFilter] = measurement.delay[LeftFilter];
+	irDelay[0][RightFilter] = measurement.delay[RightFilter];
+#endif
+	computeFilters(bank, 0);
+}
+
+#ifdef UPOLS_PARTITION_PRUNING
+/**
+ * @brief Pruning lists of a bank, in the order of partitionPruning_t
+ *
+ */
+static void appendPruning(std::string &text, const partitionPruning_t &pruning)
+{
+	text += "\t\t.pruning = {\n\t\t\t.energy = {{\n";
+	appendFloats(text, pruning.energy[LeftFilter], PartitionCount, "\t\t\t\t");
+	text += "\t\t\t}, {\n";
+	appendFloats(text, pruning.energy[RightFilter], PartitionCount, "\t\t\t\t");
+	text += "\t\t\t}},\n\t\t\t.activeEars = {";
+	for (size_t i = 0; i < PartitionCount; i++)
+	{
+		text += std::to_string(pruning.activeEars[i]) + ",";
+	}
+	text += "},\n\t\t\t.activeList = {";
+	for (size_t i = 0; i < PartitionCount; i++)
+	{
+		text += std::to_string(i < pruning.activeCount ? pruning.activeList[i] : 0) + ",";
+	}
+	text += "},\n\t\t\t.activeCount = " + std::to_string(pruning.activeCount) + ",\n\t\t},\n";
+}
+
+#endif
+
+#ifdef UPOLS_BAND_PRUNING
+/**
+ * @brief Band of every partition, as found by limitFilterBands()
+ *
+ */
+static void appendBands(std::string &text, const filters_t &bank)
+{
+	text += "\t\t.bandBins = {";
+	for (size_t ear = 0; ear < 2; ear++)
+	{
+		text += "{";
+		for (size_t i = 0; i < PartitionCount; i++)
+		{
+			text += std::to_string(bank.bandBins[ear][i]) + ",";
+		}
+		text += "}, ";
+	}
+	text += "},\n";
+}
+#endif
+
+#if defined(UPOLS_PARTITION_PRUNING) || defined(UPOLS_BAND_PRUNING)
+/**
+ * @brief Print the partitions and bins each direction's filters keep after pruning, and the CMAC work skipped
+ *
+ */
+static void reportPruning(const std::vector<measurement_t> &measurements)
+{
+	static filters_t bank;
+	const double fullBins = (double)PartitionCount * HalfSpectrumBins;
+	double savedTotal = 0;
+
+#ifdef UPOLS_PARTITION_PRUNING
+	printf("Partition pruning at %d dB, %d partitions per ear\n", UPOLS_PRUNE_THRESHOLD_DB, PartitionCount);
+#endif
+#ifdef UPOLS_BAND_PRUNING
+	printf("Band pruning at %d dB, at most %d of %d bins per partition\n", UPOLS_BAND_THRESHOLD_DB, BandLimitBins, HalfSpectrumBins);
+#endif
+	for (size_t m = 0; m < measurements.size(); m++)
+	{
+		prepareFilters(&bank, measurements[m]);
+		const unsigned left = activePartitions(&bank, LeftFilter);
+		const unsigned right = activePartitions(&bank, RightFilter);
+		const double leftBins = activeBins(&bank, LeftFilter) / fullBins;
+		const double rightBins = activeBins(&bank, RightFilter) / fullBins;
+		const double saved = 1.0 - (leftBins + rightBins) / 2;
+		savedTotal += saved;
+		printf("\t%4zu: azimuth %6.1f, elevation %5.1f: partitions left %2u, right %2u, bins left %5.1f%%, right %5.1f%%, %4.1f%% of the CMAC skipped\n",
+			   m, measurements[m].azimuth, measurements[m].elevation, left, right, 100 * leftBins, 100 * rightBins, 100 * saved);
+	}
+	printf("Mean: %.1f%% of the CMAC skipped\n", 100 * savedTotal / measurements.size());
+}
+#endif
+
+/**
+ * @brief Partition spectra of every pair, in the format read by upols.c with UPOLS_SPECTRAL_BANK
+ *
+ */
+static void writeSpectralBank(const char *path, const std::vector<measurement_t> &measurements)
+{
+	static filters_t bank;
+	std::vector<std::string> parts;
+
+	char header[512];
+	snprintf(header, sizeof(header),
+			 "/**\n * @file spectralBank.h\n * @brief Partition spectra for %zu HRIR pairs. Generated by tools/hrirc.cpp, do not edit\n */\n\n"
+			 "#pragma once\n\nenum SpectralBankSize\n{\n\tSpectralBankCount = %zu,\n\tSpectralBankStride = 1\n};\n\n"
+			 "static const filters_t spectralBank[SpectralBankCount] _section_progmem = {\n",
+			 measurements.size(), measurements.size());
+	parts.push_back(header);
+
+	for (const auto &measurement : measurements)
+	{
+		prepareFilters(&bank, measurement);
+
+		std::string text = "\t{\n\t\t.left = {\n";
+		appendFloats(text, bank.left, FilterSpectrumFloats * PartitionCount, "\t\t\t");
+		text += "\t\t},\n\t\t.right = {\n";
+		appendFloats(text, bank.right, FilterSpectrumFloats * PartitionCount, "\t\t\t");
+		text += "\t\t},\n\t\t.head = {{\n";
+		appendFloats(text, bank.head[LeftFilter], HybridHeadTaps, "\t\t\t");
+		text += "\t\t}, {\n";
+		appendFloats(text, bank.head[RightFilter], HybridHeadTaps, "\t\t\t");
+		text += "\t\t}},\n";
+#ifdef UPOLS_MINIMUM_PHASE
+		text += "\t\t.delay = {";
+		appendFloat(text, bank.delay[LeftFilter]);
+		text += " ";
+		appendFloat(text, bank.delay[RightFilter]);
+		text += "},\n";
+#endif
+#ifdef UPOLS_PARTITION_PRUNING
+		appendPruning(text, bank.pruning);
+#endif
+#ifdef UPOLS_BAND_PRUNING
+		appendBands(text, bank);
+#endif
+#ifdef UPOLS_SUBBAND
+		text += "\t\t.subband = {{\n";
+		appendFloats(text, bank.subband[LeftFilter], SubbandSpectrumFloats * SubbandFilterPartitions, "\t\t\t");
+		text += "\t\t}, {\n";
+		appendFloats(text, bank.subband[RightFilter], SubbandSpectrumFloats * SubbandFilterPartitions, "\t\t\t");
+		text += "\t\t}},\n";
+#endif
+		text += "\t},\n";
+		parts.push_back(std::move(text));
+	}
+
+	parts.push_back("};\n");
+	writeText(path, parts);
+}
+
+typedef struct vec3_t
+{
+	double x, y, z;
+} vec3_t;
+
+static vec3_t operator-(const vec3_t &a, const vec3_t &b)
+{
+	return {a.x - b.x, a.y - b.y, a.z - b.z};
+}
+
+static vec3_t operator+(const vec3_t &a, const vec3_t &b)
+{
+	return {a.x + b.x, a.y + b.y, a.z + b.z};
+}
+
+static vec3_t operator*(double s, const vec3_t &a)
+{
+	return {s * a.x, s * a.y, s * a.z};
+}
+
+static double dot(const vec3_t &a, const vec3_t &b)
+{
+	return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static vec3_t cross(const vec3_t &a, const vec3_t &b)
+{
+	return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x};
+}
+
+static vec3_t normalized(const vec3_t &a)
+{
+	return (1.0 / sqrt(dot(a, a))) * a;
+}
+
+static double angleBetween(const vec3_t &a, const vec3_t &b)
+{
+	return acos(std::max(-1.0, std::min(1.0, dot(a, b))));
+}
+
+static vec3_t unitVector(double azimuth, double elevation)
+{
+	const double az = azimuth * M_PI / 180.0;
+	const double el = elevation * M_PI / 180.0;
+	return {cos(el) * cos(az), cos(el) * sin(az), sin(el)};
+}
+
+typedef std::array<uint32_t, 3> triangle_t;
+
+/**
+ * @brief Incremental 3D convex hull. Points on the unit sphere make every hull face a spherical Delaunay triangle
+ *
+ * @return false if the points are coplanar
+ */
+static bool convexHull(const std::vector<vec3_t> &points, std::vector<triangle_t> &faces)
+{
+	const size_t n = points.size();
+	if (n < 4)
+	{
+		return false;
+	}
+
+	// Initial tetrahedron from well-separated points
+	size_t seed[4] = {0, 0, 0, 0};
+	double best = 0;
+	for (size_t i = 1; i < n; i++)
+	{
+		const double d = dot(points[i] - points[0], points[i] - points[0]);
+		if (d > best)
+		{
+			best = d;
+			seed[1] = i;
+		}
+	}
+
+	best = 0;
+	for (size_t i = 0; i < n; i++)
+	{
+		const vec3_t c = cross(points[seed[1]] - points[0], points[i] - points[0]);
+		if (dot(c, c) > best)
+		{
+			best = dot(c, c);
+			seed[2] = i;
+		}
+	}
+
+	const vec3_t baseNormal = cross(points[seed[1]] - points[0], points[seed[2]] - points[0]);
+	best = 0;
+	for (size_t i = 0; i < n; i++)
+	{
+		const double d = fabs(dot(baseNormal, points[i] - points[0]));
+		if (d > best)
+		{
+			best = d;
+			seed[3] = i;
+		}
+	}
+
+	if (best < 1e-9)
+	{
+		return false;
+	}
+
+	const vec3_t interior = 0.25 * (points[seed[0]] + points[seed[1]] + points[seed[2]] + points[seed[3]]);
+	std::vector<vec3_t> normals;
+
+	// Wind every face so its normal points away from the interior
+	auto addFace = [&](uint32_t a, uint32_t b, uint32_t c) {
+		vec3_t normal = cross(points[b] - points[a], points[c] - points[a]);
+		if (dot(normal, interior - points[a]) > 0)
+		{
+			std::swap(b, c);
+			normal = -1.0 * normal;
+		}
+		faces.push_back({a, b, c});
+		normals.push_back(normal);
+	};
+
+	faces.clear();
+	addFace(seed[0], seed[1], seed[2]);
+	addFace(seed[0], seed[1], seed[3]);
+	addFace(seed[0], seed[2], seed[3]);
+	addFace(seed[1], seed[2], seed[3]);
+
+	for (uint32_t p = 0; p < n; p++)
+	{
+		if (std::find(std::begin(seed), std::end(seed), p) != std::end(seed))
+		{
+			continue;
+		}
+
+		std::vector<bool> visible(faces.size());
+		std::set<std::pair<uint32_t, uint32_t>> visibleEdges;
+		for (size_t f = 0; f < faces.size(); f++)
+		{
+			visible[f] = dot(normals[f], points[p] - points[faces[f][0]]) > 1e-12 * sqrt(dot(normals[f], normals[f]));
+			if (visible[f])
+			{
+				for (size_t e = 0; e < 3; e++)
+				{
+					visibleEdges.insert({faces[f][e], faces[f][(e + 1) % 3]});
+				}
+			}
+		}
+
+		if (visibleEdges.empty())
+		{
+			continue; // Inside the hull
+		}
+
+		// Horizon edges belong to exactly one visible face
+		std::vector<std::pair<uint32_t, uint32_t>> horizon;
+		for (const auto &edge : visibleEdges)
+		{
+			if (!visibleEdges.count({edge.second, edge.first}))
+			{
+				horizon.push_back(edge);
+			}
+		}
+
+		size_t kept = 0;
+		for (size_t f = 0; f < faces.size(); f++)
+		{
+			if (!visible[f])
+			{
+				faces[kept] = faces[f];
+				normals[kept++] = normals[f];
+			}
+		}
+		faces.resize(kept);
+		normals.resize(kept);
+
+		for (const auto &edge : horizon)
+		{
+			addFace(edge.first, edge.second, p);
+		}
+	}
+	return true;
+}
+
+// Triangulation as emitted, plus the candidate lists for each lookup cell
+typedef struct triangulationTables_t
+{
+	std::vector<std::array<uint16_t, BlendDirections>> triangles;
+	std::vector<std::array<double, 9>> inverse;
+	std::vector<uint32_t> cellStart;
+	std::vector<uint16_t> cellTriangles;
+	bool ring; // Horizontal-only set, triangles are azimuth segments
+} triangulationTables_t;
+
+static double smallestWeight(const triangulationTables_t &tables, size_t t, const vec3_t &direction)
+{
+	const std::array<double, 9> &m = tables.inverse[t];
+	double score = INFINITY;
+	for (size_t j = 0; j < (tables.ring ? 2u : 3u); j++)
+	{
+		score = std::min(score, m[3 * j] * direction.x + m[3 * j + 1] * direction.y + m[3 * j + 2] * direction.z);
+	}
+	return score;
+}
+
+/**
+ * @brief Triangulate the measurement directions and bucket the triangles into the lookup cells used by hrirLookup()
+ *
+ */
+static triangulationTables_t triangulate(const std::vector<measurement_t> &measurements)
+{
+	triangulationTables_t tables = {};
+
+	// Repeated directions (several azimuths at a pole, for example) would only give flat triangles
+	std::vector<vec3_t> points;
+	std::vector<uint16_t> pairIndex;
+	for (size_t m = 0; m < measurements.size(); m++)
+	{
+		const vec3_t v = unitVector(measurements[m].azimuth, measurements[m].elevation);
+		if (std::none_of(points.begin(), points.end(), [&](const vec3_t &p) { return dot(p, v) > 1.0 - 1e-9; }))
+		{
+			points.push_back(v);
+			pairIndex.push_back((uint16_t)m);
+		}
+	}
+
+	std::vector<triangle_t> faces;
+	tables.ring = (points.size() > 1) && !convexHull(points, faces);
+
+	if (points.size() == 1)
+	{
+		// Single direction, every lookup falls back to corner 0
+		tables.triangles.push_back({pairIndex[0], pairIndex[0], pairIndex[0]});
+		tables.inverse.push_back({});
+	}
+	else if (tables.ring)
+	{
+		// Segments between neighbouring azimuths, weighted in the horizontal plane
+		std::vector<size_t> order(points.size());
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			order[i] = i;
+		}
+		std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return atan2(points[a].y, points[a].x) < atan2(points[b].y, points[b].x); });
+
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			const vec3_t &a = points[order[i]];
+			const vec3_t &b = points[order[(i + 1) % order.size()]];
+			const double det = a.x * b.y - b.x * a.y;
+			if (det < 1e-9)
+			{
+				continue; // Gap of 180 degrees or more
+			}
+			tables.triangles.push_back({pairIndex[order[i]], pairIndex[order[(i + 1) % order.size()]], pairIndex[order[(i + 1) % order.size()]]});
+			tables.inverse.push_back({b.y / det, -b.x / det, 0, -a.y / det, a.x / det, 0, 0, 0, 0});
+		}
+	}
+	else
+	{
+		for (const auto &face : faces)
+		{
+			const vec3_t &a = points[face[0]];
+			const vec3_t &b = points[face[1]];
+			const vec3_t &c = points[face[2]];
+			const double det = dot(a, cross(b, c));
+			if (fabs(det) < 1e-9)
+			{
+				continue; // Face through the centre, left by a gap in the measurement grid
+			}
+
+			// Rows of the inverse of [a b c] are the cross products of the other two columns
+			const vec3_t rows[3] = {(1.0 / det) * cross(b, c), (1.0 / det) * cross(c, a), (1.0 / det) * cross(a, b)};
+			tables.triangles.push_back({pairIndex[face[0]], pairIndex[face[1]], pairIndex[face[2]]});
+			tables.inverse.push_back({rows[0].x, rows[0].y, rows[0].z, rows[1].x, rows[1].y, rows[1].z, rows[2].x, rows[2].y, rows[2].z});
+		}
+	}
+
+	if (tables.triangles.empty())
+	{
+		fatal("%s", "Measurement directions can't be triangulated");
+	}
+
+	// Bounding cap of every triangle
+	const size_t triangleCount = tables.triangles.size();
+	std::vector<vec3_t> capCentre(triangleCount);
+	std::vector<double> capRadius(triangleCount);
+	std::vector<double> segmentStart(triangleCount), segmentWidth(triangleCount);
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		vec3_t corners[3];
+		for (size_t j = 0; j < 3; j++)
+		{
+			const measurement_t &m = measurements[tables.triangles[t][j]];
+			corners[j] = unitVector(m.azimuth, m.elevation);
+		}
+
+		capCentre[t] = normalized(corners[0] + corners[1] + corners[2]);
+		capRadius[t] = std::max({angleBetween(capCentre[t], corners[0]), angleBetween(capCentre[t], corners[1]), angleBetween(capCentre[t], corners[2])});
+
+		segmentStart[t] = fmod(atan2(corners[0].y, corners[0].x) * 180.0 / M_PI + 360.0, 360.0);
+		segmentWidth[t] = fmod(atan2(corners[1].y, corners[1].x) * 180.0 / M_PI - segmentStart[t] + 720.0, 360.0);
+	}
+
+	// A triangle is a candidate for every cell whose bounding cap overlaps its own
+	tables.cellStart.push_back(0);
+	for (size_t row = 0; row < ElevationCells; row++)
+	{
+		for (size_t column = 0; column < AzimuthCells; column++)
+		{
+			const double azimuth = (column + 0.5) * CellDegrees;
+			const double elevation = (row + 0.5) * CellDegrees - 90.0;
+			const vec3_t centre = unitVector(azimuth, elevation);
+
+			double radius = 0;
+			for (size_t k = 0; k <= 8; k++)
+			{
+				const double along = k * CellDegrees / 8.0;
+				radius = std::max(radius, angleBetween(centre, unitVector(column * CellDegrees + along, row * CellDegrees - 90.0)));
+				radius = std::max(radius, angleBetween(centre, unitVector(column * CellDegrees + along, (row + 1) * CellDegrees - 90.0)));
+				radius = std::max(radius, angleBetween(centre, unitVector(column * CellDegrees, row * CellDegrees - 90.0 + along)));
+				radius = std::max(radius, angleBetween(centre, unitVector((column + 1) * CellDegrees, row * CellDegrees - 90.0 + along)));
+			}
+
+			const size_t first = tables.cellTriangles.size();
+			for (size_t t = 0; t < triangleCount; t++)
+			{
+				bool overlaps;
+				if (tables.ring)
+				{
+					// Segments cover every elevation, only azimuth matters
+					const double offset = fmod(column * CellDegrees - segmentStart[t] + 360.0, 360.0);
+					overlaps = (offset <= segmentWidth[t]) || (offset >= 360.0 - CellDegrees);
+				}
+				else
+				{
+					overlaps = angleBetween(centre, capCentre[t]) <= radius + capRadius[t];
+				}
+
+				if (overlaps)
+				{
+					tables.cellTriangles.push_back((uint16_t)t);
+				}
+			}
+
+			if (tables.cellTriangles.size() == first)
+			{
+				// Nothing nearby, fall back to the closest triangle
+				size_t nearest = 0;
+				for (size_t t = 1; t < triangleCount; t++)
+				{
+					nearest = (smallestWeight(tables, t, centre) > smallestWeight(tables, nearest, centre)) ? t : nearest;
+				}
+				tables.cellTriangles.push_back((uint16_t)nearest);
+			}
+			tables.cellStart.push_back((uint32_t)tables.cellTriangles.size());
+		}
+	}
+
+	return tables;
+}
+
+/**
+ * @brief Triangulation in the format read by interpolation.c
+ *
+ */
+static void writeTriangulation(const char *path, const std::vector<measurement_t> &measurements)
+{
+	const triangulationTables_t tables = triangulate(measurements);
+	std::string text;
+
+	char header[640];
+	snprintf(header, sizeof(header),
+			 "/**\n * @file triangulation.h\n * @brief %s of the %zu HRIR directions in tablIR.h. Generated by tools/hrirc.cpp, do not edit\n */\n\n"
+			 "#pragma once\n\nenum TriangulationSize\n{\n\tIrTriangleCount = %zu,\n\tIrCellEntries = %zu\n};\n\n"
+			 "static const uint16_t irTriangles[IrTriangleCount][BlendDirections] _section_progmem = {\n",
+			 tables.ring ? "Azimuth segments" : "Spherical triangulation", measurements.size(), tables.triangles.size(), tables.cellTriangles.size());
+	text += header;
+
+	for (const auto &triangle : tables.triangles)
+	{
+		char line[64];
+		snprintf(line, sizeof(line), "\t{%u, %u, %u},\n", triangle[0], triangle[1], triangle[2]);
+		text += line;
+	}
+
+	text += "};\n\nstatic const float32_t irTriangleInverse[IrTriangleCount][9] _section_progmem = {\n";
+	for (const auto &inverse : tables.inverse)
+	{
+		const float values[9] = {(float)inverse[0], (float)inverse[1], (float)inverse[2], (float)inverse[3], (float)inverse[4],
+								 (float)inverse[5], (float)inverse[6], (float)inverse[7], (float)inverse[8]};
+		text += "\t{";
+		for (size_t i = 0; i < 9; i++)
+		{
+			appendFloat(text, values[i]);
+			text += (i < 8) ? " " : "";
+		}
+		text += "},\n";
+	}
+
+	text += "};\n\nstatic const uint32_t irCellStart[TriangulationCellCount + 1] _section_progmem = {\n";
+	for (size_t i = 0; i < tables.cellStart.size(); i++)
+	{
+		text += (i % 16) ? " " : "\t";
+		text += std::to_string(tables.cellStart[i]) + ",";
+		text += ((i + 1) % 16 && (i + 1) < tables.cellStart.size()) ? "" : "\n";
+	}
+
+	text += "};\n\nstatic const uint16_t irCellTriangles[IrCellEntries] _section_progmem = {\n";
+	for (size_t i = 0; i < tables.cellTriangles.size(); i++)
+	{
+		text += (i % 16) ? " " : "\t";
+		text += std::to_string(tables.cellTriangles[i]) + ",";
+		text += ((i + 1) % 16 && (i + 1) < tables.cellTriangles.size()) ? "" : "\n";
+	}
+
+	text += "};\n\nstatic const triangulation_t triangulation = {IrTriangleCount, irTriangles, irTriangleInverse, irCellStart, irCellTriangles};\n";
+	writeText(path, {text});
+	printf("%s: %zu %s, %.1f candidates per cell\n", path, tables.triangles.size(), tables.ring ? "segments" : "triangles",
+		   (double)tables.cellTriangles.size() / TriangulationCellCount);
+}
+
+int main(int argc, char **argv)
+{
+	const char *tablePath = "include/tablIR.h";
+	const char *triangulationPath = "include/triangulation.h";
+	const char *bankPath = NULL;
+	double azimuthStep = 0;
+	bool normalize = true;
+	bool pruningReport = false;
+	unsigned threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+	int opt;
+	while ((opt = getopt(argc, argv, "o:t:b:a:n:j:p")) != -1)
+	{
+		switch (opt)
+		{
+		case 'o':
+			tablePath = optarg;
+			break;
+		case 't':
+			triangulationPath = optarg;
+			break;
+		case 'b':
+			bankPath = optarg;
+			break;
+		case 'a':
+			azimuthStep = strtod(optarg, NULL);
+			break;
+		case 'n':
+			normalize = strcmp(optarg, "none");
+			break;
+		case 'j':
+			threadCount = std::max(1ul, strtoul(optarg, NULL, 10));
+			break;
+		case 'p':
+			pruningReport = true;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-o tablIR.h] [-t triangulation.h] [-b spectralBank.h] [-a azimuthStep] [-n spectral|none] [-j threads] [-p] input...\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	std::vector<measurement_t> measurements;
+	for (int i = optind; i < argc; i++)
+	{
+		const std::string path = argv[i];
+		const std::string extension = path.substr(path.find_last_of('.') + 1);
+
+		if (extension == "sofa" || extension == "SOFA")
+		{
+#ifdef HRIRC_SOFA
+			loadSofa(path, measurements);
+#else
+			fatal("%s: built without SOFA support (HRIRC_SOFA)", path.c_str());
+#endif
+		}
+		else
+		{
+			measurements.push_back(loadWav(path));
+		}
+	}
+
+	if (measurements.empty())
+	{
+		fatal("%s", "No input measurements");
+	}
+
+	if (azimuthStep > 0)
+	{
+		measurements = horizontalGrid(measurements, azimuthStep);
+	}
+	else
+	{
+		std::stable_sort(measurements.begin(), measurements.end(), [](const measurement_t &a, const measurement_t &b) {
+			return (a.elevation != b.elevation) ? (a.elevation < b.elevation) : (a.azimuth < b.azimuth);
+		});
+	}
+
+	// One resampler per distinct source rate
+	std::vector<resampler_t> resamplers;
+	std::vector<size_t> resamplerIndex(measurements.size());
+	for (size_t m = 0; m < measurements.size(); m++)
+	{
+		auto match = std::find_if(resamplers.begin(), resamplers.end(), [&](const resampler_t &r) {
+			return r.sourceRate == measurements[m].sampleRate;
+		});
+		if (match == resamplers.end())
+		{
+			resamplers.push_back(makeResampler(measurements[m].sampleRate));
+			match = resamplers.end() - 1;
+		}
+		resamplerIndex[m] = match - resamplers.begin();
+	}
+
+	// Resample and fit every direction, noting its spectral peak for the shared gain
+	std::vector<double> peaks(measurements.size());
+	std::atomic<size_t> clampedDelays(0);
+	parallelFor(measurements.size(), threadCount, [&](size_t m) {
+		measurement_t &measurement = measurements[m];
+		for (size_t ear = 0; ear < 2; ear++)
+		{
+			std::vector<float> &ir = measurement.ir[ear];
+			ir = resample(ir, resamplers[resamplerIndex[m]]);
+#ifdef UPOLS_MINIMUM_PHASE
+			measurement.delay[ear] = minimumPhase(ir);
+#else
+			measurement.delay[ear] = 0;
+#endif
+			fitLength(ir);
+		}
+
+		// Only the interaural difference is kept, the earlier ear plays without delay
+		const float common = std::min(measurement.delay[LeftFilter], measurement.delay[RightFilter]);
+		for (size_t ear = 0; ear < 2; ear++)
+		{
+			measurement.delay[ear] -= common;
+			if (measurement.delay[ear] > ItdMaxSamples)
+			{
+				measurement.delay[ear] = ItdMaxSamples;
+				clampedDelays++;
+			}
+		}
+		peaks[m] = spectralPeak(measurement.ir[LeftFilter], measurement.ir[RightFilter]);
+	});
+
+	const double peak = *std::max_element(peaks.begin(), peaks.end());
+	const float gain = (normalize && peak > 0) ? (float)(1.0 / peak) : 1.0f;
+
+	// Format each pair in parallel, then write them out in order
+	std::vector<std::string> parts(measurements.size() + 2);
+	parallelFor(measurements.size(), threadCount, [&](size_t m) {
+		std::string &text = parts[m + 1];
+		char comment[96];
+		snprintf(comment, sizeof(comment), "\t// %zu: azimuth %.1f, elevation %.1f\n", m, measurements[m].azimuth, measurements[m].elevation);
+		text += comment;
+
+		for (size_t ear = 0; ear < 2; ear++)
+		{
+			std::vector<float> &ir = measurements[m].ir[ear];
+			for (auto &tap : ir)
+			{
+				tap *= gain;
+			}
+			appendFloats(text, ir.data(), ir.size(), "\t");
+		}
+	});
+
+#ifdef UPOLS_MINIMUM_PHASE
+	const char *phase = "minimum-phase ";
+#else
+	const char *phase = "";
+#endif
+
+	char header[768];
+	snprintf(header, sizeof(header),
+			 "/**\n * @file tablIR.h\n * @brief %zu %sHRIR pairs at %d Hz, %d taps per ear. Generated by tools/hrirc.cpp, do not edit\n */\n\n"
+			 "#pragma once\n\nenum TablIR\n{\n\tIrPairCount = %zu\n};\n\n"
+			 "// [pair][left, right][tap]\nconst float32_t irTable[] _section_progmem = {\n",
+			 measurements.size(), phase, TargetSampleRate, ImpulseSamples, measurements.size());
+	parts.front() = header;
+
+	std::string directions = "};\n\n// Azimuth and elevation of each pair in degrees\nconst float32_t irDirections[IrPairCount][2] _section_progmem = {\n";
+	for (const auto &measurement : measurements)
+	{
+		char line[64];
+		snprintf(line, sizeof(line), "\t{%.2ff, %.2ff},\n", measurement.azimuth, measurement.elevation);
+		directions += line;
+	}
+#ifdef UPOLS_MINIMUM_PHASE
+	directions += "};\n\n// Interaural delay split off each ear of the minimum-phase pairs, in samples\nconst float32_t irDelay[IrPairCount][2] _section_progmem = {\n";
+	for (const auto &measurement : measurements)
+	{
+		char line[64];
+		snprintf(line, sizeof(line), "\t{%.4ff, %.4ff},\n", measurement.delay[LeftFilter], measurement.delay[RightFilter]);
+		directions += line;
+	}
+#endif
+	parts.back() = directions + "};\n";
+
+	writeText(tablePath, parts);
+	printf("%s: %zu HRIR pairs, gain %.3f dB\n", tablePath, measurements.size(), 20.0 * log10(gain));
+	if (clampedDelays)
+	{
+		printf("%s: %zu interaural delays clamped to %d samples\n", tablePath, clampedDelays.load(), ItdMaxSamples);
+	}
+
+	writeTriangulation(triangulationPath, measurements);
+
+	if (bankPath)
+	{
+		writeSpectralBank(bankPath, measurements);
+		printf("%s: %zu spectral filter sets\n", bankPath, measurements.size());
+	}
+
+	if (pruningReport)
+	{
+#if defined(UPOLS_PARTITION_PRUNING) || defined(UPOLS_BAND_PRUNING)
+		reportPruning(measurements);
+#else
+		fprintf(stderr, "-p: built without UPOLS_PARTITION_PRUNING or UPOLS_BAND_PRUNING\n");
+#endif
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,191 @@
+/**
+ * @file spectralBank.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Build-time generator for the flash-resident spectral HRTF bank
+ * @version 0.1
+ * @date 2021-12-11
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ * @details
+ * Runs computeFilters() from libupols on the host for every HRIR pair in include/tablIR.h and
+ * writes the resulting filters_t structs as a C initializer. Spectra come from the same code
+ * path the firmware would otherwise run after every angle change, so both are bit-compatible
+ * apart from FFT rounding differences between the portable backend and CMSIS-DSP.
+ *
+ * Usage: spectralBank [-s stride] [-o include/spectralBank.h]
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "upols.h"
+
+static filters_t bank;
+
+/**
+ * @brief Print a float literal that round-trips exactly
+ *
+ */
+static void emitFloat(FILE *out, float32_t value)
+{
+	char literal[32];
+	snprintf(literal, sizeof(literal), "%.9g", value);
+	fprintf(out, "%s%sf", literal, strpbrk(literal, ".e") ? "" : ".0");
+}
+
+/**
+ * @brief Write count floats as a brace-enclosed initializer list
+ *
+ */
+static void emitFloats(FILE *out, const float32_t *values, size_t count, const char *indent)
+{
+	fprintf(out, "{\n%s\t", indent);
+	for (size_t i = 0; i < count; i++)
+	{
+		emitFloat(out, values[i]);
+		fprintf(out, ",%s", ((i + 1) % 8) ? " " : "");
+		if (!((i + 1) % 8) && (i + 1 < count))
+		{
+			fprintf(out, "\n%s\t", indent);
+		}
+	}
+	fprintf(out, "\n%s}", indent);
+}
+
+#ifdef UPOLS_PARTITION_PRUNING
+/**
+ * @brief Write the energy and active partition lists pruneFilters() left in the bank
+ *
+ */
+static void emitPruning(FILE *out, const partitionPruning_t *pruning)
+{
+	fprintf(out, "\t\t.pruning = {\n\t\t\t.energy = {");
+	emitFloats(out, pruning->energy[LeftFilter], PartitionCount, "\t\t\t");
+	fprintf(out, ", ");
+	emitFloats(out, pruning->energy[RightFilter], PartitionCount, "\t\t\t");
+	fprintf(out, "},\n\t\t\t.activeEars = {");
+	for (size_t i = 0; i < PartitionCount; i++)
+	{
+		fprintf(out, "%u,", pruning->activeEars[i]);
+	}
+	fprintf(out, "},\n\t\t\t.activeList = {");
+	for (size_t i = 0; i < PartitionCount; i++)
+	{
+		fprintf(out, "%u,", pruning->activeList[i]);
+	}
+	fprintf(out, "},\n\t\t\t.activeCount = %u,\n\t\t},\n", pruning->activeCount);
+}
+#endif
+
+#ifdef UPOLS_BAND_PRUNING
+/**
+ * @brief Write the band limitFilterBands() found for every partition
+ *
+ */
+static void emitBands(FILE *out, const filters_t *bank)
+{
+	fprintf(out, "\t\t.bandBins = {");
+	for (size_t ear = 0; ear < 2; ear++)
+	{
+		fprintf(out, "{");
+		for (size_t i = 0; i < PartitionCount; i++)
+		{
+			fprintf(out, "%u,", bank->bandBins[ear][i]);
+		}
+		fprintf(out, "}, ");
+	}
+	fprintf(out, "},\n");
+}
+#endif
+
+int main(int argc, char **argv)
+{
+	unsigned long stride = 1;
+	const char *outputPath = NULL;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "s:o:")) != -1)
+	{
+		switch (opt)
+		{
+		case 's':
+			stride = strtoul(optarg, NULL, 10);
+			break;
+		case 'o':
+			outputPath = optarg;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-s stride] [-o output]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (stride == 0)
+	{
+		fprintf(stderr, "Stride must be at least 1\n");
+		return EXIT_FAILURE;
+	}
+
+	FILE *out = outputPath ? fopen(outputPath, "w") : stdout;
+	if (!out)
+	{
+		perror(outputPath);
+		return EXIT_FAILURE;
+	}
+
+	const uint16_t pairCount = hrirCount();
+	const size_t bankCount = (pairCount + stride - 1) / stride;
+
+	fprintf(out, "/**\n * @file spectralBank.h\n");
+	fprintf(out, " * @brief Partition spectra for %zu HRIR pairs. Generated by tools/spectralBank.c, do not edit\n */\n\n", bankCount);
+	fprintf(out, "#pragma once\n\n");
+	fprintf(out, "enum SpectralBankSize\n{\n\tSpectralBankCount = %zu,\n\tSpectralBankStride = %lu\n};\n\n", bankCount, stride);
+	fprintf(out, "static const filters_t spectralBank[SpectralBankCount] _section_progmem = {\n");
+
+	for (size_t irIndex = 0; irIndex < pairCount; irIndex += stride)
+	{
+		computeFilters(&bank, (uint16_t)irIndex);
+
+		fprintf(out, "\t{\n\t\t.left = ");
+		emitFloats(out, bank.left, FilterSpectrumFloats * PartitionCount, "\t\t");
+		fprintf(out, ",\n\t\t.right = ");
+		emitFloats(out, bank.right, FilterSpectrumFloats * PartitionCount, "\t\t");
+		fprintf(out, ",\n\t\t.head = {");
+		emitFloats(out, bank.head[LeftFilter], HybridHeadTaps, "\t\t");
+		fprintf(out, ", ");
+		emitFloats(out, bank.head[RightFilter], HybridHeadTaps, "\t\t");
+		fprintf(out, "},\n");
+#ifdef UPOLS_MINIMUM_PHASE
+		fprintf(out, "\t\t.delay = {");
+		emitFloat(out, bank.delay[LeftFilter]);
+		fprintf(out, ", ");
+		emitFloat(out, bank.delay[RightFilter]);
+		fprintf(out, "},\n");
+#endif
+#ifdef UPOLS_PARTITION_PRUNING
+		emitPruning(out, &bank.pruning);
+#endif
+#ifdef UPOLS_BAND_PRUNING
+		emitBands(out, &bank);
+#endif
+#ifdef UPOLS_SUBBAND
+		fprintf(out, "\t\t.subband = {");
+		emitFloats(out, bank.subband[LeftFilter], SubbandSpectrumFloats * SubbandFilterPartitions, "\t\t");
+		fprintf(out, ", ");
+		emitFloats(out, bank.subband[RightFilter], SubbandSpectrumFloats * SubbandFilterPartitions, "\t\t");
+		fprintf(out, "},\n");
+#endif
+		fprintf(out, "\t},\n");
+	}
+
+	fprintf(out, "};\n");
+
+	if (out != stdout)
+	{
+		fclose(out);
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,66 @@
+# PlatformIO pre-build script: regenerate include/spectralBank.h when UPOLS_SPECTRAL_BANK is set
+# and the HRIR table or the generator is newer than the bank, or the UPOLS_* defines that shape filters_t
+# have changed. Builds the generator with the host compiler.
+
+import os
+import subprocess
+
+Import("env")
+
+projectDir = env.subst("$PROJECT_DIR")
+bankPath = os.path.join(projectDir, "include", "spectralBank.h")
+toolPath = os.path.join(env.subst("$PROJECT_BUILD_DIR"), "spectralBank")
+definesPath = toolPath + ".defines"
+
+toolSources = [
+    os.path.join(projectDir, "tools", "spectralBank.c"),
+    os.path.join(projectDir, "lib", "upols", "upols.c"),
+    os.path.join(projectDir, "lib", "upols", "math512.c"),
+    os.path.join(projectDir, "lib", "upols", "dspBackend.c"),
+    os.path.join(projectDir, "lib", "upols", "subband.c"),
+    os.path.join(projectDir, "lib", "upols", "room.c"),
+]
+dependencies = toolSources + [
+    os.path.join(projectDir, "include", "tablIR.h"),
+    os.path.join(projectDir, "lib", "upols", "upols.h"),
+]
+
+
+def defineName(define):
+    return define[0] if isinstance(define, (list, tuple)) else define
+
+
+def bankEnabled():
+    return any(defineName(define) == "UPOLS_SPECTRAL_BANK" for define in env.get("CPPDEFINES", []))
+
+
+def layoutDefines():
+    # The generator has to see the same filters_t as the firmware, but not the bank it is generating
+    flags = []
+    for define in env.get("CPPDEFINES", []):
+        name = defineName(define)
+        if name.startswith("UPOLS_") and name != "UPOLS_SPECTRAL_BANK":
+            value = define[1] if isinstance(define, (list, tuple)) and len(define) > 1 else None
+            flags.append("-D%s" % name if value is None else "-D%s=%s" % (name, value))
+    return sorted(flags)
+
+
+def bankStale():
+    if not os.path.exists(bankPath) or not os.path.exists(definesPath):
+        return True
+    with open(definesPath) as defines:
+        if defines.read().split() != layoutDefines():
+            return True
+    bankTime = os.path.getmtime(bankPath)
+    return any(os.path.getmtime(path) > bankTime for path in dependencies if os.path.exists(path))
+
+
+if bankEnabled() and bankStale():
+    stride = env.GetProjectOption("custom_spectral_bank_stride", "1")
+    os.makedirs(os.path.dirname(toolPath), exist_ok=True)
+    print("Generating spectralBank.h (stride %s)" % stride)
+    subprocess.check_call([os.environ.get("HOSTCC", "cc"), "-O2", "-I" + os.path.join(projectDir, "lib", "upols")]
+                          + layoutDefines() + toolSources + ["-lm", "-o", toolPath])
+    subprocess.check_call([toolPath, "-s", stride, "-o", bankPath])
+    with open(definesPath, "w") as defines:
+        defines.write(" ".join(layoutDefines()))